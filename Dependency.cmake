@@ -64,6 +64,9 @@ ExternalProject_Add(
     INSTALL_COMMAND ${CMAKE_COMMAND} -E copy # cross-platform (macOS, Linux, Window)
         ${PROJECT_BINARY_DIR}/dep_stb-prefix/src/dep_stb/stb_image.h # set clone dir in "build" dir
         ${DEP_INSTALL_DIR}/include/stb/stb_image.h
+    COMMAND ${CMAKE_COMMAND} -E copy
+        ${PROJECT_BINARY_DIR}/dep_stb-prefix/src/dep_stb/stb_image_write.h
+        ${DEP_INSTALL_DIR}/include/stb/stb_image_write.h
 )
 set(DEP_LIST ${DEP_LIST} dep_stb)
 
@@ -4,6 +4,7 @@ uniform mat4 projTransform;
 uniform float pointRadius;
 
 in vec3 eyeSpacePos;
+in float radiusScale;
 
 void main() {
     // Calculate Normal of the fragment Points
@@ -17,7 +18,7 @@ void main() {
     // pixelNorm = transpose(pointTransform)*normalize(pixelNorm);
     pixelNorm = normalize(pixelNorm);
 
-    vec4 pixelPos = vec4(eyeSpacePos + pixelNorm.xyz*pointRadius, 1.0);
+    vec4 pixelPos = vec4(eyeSpacePos + pixelNorm.xyz*pointRadius*radiusScale, 1.0);
     vec4 clipSpacePos = projTransform * pixelPos;
     gl_FragDepth = clipSpacePos.z / clipSpacePos.w;
     // gl_FragColor = vec4(vec3(clipSpacePos.z / clipSpacePos.w), 1.0);
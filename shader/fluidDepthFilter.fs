@@ -0,0 +1,68 @@
+#version 330 core
+in vec2 texCoord;
+out vec4 fragColor;
+
+// one separable pass over the fluid depth : the stored value is the clip space z of fluidDepth.fs,
+// 1 where there is no fluid, and the filter weighs eye space distances
+uniform sampler2D texDepth;
+uniform mat4 projTransform;
+uniform vec2 direction;         // (1, 0) horizontal, (0, 1) vertical
+uniform float filterRadius;     // eye space half width of the kernel
+uniform float pointScale;       // pixels per eye space unit at distance 1
+uniform int maxHalfWidth;       // pixels
+uniform float depthRange;       // eye space distance between surfaces
+uniform int narrowRange;        // 0 : bilateral, 1 : narrow range
+
+float ToEyeDistance(float depth)
+{
+	return projTransform[3][2] / (depth + projTransform[2][2]);
+}
+
+float ToDepth(float distance)
+{
+	return projTransform[3][2] / distance - projTransform[2][2];
+}
+
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	ivec2 maxPixel = textureSize(texDepth, 0) - 1;
+	float depth = texelFetch(texDepth, pixel, 0).r;
+	if (depth >= 1.0f)
+	{
+		fragColor = vec4(1.0f);
+		return;
+	}
+
+	// the kernel covers the same eye space extent at any distance
+	float center = ToEyeDistance(depth);
+	int halfWidth = min(maxHalfWidth, int(ceil(filterRadius * pointScale / center)));
+	float sigma = max(0.5f * float(halfWidth), 0.5f);
+	ivec2 axis = ivec2(direction);
+
+	float sum = 0.0f;
+	float weightSum = 0.0f;
+	for (int i = -halfWidth; i <= halfWidth; ++i)
+	{
+		float sampleDepth = texelFetch(texDepth, clamp(pixel + i * axis, ivec2(0), maxPixel), 0).r;
+		if (sampleDepth >= 1.0f)
+			continue;
+		float distance = ToEyeDistance(sampleDepth);
+		float weight = exp(-float(i * i) / (2.0f * sigma * sigma));
+		if (narrowRange != 0)
+		{
+			// a surface behind belongs to another layer : skip it,
+			// one in front is pulled in so silhouettes stay smooth without bleeding
+			if (distance > center + depthRange)
+				continue;
+			distance = max(distance, center - depthRange);
+		}
+		else
+		{
+			float difference = (distance - center) / depthRange;
+			weight *= exp(-difference * difference);
+		}
+		sum += weight * distance;
+		weightSum += weight;
+	}
+	fragColor = vec4(ToDepth(sum / weightSum));
+}
@@ -9,6 +9,8 @@ uniform sampler2D texDepth;
 uniform mat4 iProjTransform;
 uniform mat4 iViewTransform;
 uniform mat4 viewTransform;
+uniform mat4 projTransform;
+uniform float depthRange;   // eye space distance between surfaces
 
 
 vec4 liquidColor = vec4(0.0, 0.5, 1.0, 1.0);
@@ -34,9 +36,51 @@ vec3 uvToEye(vec2 coord, float z)
 	return viewPos.xyz / viewPos.w;
 }
 
+float ToEyeDistance(float depth)
+{
+	return projTransform[3][2] / (depth + projTransform[2][2]);
+}
+
+// depth at coord from a depth texture of any resolution : bilinear over the texels on the nearest surface only,
+// so neither the background nor a surface behind leaks into the silhouettes
+float SampleDepth(vec2 coord)
+{
+	vec2 size = vec2(textureSize(texDepth, 0));
+	vec2 st = coord * size - 0.5f;
+	ivec2 base = ivec2(floor(st));
+	vec2 f = st - vec2(base);
+	ivec2 maxTexel = ivec2(size) - 1;
+
+	float depths[4];
+	float weights[4] = float[4]((1.0f - f.x) * (1.0f - f.y), f.x * (1.0f - f.y), (1.0f - f.x) * f.y, f.x * f.y);
+	float nearest = 1.0f;
+	for (int i = 0; i < 4; ++i)
+	{
+		depths[i] = texelFetch(texDepth, clamp(base + ivec2(i & 1, i >> 1), ivec2(0), maxTexel), 0).r;
+		nearest = min(nearest, depths[i]);
+	}
+	if (nearest >= 1.0f)
+		return 1.0f;
+
+	float nearestDistance = ToEyeDistance(nearest);
+	float sum = 0.0f;
+	float weightSum = 0.0f;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (depths[i] >= 1.0f || ToEyeDistance(depths[i]) > nearestDistance + depthRange)
+			continue;
+		sum += weights[i] * depths[i];
+		weightSum += weights[i];
+	}
+	// mostly off the surface : keep the silhouette where the coarse texels put it
+	if (weightSum < 0.5f)
+		return 1.0f;
+	return sum / weightSum;
+}
+
 void main() {
 
-    float depth = texture(texDepth, texCoord).r;
+    float depth = SampleDepth(texCoord);
 	gl_FragDepth = depth;
 	if(depth <= -1.0f || depth >= 1.0f)
 	{
@@ -52,13 +96,13 @@ void main() {
 	vec3 eyeSpacePos = uvToEye(texCoord, depth);
 	// finite difference.
 	vec3 ddxLeft   = eyeSpacePos - uvToEye(texCoord - vec2(depthTexelSize.x,0.0f),
-					texture(texDepth, texCoord - vec2(depthTexelSize.x,0.0f)).r);
+					SampleDepth(texCoord - vec2(depthTexelSize.x,0.0f)));
 	vec3 ddxRight  = uvToEye(texCoord + vec2(depthTexelSize.x,0.0f),
-					texture(texDepth, texCoord + vec2(depthTexelSize.x,0.0f)).r) - eyeSpacePos;
+					SampleDepth(texCoord + vec2(depthTexelSize.x,0.0f))) - eyeSpacePos;
 	vec3 ddyTop    = uvToEye(texCoord + vec2(0.0f,depthTexelSize.y),
-					texture(texDepth, texCoord + vec2(0.0f,depthTexelSize.y)).r) - eyeSpacePos;
+					SampleDepth(texCoord + vec2(0.0f,depthTexelSize.y))) - eyeSpacePos;
 	vec3 ddyBottom = eyeSpacePos - uvToEye(texCoord - vec2(0.0f,depthTexelSize.y),
-					texture(texDepth, texCoord - vec2(0.0f,depthTexelSize.y)).r);
+					SampleDepth(texCoord - vec2(0.0f,depthTexelSize.y)));
 	vec3 dx = ddxLeft;
 	vec3 dy = ddyTop;
 	if(abs(ddxRight.z) < abs(ddxLeft.z))
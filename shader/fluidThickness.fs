@@ -1,5 +1,6 @@
 #version 330 core
 
+in float radiusScale;
 out vec4 fragColor;
 
 void main() {
@@ -13,5 +14,5 @@ void main() {
 
     pixelNorm = normalize(pixelNorm);
 
-	fragColor = vec4(pixelNorm.z*0.025, 0.0, 0.0, 1.0);
+	fragColor = vec4(pixelNorm.z*0.025*radiusScale, 0.0, 0.0, 1.0);
 }
\ No newline at end of file
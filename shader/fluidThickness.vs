@@ -1,14 +1,17 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+layout (location = 0) in vec4 aPos; // w : radius scale, 1 for a particle with only xyz given
 
 uniform mat4 transform;
 uniform mat4 viewTransform;
 uniform float pointRadius;
 uniform float pointScale;
 
+out float radiusScale;
+
 void main() {
-	vec4 viewPosition = viewTransform * vec4(aPos, 1.0);
+	vec4 viewPosition = viewTransform * vec4(aPos.xyz, 1.0);
 
-    gl_Position = transform * vec4(aPos, 1.0);
-	gl_PointSize = - (pointScale * pointRadius / viewPosition.z);
+    gl_Position = transform * vec4(aPos.xyz, 1.0);
+	gl_PointSize = - (pointScale * pointRadius * aPos.w / viewPosition.z);
+	radiusScale = aPos.w;
 }
\ No newline at end of file
@@ -1,6 +1,103 @@
 #include "hiphysics.h"
 #include "hiphysicsPBD.h"
 
+#include <algorithm>
+#include <limits>
+#include <thrust/copy.h>
+#include <thrust/transform_reduce.h>
+#include <thrust/iterator/counting_iterator.h>
+#include <thrust/scatter.h>
+#include <thrust/sequence.h>
+
+// stencil predicate grouping particles by the state of matter of their phase
+struct IsPhaseType {
+    const PhaseParameters* phaseParam;
+    StateOfMatter phaseType;
+    __host__ __device__ bool operator()(int32_t phase) const { return phaseParam[phase].phaseType == phaseType; }
+};
+
+// axis aligned bounds of the corrected positions, reduced on the device
+struct PositionBounds {
+    glm::vec3 minPoint;
+    glm::vec3 maxPoint;
+};
+
+struct ToPositionBounds {
+    __host__ __device__ PositionBounds operator()(const glm::vec3& position) const { return { position, position }; }
+};
+
+struct MergePositionBounds {
+    __host__ __device__ PositionBounds operator()(const PositionBounds& a, const PositionBounds& b) const {
+        return { glm::min(a.minPoint, b.minPoint), glm::max(a.maxPoint, b.maxPoint) };
+    }
+};
+
+// particles are stored in grid order on the device : copy them back in SimBuffer order
+template <typename T>
+static void CopyToHostBySlots(T* hostDst, const T* deviceSrc, const int32_t* slots, uint64_t count)
+{
+    thrust::device_vector<T> temp(count);
+    thrust::gather(thrust::device_pointer_cast(slots), thrust::device_pointer_cast(slots) + count, 
+                   thrust::device_pointer_cast(deviceSrc), temp.begin());
+    thrust::copy(temp.begin(), temp.end(), hostDst);
+}
+
+// multipliers are gathered by the size of their storage type, their bits are moved untouched
+template <typename T>
+static void GatherBits(void* data, const thrust::device_vector<int>& indices, uint64_t count)
+{
+    thrust::device_ptr<T> dev_ptr = thrust::device_pointer_cast(static_cast<T*>(data));
+    thrust::device_vector<T> temp(dev_ptr, dev_ptr+count);
+    thrust::gather(indices.begin(),indices.end(), temp.data(), dev_ptr);
+}
+
+// the halo particles of a list of slots, to the host and back
+template <typename T>
+static void GatherToHost(T* hostDst, const T* deviceSrc, const thrust::device_vector<int32_t>& slots)
+{
+    thrust::device_vector<T> temp(slots.size());
+    thrust::gather(slots.begin(), slots.end(), thrust::device_pointer_cast(deviceSrc), temp.begin());
+    thrust::copy(temp.begin(), temp.end(), hostDst);
+}
+
+template <typename T>
+static void ScatterFromHost(T* deviceDst, const T* hostSrc, const thrust::device_vector<int32_t>& slots)
+{
+    thrust::device_vector<T> temp(hostSrc, hostSrc + slots.size());
+    thrust::scatter(temp.begin(), temp.end(), slots.begin(), thrust::device_pointer_cast(deviceDst));
+}
+
+// multipliers move by the size of their storage type, their bits untouched
+static void GatherMultipliersToHost(uint8_t* hostDst, const void* deviceSrc, const thrust::device_vector<int32_t>& slots, Precision precision)
+{
+    switch (MultiplierStorageSize(precision))
+    {
+    case sizeof(uint16_t) : GatherToHost(reinterpret_cast<uint16_t*>(hostDst), static_cast<const uint16_t*>(deviceSrc), slots); break;
+    case sizeof(uint64_t) : GatherToHost(reinterpret_cast<uint64_t*>(hostDst), static_cast<const uint64_t*>(deviceSrc), slots); break;
+    default :               GatherToHost(reinterpret_cast<uint32_t*>(hostDst), static_cast<const uint32_t*>(deviceSrc), slots); break;
+    }
+}
+
+static void ScatterMultipliersFromHost(void* deviceDst, const uint8_t* hostSrc, const thrust::device_vector<int32_t>& slots, Precision precision)
+{
+    switch (MultiplierStorageSize(precision))
+    {
+    case sizeof(uint16_t) : ScatterFromHost(static_cast<uint16_t*>(deviceDst), reinterpret_cast<const uint16_t*>(hostSrc), slots); break;
+    case sizeof(uint64_t) : ScatterFromHost(static_cast<uint64_t*>(deviceDst), reinterpret_cast<const uint64_t*>(hostSrc), slots); break;
+    default :               ScatterFromHost(static_cast<uint32_t*>(deviceDst), reinterpret_cast<const uint32_t*>(hostSrc), slots); break;
+    }
+}
+
+static void GatherMultipliers(void* data, const thrust::device_vector<int>& indices, uint64_t count, Precision precision)
+{
+    switch (MultiplierStorageSize(precision))
+    {
+    case sizeof(uint16_t) : GatherBits<uint16_t>(data, indices, count); break;
+    case sizeof(uint64_t) : GatherBits<uint64_t>(data, indices, count); break;
+    default :               GatherBits<uint32_t>(data, indices, count); break;
+    }
+}
+
 HiPhysicsUPtr HiPhysics::Create() {
     auto solver = HiPhysicsUPtr(new HiPhysics());
     if(!solver->Init())
@@ -18,14 +115,68 @@ bool HiPhysics::ClearMemory() {
     cudaFree(dm_DataFluid.phases);
     cudaFree(dm_DataFluid.constraints);
     cudaFree(dm_DataFluid.lambdas);
+    cudaFree(dm_DataFluid.deltaLambdas);
     cudaFree(dm_DataFluid.correctedPos);
     cudaFree(dm_DataFluid.deltaPos);
     cudaFree(dm_DataFluid.gridIndices);
     cudaFree(dm_DataFluid.numPartInGrids);
-    cudaFree(dm_DataFluid.nearGridID);
     cudaFree(dm_DataFluid.commonParam);
     cudaFree(dm_DataFluid.phaseParam);
 
+    cudaFree(dm_DataFluid.invMasses);
+    cudaFree(dm_DataFluid.originalIDs);
+    cudaFree(dm_DataFluid.slots);
+    cudaFree(dm_DataFluid.fluidIDs);
+    cudaFree(dm_DataFluid.stepStatistics);
+    cudaFree(dm_DataFluid.surfaceFlags);
+    cudaFree(dm_DataFluid.xsphVelocity);
+    cudaFree(dm_DataFluid.vorticity);
+    cudaFree(dm_DataFluid.vorticityNext);
+    cudaFree(dm_DataFluid.vorticityGradient);
+    cudaFree(dm_DataFluid.quantizedPos);
+    cudaFree(dm_DataFluid.colliders);
+    cudaFree(dm_DataFluid.colliderDistances);
+    dm_DataFluid.numColliders = 0;
+    cudaFree(dm_DataFluid.meshColliders);
+    cudaFree(dm_DataFluid.meshNodes);
+    cudaFree(dm_DataFluid.meshTriangles);
+    cudaFree(dm_DataFluid.meshVertices);
+    dm_DataFluid.numMeshColliders = 0;
+    m_hostColliders.clear();
+    m_hostMeshColliders.clear();
+    m_kinematicColliders = false;
+
+    // the particle arrays of dm_DataCloth alias the ones above
+    cudaFree(dm_DataCloth.constraintID0);
+    cudaFree(dm_DataCloth.constraintID1);
+    cudaFree(dm_DataCloth.restLengths);
+    cudaFree(dm_DataCloth.compliance);
+    cudaFree(dm_DataCloth.constraintLambdas);
+    cudaFree(dm_DataCloth.clothIDs);
+    cudaFree(dm_DataCloth.adjacencyOffsets);
+    cudaFree(dm_DataCloth.adjacencyIDs);
+    cudaFree(dm_DataCloth.hashKeys);
+    cudaFree(dm_DataCloth.hashIDs);
+    cudaFree(dm_DataCloth.cellStart);
+    cudaFree(dm_DataCloth.cellEnd);
+    m_clothHashSize = 0;
+    m_particleCapacity = 0;
+
+    cudaFree(dm_SimParameters.commonParam);
+    cudaFree(dm_SimParameters.phaseParam);
+    m_clothColorOffsets.clear();
+
+    cudaStreamDestroy(m_fluidStream);
+    cudaStreamDestroy(m_clothStream);
+    cudaEventDestroy(m_forkEvent);
+    cudaEventDestroy(m_fluidDone);
+    cudaEventDestroy(m_clothDone);
+    m_fluidStream = nullptr;
+    m_clothStream = nullptr;
+    m_forkEvent = nullptr;
+    m_fluidDone = nullptr;
+    m_clothDone = nullptr;
+
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
@@ -37,9 +188,31 @@ bool HiPhysics::ClearMemory() {
 
 }
 
+// free a device array and allocate it again for capacity elements, its content is undefined
+template <typename T>
+static void ReallocDevice(T*& data, uint64_t capacity, size_t elementSize = sizeof(T))
+{
+    cudaFree(data);
+    cudaMalloc(&data, capacity*elementSize);
+}
+
+// cells of the grid over [minPosition, maxPosition], bounds padded by the radius as in ComputeGridIndices
+static uint64_t GridCellCount(glm::vec3 minPosition, glm::vec3 maxPosition, float radius)
+{
+    float H = radius * 1.2f * 2.0f * 2.0f;
+    uint64_t ix = static_cast<uint64_t>((maxPosition.x - radius - minPosition.x)/H)+1;
+    uint64_t iy = static_cast<uint64_t>((maxPosition.y - radius - minPosition.y)/H)+1;
+    uint64_t iz = static_cast<uint64_t>((maxPosition.z - radius - minPosition.z)/H)+1;
+    return ix*iy*iz;
+}
+
 bool HiPhysics::SetMemory(SimBufferPtr simBuffer) {
     cudaError_t cudaError;
     uint64_t count = simBuffer->GetNumParticles();
+    m_numParticles = count;
+    m_precision = simBuffer->m_commonParam.precision;
+
+    simBuffer->ApplyFixedConstraints();
 
     //TODO : Dynamic allocation!
     // the number of particles is varying during the simulations!!
@@ -98,8 +271,8 @@ bool HiPhysics::SetMemory(SimBufferPtr simBuffer) {
         return false;
   	}
 
-    cudaMalloc(&dm_DataFluid.lambdas, count*sizeof(float));
-    cudaMemset(dm_DataFluid.lambdas, 0, count*sizeof(float));
+    cudaMalloc(&dm_DataFluid.lambdas, count*MultiplierStorageSize(m_precision));
+    cudaMemset(dm_DataFluid.lambdas, 0, count*MultiplierStorageSize(m_precision));
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
@@ -109,6 +282,17 @@ bool HiPhysics::SetMemory(SimBufferPtr simBuffer) {
         return false;
   	}
 
+    cudaMalloc(&dm_DataFluid.deltaLambdas, count*MultiplierStorageSize(m_precision));
+    cudaMemset(dm_DataFluid.deltaLambdas, 0, count*MultiplierStorageSize(m_precision));
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("MallocMemcpy dm_DataFluid.deltaLambdas %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
+
     cudaMalloc(&dm_DataFluid.correctedPos, count*sizeof(glm::vec3));
     cudaMemset(dm_DataFluid.correctedPos, 0, count*sizeof(glm::vec3));
 	cudaDeviceSynchronize(); 
@@ -142,30 +326,98 @@ bool HiPhysics::SetMemory(SimBufferPtr simBuffer) {
         return false;
   	}
 
-    // TODO
-    glm::vec3 maxPosition = max_element_xyz(&simBuffer->m_positions) + glm::vec3(simBuffer->m_commonParam.radius);
-    glm::vec3 minPosition = min_element_xyz(&simBuffer->m_positions) - glm::vec3(simBuffer->m_commonParam.radius);
-    float H = simBuffer->m_commonParam.radius * 1.2f * 2.0f * 2.0f;
-    int32_t ix = static_cast<int32_t>((maxPosition.x - (simBuffer->m_commonParam.radius) - minPosition.x)/H)+1;
-    int32_t iy = static_cast<int32_t>((maxPosition.y - (simBuffer->m_commonParam.radius) - minPosition.y)/H)+1;
-    int32_t iz = static_cast<int32_t>((maxPosition.z - (simBuffer->m_commonParam.radius) - minPosition.z)/H)+1;
-    cudaMalloc(&dm_DataFluid.numPartInGrids, 1000*(ix)*(iy)*(iz)*sizeof(int32_t));
-    cudaMemset(dm_DataFluid.numPartInGrids, 0, 1000*(ix)*(iy)*(iz)*sizeof(int32_t));
+    cudaMalloc(&dm_DataFluid.invMasses, count*sizeof(float));
+	cudaMemcpy(dm_DataFluid.invMasses, simBuffer->m_invMasses.data(), count*sizeof(float), cudaMemcpyHostToDevice);
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataFluid.numPartInGrids %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataFluid.invMasses %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
+
+    // every particle starts in the slot of its SimBuffer ID
+    cudaMalloc(&dm_DataFluid.originalIDs, count*sizeof(int32_t));
+    cudaMalloc(&dm_DataFluid.slots, count*sizeof(int32_t));
+    cudaMalloc(&dm_DataFluid.fluidIDs, count*sizeof(int32_t));
+    thrust::sequence(thrust::device_pointer_cast(dm_DataFluid.originalIDs), thrust::device_pointer_cast(dm_DataFluid.originalIDs) + count);
+    thrust::sequence(thrust::device_pointer_cast(dm_DataFluid.slots), thrust::device_pointer_cast(dm_DataFluid.slots) + count);
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("MallocMemcpy dm_DataFluid.originalIDs %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
+
+    cudaMalloc(&dm_DataFluid.stepStatistics, 2*sizeof(float));
+    cudaMemset(dm_DataFluid.stepStatistics, 0, 2*sizeof(float));
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("MallocMemcpy dm_DataFluid.stepStatistics %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
+
+    // every particle is drawn until the first step classifies them
+    cudaMalloc(&dm_DataFluid.surfaceFlags, count*sizeof(uint8_t));
+    cudaMemset(dm_DataFluid.surfaceFlags, 1, count*sizeof(uint8_t));
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("MallocMemcpy dm_DataFluid.surfaceFlags %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
-    cudaMalloc(&dm_DataFluid.nearGridID, 3*(ix+1)*(iy+1)*(iz+1)*27*sizeof(int32_t));
-    cudaMemset(dm_DataFluid.nearGridID, 0, 3*(ix+1)*(iy+1)*(iz+1)*27*sizeof(int32_t));
+
+    cudaMalloc(&dm_DataFluid.xsphVelocity, count*sizeof(glm::vec3));
+    cudaMalloc(&dm_DataFluid.vorticity, count*sizeof(glm::vec3));
+    cudaMalloc(&dm_DataFluid.vorticityNext, count*sizeof(glm::vec3));
+    cudaMalloc(&dm_DataFluid.vorticityGradient, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.xsphVelocity, 0, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.vorticity, 0, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.vorticityNext, 0, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.vorticityGradient, 0, count*sizeof(glm::vec3));
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("MallocMemcpy dm_DataFluid.vorticity %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
+
+    m_quantizedPositions = simBuffer->m_commonParam.quantizedPositions;
+    if (m_quantizedPositions)
+    {
+        cudaMalloc(&dm_DataFluid.quantizedPos, count*sizeof(QuantizedPosition));
+        cudaDeviceSynchronize(); 
+        cudaError = cudaGetLastError();
+        if (cudaError != cudaSuccess)
+        {
+            printf("MallocMemcpy dm_DataFluid.quantizedPos %s\n",cudaGetErrorString(cudaError));
+            exit(1);
+            return false;
+        }
+    }
+
+    // the particles are kept inside the AnalysisBox : its grid holds them wherever they go,
+    // a rank that starts with an empty slab included. A prediction past a wall grows it in ComputeGridIndices
+    const CommonParameters& commonParam = simBuffer->m_commonParam;
+    m_gridCapacity = GridCellCount(commonParam.AnalysisBox.minPoint - glm::vec3(commonParam.radius),
+                                   commonParam.AnalysisBox.maxPoint + glm::vec3(commonParam.radius), commonParam.radius);
+    cudaMalloc(&dm_DataFluid.numPartInGrids, m_gridCapacity*sizeof(int32_t));
+    cudaMemset(dm_DataFluid.numPartInGrids, 0, m_gridCapacity*sizeof(int32_t));
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataFluid.nearGridID %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataFluid.numPartInGrids %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
@@ -215,173 +467,416 @@ bool HiPhysics::SetMemory(SimBufferPtr simBuffer) {
         return false;
   	}
 
-    return true;
+    if (!SetMemoryCloth(simBuffer) || !SetMemoryColliders(simBuffer))
+        return false;
+
+    m_particleCapacity = count;
+    return GroupParticlesByPhase() && ResizeClothHash();
 }
 
-bool HiPhysics::SetMemoryCloth(SimBufferPtr simBuffer) {
+bool HiPhysics::UploadParticles(SimBufferPtr simBuffer) {
     cudaError_t cudaError;
     uint64_t count = simBuffer->GetNumParticles();
-    uint64_t nStretchLines = simBuffer->GetNumStretchLines();
-    uint64_t nBendLines = simBuffer->GetNumBendLines();
-    uint64_t nShearLines = simBuffer->GetNumShearLines();
-    uint64_t nTriangles = simBuffer->GetNumTriangles();
+    m_numParticles = count;
 
-    //TODO : Dynamic allocation!
-    // the number of particles is varying during the simulations!!
-    cudaMalloc(&(dm_DataCloth.colorValues), count*sizeof(float));
-    cudaMemset(dm_DataCloth.colorValues, 0, count*sizeof(float));
+    if (count > m_particleCapacity)
+    {
+        // grow with headroom : exchanges move a few particles every frame
+        m_particleCapacity = count + count / 4;
+        uint64_t capacity = m_particleCapacity;
+
+        ReallocDevice(dm_DataFluid.colorValues, capacity);
+        ReallocDevice(dm_DataFluid.positions, capacity);
+        ReallocDevice(dm_DataFluid.velocities, capacity);
+        ReallocDevice(dm_DataFluid.phases, capacity);
+        ReallocDevice(dm_DataFluid.constraints, capacity);
+        ReallocDevice(dm_DataFluid.lambdas, capacity, MultiplierStorageSize(m_precision));
+        ReallocDevice(dm_DataFluid.deltaLambdas, capacity, MultiplierStorageSize(m_precision));
+        ReallocDevice(dm_DataFluid.correctedPos, capacity);
+        ReallocDevice(dm_DataFluid.deltaPos, capacity);
+        ReallocDevice(dm_DataFluid.gridIndices, capacity);
+        ReallocDevice(dm_DataFluid.invMasses, capacity);
+        ReallocDevice(dm_DataFluid.originalIDs, capacity);
+        ReallocDevice(dm_DataFluid.slots, capacity);
+        ReallocDevice(dm_DataFluid.fluidIDs, capacity);
+        ReallocDevice(dm_DataFluid.surfaceFlags, capacity);
+        ReallocDevice(dm_DataFluid.xsphVelocity, capacity);
+        ReallocDevice(dm_DataFluid.vorticity, capacity);
+        ReallocDevice(dm_DataFluid.vorticityNext, capacity);
+        ReallocDevice(dm_DataFluid.vorticityGradient, capacity);
+        if (m_quantizedPositions)
+            ReallocDevice(dm_DataFluid.quantizedPos, capacity);
+        ReallocDevice(dm_DataCloth.clothIDs, capacity);
+        ReallocDevice(dm_DataCloth.hashKeys, capacity);
+        ReallocDevice(dm_DataCloth.hashIDs, capacity);
+
+        // cloth kernels work on the shared particle arrays
+        static_cast<DeviceParticleData&>(dm_DataCloth) = dm_DataFluid;
+
+        cudaDeviceSynchronize(); 
+        cudaError = cudaGetLastError();
+        if (cudaError != cudaSuccess)
+        {
+            printf("Malloc HiPhysics::UploadParticles %s\n",cudaGetErrorString(cudaError));
+            exit(1);
+            return false;
+        }
+    }
+
+    // the particles come in SimBuffer order : every one starts in the slot of its ID
+    cudaMemcpy(dm_DataFluid.positions, simBuffer->m_positions.data(), count*sizeof(glm::vec3), cudaMemcpyHostToDevice);
+    cudaMemcpy(dm_DataFluid.velocities, simBuffer->m_velocities.data(), count*sizeof(glm::vec3), cudaMemcpyHostToDevice);
+    cudaMemcpy(dm_DataFluid.phases, simBuffer->m_phases.data(), count*sizeof(int32_t), cudaMemcpyHostToDevice);
+    cudaMemcpy(dm_DataFluid.invMasses, simBuffer->m_invMasses.data(), count*sizeof(float), cudaMemcpyHostToDevice);
+    thrust::sequence(thrust::device_pointer_cast(dm_DataFluid.originalIDs), thrust::device_pointer_cast(dm_DataFluid.originalIDs) + count);
+    thrust::sequence(thrust::device_pointer_cast(dm_DataFluid.slots), thrust::device_pointer_cast(dm_DataFluid.slots) + count);
+
+    // per particle solver state can't follow the new order : it restarts like after SetMemory
+    cudaMemset(dm_DataFluid.colorValues, 0, count*sizeof(float));
+    cudaMemset(dm_DataFluid.constraints, 0, count*sizeof(float));
+    cudaMemset(dm_DataFluid.lambdas, 0, count*MultiplierStorageSize(m_precision));
+    cudaMemset(dm_DataFluid.deltaLambdas, 0, count*MultiplierStorageSize(m_precision));
+    cudaMemset(dm_DataFluid.correctedPos, 0, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.deltaPos, 0, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.gridIndices, 0, count*sizeof(int32_t));
+    cudaMemset(dm_DataFluid.surfaceFlags, 1, count*sizeof(uint8_t));
+    cudaMemset(dm_DataFluid.xsphVelocity, 0, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.vorticity, 0, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.vorticityNext, 0, count*sizeof(glm::vec3));
+    cudaMemset(dm_DataFluid.vorticityGradient, 0, count*sizeof(glm::vec3));
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.colorValues %s\n",cudaGetErrorString(cudaError));
+        printf("Memcpy HiPhysics::UploadParticles %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
 
-    cudaMalloc(&dm_DataCloth.positions, count*sizeof(glm::vec3));
-	cudaMemcpy(dm_DataCloth.positions, simBuffer->m_positions.data(), count*sizeof(glm::vec3), cudaMemcpyHostToDevice);
+    return GroupParticlesByPhase() && ResizeClothHash();
+}
+
+static ColliderPose ToColliderPose(const ColliderKeyframe& keyframe) {
+    return {glm::mat3_cast(keyframe.rotation), keyframe.translation};
+}
+
+bool HiPhysics::SetMemoryColliders(SimBufferPtr simBuffer) {
+    cudaError_t cudaError;
+    dm_DataFluid.numColliders = static_cast<int32_t>(simBuffer->m_colliders.size());
+    if (!SetMemoryMeshColliders(simBuffer))
+        return false;
+    if (dm_DataFluid.numColliders == 0)
+        return true;
+
+    // every grid in one array
+    std::vector<DeviceCollider>& colliders = m_hostColliders;
+    colliders.clear();
+    int64_t numDistances = 0;
+    for (const SdfCollider& collider : simBuffer->m_colliders)
+    {
+        ColliderPose pose = ToColliderPose(collider.motion.PoseAt(m_time));
+        colliders.push_back({collider.origin, collider.cellSize, collider.dims, collider.bandWidth, numDistances,
+                             pose, pose, collider.motion.friction});
+        numDistances += collider.distances.size();
+        m_kinematicColliders |= collider.motion.IsKinematic();
+    }
+
+    cudaMalloc(&dm_DataFluid.colliders, colliders.size()*sizeof(DeviceCollider));
+	cudaMemcpy(dm_DataFluid.colliders, colliders.data(), colliders.size()*sizeof(DeviceCollider), cudaMemcpyHostToDevice);
+    cudaMalloc(&dm_DataFluid.colliderDistances, numDistances*sizeof(float));
+    for (size_t c = 0; c < colliders.size(); ++c)
+    {
+        const std::vector<float>& distances = simBuffer->m_colliders[c].distances;
+        cudaMemcpy(dm_DataFluid.colliderDistances + colliders[c].offset, distances.data(), distances.size()*sizeof(float), cudaMemcpyHostToDevice);
+    }
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.positions %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataFluid.colliders %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
+    return true;
+}
 
-    cudaMalloc(&dm_DataCloth.velocities, count*sizeof(glm::vec3));
-	cudaMemcpy(dm_DataCloth.velocities, simBuffer->m_velocities.data(), count*sizeof(glm::vec3), cudaMemcpyHostToDevice);
+bool HiPhysics::SetMemoryMeshColliders(SimBufferPtr simBuffer) {
+    cudaError_t cudaError;
+    dm_DataFluid.numMeshColliders = static_cast<int32_t>(simBuffer->m_meshColliders.size());
+    if (dm_DataFluid.numMeshColliders == 0)
+        return true;
+
+    std::vector<DeviceMeshCollider>& meshColliders = m_hostMeshColliders;
+    meshColliders.clear();
+    int32_t numNodes = 0, numTriangleIDs = 0, numVertices = 0;
+    for (const MeshCollider& collider : simBuffer->m_meshColliders)
+    {
+        ColliderPose pose = ToColliderPose(collider.motion.PoseAt(m_time));
+        meshColliders.push_back({numNodes, numTriangleIDs, numVertices, pose, pose, collider.motion.friction});
+        m_kinematicColliders |= collider.motion.IsKinematic();
+        numNodes += static_cast<int32_t>(collider.nodes.size());
+        numTriangleIDs += static_cast<int32_t>(collider.triangles.size());
+        numVertices += static_cast<int32_t>(collider.vertices.size());
+    }
+
+    cudaMalloc(&dm_DataFluid.meshColliders, meshColliders.size()*sizeof(DeviceMeshCollider));
+	cudaMemcpy(dm_DataFluid.meshColliders, meshColliders.data(), meshColliders.size()*sizeof(DeviceMeshCollider), cudaMemcpyHostToDevice);
+    cudaMalloc(&dm_DataFluid.meshNodes, numNodes*sizeof(BvhNode));
+    cudaMalloc(&dm_DataFluid.meshTriangles, numTriangleIDs*sizeof(int32_t));
+    cudaMalloc(&dm_DataFluid.meshVertices, numVertices*sizeof(glm::vec3));
+    for (size_t c = 0; c < meshColliders.size(); ++c)
+    {
+        const std::vector<int32_t>& triangles = simBuffer->m_meshColliders[c].triangles;
+        cudaMemcpy(dm_DataFluid.meshTriangles + meshColliders[c].triangleOffset, triangles.data(), triangles.size()*sizeof(int32_t), cudaMemcpyHostToDevice);
+    }
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.velocities %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataFluid.meshColliders %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
+    return UpdateMeshColliders(simBuffer);
+}
 
-    cudaMalloc(&dm_DataCloth.phases, count*sizeof(int32_t));
-	cudaMemcpy(dm_DataCloth.phases, simBuffer->m_phases.data(), count*sizeof(int32_t), cudaMemcpyHostToDevice);
-	cudaDeviceSynchronize(); 
+bool HiPhysics::UpdateColliderPoses(SimBufferPtr simBuffer, float startTime, float endTime) {
+    cudaError_t cudaError;
+    // only the poses change : nothing of the geometry is rebuilt or uploaded
+    for (size_t c = 0; c < m_hostColliders.size(); ++c)
+    {
+        const ColliderMotion& motion = simBuffer->m_colliders[c].motion;
+        m_hostColliders[c].previousPose = ToColliderPose(motion.PoseAt(startTime));
+        m_hostColliders[c].pose         = ToColliderPose(motion.PoseAt(endTime));
+    }
+    for (size_t c = 0; c < m_hostMeshColliders.size(); ++c)
+    {
+        const ColliderMotion& motion = simBuffer->m_meshColliders[c].motion;
+        m_hostMeshColliders[c].previousPose = ToColliderPose(motion.PoseAt(startTime));
+        m_hostMeshColliders[c].pose         = ToColliderPose(motion.PoseAt(endTime));
+    }
+    if (!m_hostColliders.empty())
+        cudaMemcpy(dm_DataFluid.colliders, m_hostColliders.data(), m_hostColliders.size()*sizeof(DeviceCollider), cudaMemcpyHostToDevice);
+    if (!m_hostMeshColliders.empty())
+        cudaMemcpy(dm_DataFluid.meshColliders, m_hostMeshColliders.data(), m_hostMeshColliders.size()*sizeof(DeviceMeshCollider), cudaMemcpyHostToDevice);
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.phases %s\n",cudaGetErrorString(cudaError));
+        printf("Memcpy dm_DataFluid.colliders poses %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
+    return true;
+}
 
-    cudaMalloc(&dm_DataCloth.stretchID, 2*nStretchLines*sizeof(int32_t));
-	cudaMemcpy(dm_DataCloth.stretchID, simBuffer->m_stretchID.data(), 2*nStretchLines*sizeof(int32_t), cudaMemcpyHostToDevice);
-	cudaDeviceSynchronize(); 
+bool HiPhysics::UpdateMeshColliders(SimBufferPtr simBuffer) {
+    cudaError_t cudaError;
+    if (dm_DataFluid.numMeshColliders == 0)
+        return true;
+
+    // the topology is fixed at SetMemory : same offsets, only the geometry changes
+    int32_t nodeOffset = 0, vertexOffset = 0;
+    for (const MeshCollider& collider : simBuffer->m_meshColliders)
+    {
+        cudaMemcpy(dm_DataFluid.meshNodes + nodeOffset, collider.nodes.data(), collider.nodes.size()*sizeof(BvhNode), cudaMemcpyHostToDevice);
+        cudaMemcpy(dm_DataFluid.meshVertices + vertexOffset, collider.vertices.data(), collider.vertices.size()*sizeof(glm::vec3), cudaMemcpyHostToDevice);
+        nodeOffset += static_cast<int32_t>(collider.nodes.size());
+        vertexOffset += static_cast<int32_t>(collider.vertices.size());
+    }
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.stretchID %s\n",cudaGetErrorString(cudaError));
+        printf("Memcpy dm_DataFluid.meshNodes %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
+    return true;
+}
 
-    cudaMalloc(&dm_DataCloth.bendID, 2*nBendLines*sizeof(int32_t));
-    cudaMemcpy(dm_DataCloth.bendID, simBuffer->m_bendID.data(), 2*nBendLines*sizeof(int32_t), cudaMemcpyHostToDevice);
+bool HiPhysics::SetMemoryCloth(SimBufferPtr simBuffer) {
+    cudaError_t cudaError;
+    uint64_t count = simBuffer->GetNumParticles();
+    uint64_t nConstraints = simBuffer->GetNumClothConstraints();
+
+    // cloth kernels work on the shared particle arrays
+    static_cast<DeviceParticleData&>(dm_DataCloth) = dm_DataFluid;
+
+    cudaMalloc(&dm_DataCloth.clothIDs, count*sizeof(int32_t));
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.bendID %s\n",cudaGetErrorString(cudaError));
+        printf("Malloc dm_DataCloth.clothIDs %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
 
-    cudaMalloc(&dm_DataCloth.shearID, 2*nShearLines*sizeof(int32_t));
-    cudaMemcpy(dm_DataCloth.shearID, simBuffer->m_shearID.data(), 2*nShearLines*sizeof(int32_t), cudaMemcpyHostToDevice);
+    // Constraints of one color touch disjoint particles, so each color is
+    // projected as a single Gauss-Seidel batch without atomics.
+    m_clothColorOffsets = simBuffer->m_clothConstraints.SortByColor(count);
+    const ClothConstraints& constraints = simBuffer->m_clothConstraints;
+    simBuffer->m_clothAdjacency.Build(constraints, count);
+
+    cudaMalloc(&dm_DataCloth.constraintID0, nConstraints*sizeof(int32_t));
+	cudaMemcpy(dm_DataCloth.constraintID0, constraints.id0.data(), nConstraints*sizeof(int32_t), cudaMemcpyHostToDevice);
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.shearID %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataCloth.constraintID0 %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
 
-    cudaMalloc(&dm_DataCloth.correctedPos, count*sizeof(glm::vec3));
-	cudaMemcpy(dm_DataCloth.correctedPos, simBuffer->m_positions.data(), count*sizeof(glm::vec3), cudaMemcpyHostToDevice);
+    cudaMalloc(&dm_DataCloth.constraintID1, nConstraints*sizeof(int32_t));
+	cudaMemcpy(dm_DataCloth.constraintID1, constraints.id1.data(), nConstraints*sizeof(int32_t), cudaMemcpyHostToDevice);
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.correctedPos %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataCloth.constraintID1 %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
 
-    cudaMalloc(&dm_DataCloth.deltaPos, count*sizeof(glm::vec3));
-    cudaMemset(dm_DataCloth.deltaPos, 0, count*sizeof(glm::vec3));
+    cudaMalloc(&dm_DataCloth.restLengths, nConstraints*sizeof(float));
+	cudaMemcpy(dm_DataCloth.restLengths, constraints.restLength.data(), nConstraints*sizeof(float), cudaMemcpyHostToDevice);
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_DataCloth.deltaPos %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataCloth.restLengths %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
 
-    cudaMalloc(&dm_SimParameters.commonParam, sizeof(CommonParameters));
-	cudaMemcpy(dm_SimParameters.commonParam, &simBuffer->m_commonParam, sizeof(CommonParameters), cudaMemcpyHostToDevice);
+    cudaMalloc(&dm_DataCloth.compliance, nConstraints*sizeof(float));
+	cudaMemcpy(dm_DataCloth.compliance, constraints.compliance.data(), nConstraints*sizeof(float), cudaMemcpyHostToDevice);
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_SimParameters.commonParam %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataCloth.compliance %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
 
-    cudaMalloc(&dm_SimParameters.phaseParam, simBuffer->m_phaseParam.size()*sizeof(PhaseParameters));
-	cudaMemcpy(dm_SimParameters.phaseParam, simBuffer->m_phaseParam.data(), simBuffer->m_phaseParam.size()*sizeof(PhaseParameters), cudaMemcpyHostToDevice);
+    cudaMalloc(&dm_DataCloth.constraintLambdas, nConstraints*sizeof(float));
+    cudaMemset(dm_DataCloth.constraintLambdas, 0, nConstraints*sizeof(float));
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("MallocMemcpy dm_SimParameters.phaseParam %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataCloth.constraintLambdas %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
 
-    return true;
-}
+    const ClothAdjacency& adjacency = simBuffer->m_clothAdjacency;
 
-bool HiPhysics::GetMemory(SimBufferPtr simBuffer) {
-    cudaError_t cudaError;
-
-    uint64_t count = simBuffer->GetNumParticles();
+    cudaMalloc(&dm_DataCloth.adjacencyOffsets, adjacency.offsets.size()*sizeof(int32_t));
+	cudaMemcpy(dm_DataCloth.adjacencyOffsets, adjacency.offsets.data(), adjacency.offsets.size()*sizeof(int32_t), cudaMemcpyHostToDevice);
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("MallocMemcpy dm_DataCloth.adjacencyOffsets %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
 
-	cudaMemcpy(simBuffer->m_colorValues.data(), dm_DataFluid.colorValues, count*sizeof(float),    cudaMemcpyDeviceToHost);
-	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
+    cudaMalloc(&dm_DataCloth.adjacencyIDs, adjacency.ids.size()*sizeof(int32_t));
+	cudaMemcpy(dm_DataCloth.adjacencyIDs, adjacency.ids.data(), adjacency.ids.size()*sizeof(int32_t), cudaMemcpyHostToDevice);
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("Error at HiPhysics::GetMemory %s\n",cudaGetErrorString(cudaError));
+        printf("MallocMemcpy dm_DataCloth.adjacencyIDs %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
-	cudaMemcpy(simBuffer->m_positions.data(),   dm_DataFluid.positions,   count*sizeof(glm::vec3),cudaMemcpyDeviceToHost);
-	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
+
+    // self collision hash entries, its cells are sized by ResizeClothHash once the cloth particles are counted
+    cudaMalloc(&dm_DataCloth.hashKeys, count*sizeof(int32_t));
+    cudaMalloc(&dm_DataCloth.hashIDs, count*sizeof(int32_t));
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("Error at HiPhysics::GetMemory %s\n",cudaGetErrorString(cudaError));
+        printf("Malloc dm_DataCloth self collision hash %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
-	cudaMemcpy(simBuffer->m_velocities.data(),  dm_DataFluid.velocities,  count*sizeof(glm::vec3),cudaMemcpyDeviceToHost);
-	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
+
+    return true;
+}
+
+bool HiPhysics::ResizeClothHash() {
+    // about two cells per cloth particle, only ever grows
+    int32_t hashSize = 1;
+    while (static_cast<uint32_t>(hashSize) < 2 * m_numClothParticles) hashSize <<= 1;
+    if (hashSize <= m_clothHashSize)
+        return true;
+
+    m_clothHashSize = hashSize;
+    cudaFree(dm_DataCloth.cellStart);
+    cudaFree(dm_DataCloth.cellEnd);
+    cudaMalloc(&dm_DataCloth.cellStart, m_clothHashSize*sizeof(int32_t));
+    cudaMalloc(&dm_DataCloth.cellEnd, m_clothHashSize*sizeof(int32_t));
+    cudaError_t cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
-        printf("Error at HiPhysics::GetMemory %s\n",cudaGetErrorString(cudaError));
+        printf("Malloc dm_DataCloth.cellStart %s\n",cudaGetErrorString(cudaError));
         exit(1);
         return false;
   	}
-	cudaMemcpy(simBuffer->m_phases.data(),      dm_DataFluid.phases,      count*sizeof(int32_t),  cudaMemcpyDeviceToHost);
+    return true;
+}
+
+bool HiPhysics::GroupParticlesByPhase() {
+    cudaError_t cudaError;
+
+    thrust::counting_iterator<int32_t> first(0);
+    thrust::device_ptr<int32_t> phases = thrust::device_pointer_cast(dm_DataFluid.phases);
+
+    auto fluidEnd = thrust::copy_if(first, first + m_numParticles, phases, 
+                                    thrust::device_pointer_cast(dm_DataFluid.fluidIDs), 
+                                    IsPhaseType{dm_SimParameters.phaseParam, StateOfMatter::FLUID});
+    m_numFluidParticles = fluidEnd - thrust::device_pointer_cast(dm_DataFluid.fluidIDs);
+
+    auto clothEnd = thrust::copy_if(first, first + m_numParticles, phases, 
+                                    thrust::device_pointer_cast(dm_DataCloth.clothIDs), 
+                                    IsPhaseType{dm_SimParameters.phaseParam, StateOfMatter::CLOTH});
+    m_numClothParticles = clothEnd - thrust::device_pointer_cast(dm_DataCloth.clothIDs);
+
+    cudaError = cudaGetLastError();
+    if (cudaError != cudaSuccess)
+    {
+        printf("Error at HiPhysics::GroupParticlesByPhase %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+    }
+    return true;
+}
+
+bool HiPhysics::GetMemory(SimBufferPtr simBuffer) {
+    cudaError_t cudaError;
+
+    uint64_t count = simBuffer->GetNumParticles();
+
+    CopyToHostBySlots(simBuffer->m_colorValues.data(), dm_DataFluid.colorValues, dm_DataFluid.slots, count);
+    CopyToHostBySlots(simBuffer->m_positions.data(),   dm_DataFluid.positions,   dm_DataFluid.slots, count);
+    CopyToHostBySlots(simBuffer->m_velocities.data(),  dm_DataFluid.velocities,  dm_DataFluid.slots, count);
+    CopyToHostBySlots(simBuffer->m_phases.data(),      dm_DataFluid.phases,      dm_DataFluid.slots, count);
+
+    // the renderer walks the particles in grid order : cells are runs of consecutive particles with the same
+    // cell ID, the sorted gridIndices of the last iteration
+    simBuffer->m_gridOrder.resize(count);
+    simBuffer->m_surfaceFlags.resize(count);
+    simBuffer->m_gridCells.resize(count);
+    cudaMemcpy(simBuffer->m_gridOrder.data(),    dm_DataFluid.originalIDs,  count*sizeof(int32_t), cudaMemcpyDeviceToHost);
+    cudaMemcpy(simBuffer->m_surfaceFlags.data(), dm_DataFluid.surfaceFlags, count*sizeof(uint8_t), cudaMemcpyDeviceToHost);
+    cudaMemcpy(simBuffer->m_gridCells.data(),    dm_DataFluid.gridIndices,  count*sizeof(int32_t), cudaMemcpyDeviceToHost);
 	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
   	{
@@ -396,46 +891,223 @@ bool HiPhysics::GetMemory(SimBufferPtr simBuffer) {
 bool HiPhysics::Init () {   
     // cudamemcopy
 
+    cudaStreamCreateWithFlags(&m_fluidStream, cudaStreamNonBlocking);
+    cudaStreamCreateWithFlags(&m_clothStream, cudaStreamNonBlocking);
+    cudaEventCreateWithFlags(&m_forkEvent, cudaEventDisableTiming);
+    cudaEventCreateWithFlags(&m_fluidDone, cudaEventDisableTiming);
+    cudaEventCreateWithFlags(&m_clothDone, cudaEventDisableTiming);
+    cudaError_t cudaError = cudaGetLastError();
+    if (cudaError != cudaSuccess)
+    {
+        printf("Error at HiPhysics::Init streams %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+    }
+    return true;
+}
+
+bool HiPhysics::ForkStreams() {
+    cudaEventRecord(m_forkEvent, 0);
+    cudaStreamWaitEvent(m_fluidStream, m_forkEvent, 0);
+    cudaStreamWaitEvent(m_clothStream, m_forkEvent, 0);
+    return true;
+}
+
+bool HiPhysics::JoinStreams() {
+    cudaEventRecord(m_fluidDone, m_fluidStream);
+    cudaEventRecord(m_clothDone, m_clothStream);
+    cudaStreamWaitEvent(0, m_fluidDone, 0);
+    cudaStreamWaitEvent(0, m_clothDone, 0);
+    cudaError_t cudaError = cudaGetLastError();
+    if (cudaError != cudaSuccess)
+    {
+        printf("Error at HiPhysics::JoinStreams %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+    }
     return true;
 }
 
 void HiPhysics::UpdateSolver(SimBufferPtr simBuffer) {
     m_numParticles = simBuffer->GetNumParticles();
     
-    if (m_numParticles > 0)
+    // every rank of a decomposed scene takes part in the halo exchanges, an empty one included
+    if ((m_numParticles > 0) || m_halo)
     {
-        /// APPLY THE CHANGE BY USER INTERFACE
-        MemsetFromHost(simBuffer);
+        const CommonParameters& commonParam = simBuffer->m_commonParam;
+        if (!commonParam.adaptiveDt)
+        {
+            Step(simBuffer, commonParam.dt);
+        }
+        else
+        {
+        /// SUB-CYCLE ADAPTIVE STEPS UNTIL THE NEXT OUTPUT FRAME
+            // commonParam.dt stays the scene's nominal step : the controller only seeds from it
+            if (m_nextDt <= 0.0f)
+                m_nextDt = glm::clamp(commonParam.dt, commonParam.minDt, commonParam.maxDt);
+
+            float remaining = commonParam.frameDt;
+            while (remaining > 0.0f)
+            {
+                // split the end of the frame evenly rather than leaving a sliver step
+                float dt = m_nextDt;
+                if (remaining <= dt)
+                    dt = remaining;
+                else if (remaining < 2.0f * dt)
+                    dt = 0.5f * remaining;
+
+                Step(simBuffer, dt);
+                remaining -= dt;
+
+                m_nextDt = ComputeAdaptiveDt(commonParam);
+                if (m_halo && !m_halo->AgreeOnDt(m_nextDt))
+                    exit(1);
+                SPDLOG_DEBUG("adaptive step dt {:.6f} max speed {:.4f} max acceleration {:.4f} next dt {:.6f}", 
+                             dt, m_maxSpeed, m_maxAcceleration, m_nextDt);
+            }
+        }
+
+        /// GET VALUES FOR RENDERING PARTICLE COLOR
+        GetRenderingVariable(simBuffer);
+    }
+}
+
+bool HiPhysics::Step(SimBufferPtr simBuffer, float dt) {
+    /// APPLY THE CHANGE BY USER INTERFACE
+    MemsetFromHost(simBuffer, dt);
 
-        /// 
+    cudaMemset(dm_DataFluid.stepStatistics, 0, 2*sizeof(float));
+
+    /// SMALL STEPS : dt is split in substeps, usually with a single iteration each
+    float substepDt = dt / static_cast<float>(simBuffer->m_commonParam.substepNumber);
+    for (int32_t ss = 0; ss < simBuffer->m_commonParam.substepNumber; ++ss)
+    {
+    /// MOVE THE KINEMATIC COLLIDERS OVER THE SUBSTEP
+        if (m_kinematicColliders)
+            UpdateColliderPoses(simBuffer, m_time + ss * substepDt, m_time + (ss + 1) * substepDt);
+
+    /// PREDICT POSITIONS AND RESET THE XPBD LAMBDAS
         PredictPosition(simBuffer);
 
-        
+    /// HASH THE PREDICTED CLOTH POSITIONS FOR SELF COLLISION
+        ComputeHashCloth(simBuffer);
+
         for (int32_t ii = 0; ii < simBuffer->m_commonParam.iterationNumber; ++ii)
         {
+        /// REFRESH THE GHOST PARTICLES FROM THEIR OWNERS ON THE NEIGHBOR RANKS
+            if (m_halo && !RefreshGhosts())
+                exit(1);
+
+            // a rank whose slab is empty has nothing to bin, sort or constrain
+            if (m_numParticles == 0)
+                continue;
+
         /// COMPUTE GRID INDEX COUNT THE NUMBER OF PARTICLES IN THE GRID
             ComputeGridIndices(simBuffer);
 
-        /// SORT BY GRID INDEX
+        /// SORT BY GRID INDEX, FLUID AND CLOTH SHARE THE GRID
             SortVariablesByIndices(simBuffer);
 
-        /// COMPUTE CONSTRAINTS
-            ComputeConstraint(simBuffer);
+        /// COMPUTE DENSITY AND CONTACT CONSTRAINTS
+            bool lastIteration = (ii == simBuffer->m_commonParam.iterationNumber - 1);
+            bool lastOfStep = lastIteration && (ss == simBuffer->m_commonParam.substepNumber - 1);
+            ComputeConstraint(simBuffer, lastIteration, lastOfStep && simBuffer->m_commonParam.classifySurface);
+
+        /// COMPUTE CLOTH DISTANCE CONSTRAINTS
+            ComputeConstraintCloth(simBuffer);
         }
-            
 
-        /// UPDATE PARTICLE POSITIONS
+    /// UPDATE PARTICLE POSITIONS, REDUCE MAX SPEED AND ACCELERATION
         UpdateVelPos(simBuffer);
 
-        /// GET VALUES FOR RENDERING PARTICLE COLOR
-        GetRenderingVariable(simBuffer);
+        // this substep's curl feeds the vorticity gradient of the next one
+        std::swap(dm_DataFluid.vorticity, dm_DataFluid.vorticityNext);
+    }
+    m_time += dt;
+
+    float stepStatistics[2];
+	cudaMemcpy(stepStatistics, dm_DataFluid.stepStatistics, 2*sizeof(float), cudaMemcpyDeviceToHost);
+    cudaError_t cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("Memcpy dm_DataFluid.stepStatistics %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
+    m_maxSpeed        = stepStatistics[0];
+    m_maxAcceleration = stepStatistics[1];
+    return true;
+}
+
+bool HiPhysics::RefreshGhosts() {
+    // the iterate and the multipliers of the owners, with the substep start they are relative to
+    const std::vector<int32_t>& boundaryIDs = m_halo->GetBoundaryIDs();
+    thrust::device_vector<int32_t> ids(boundaryIDs.begin(), boundaryIDs.end());
+    thrust::device_vector<int32_t> boundarySlots(ids.size());
+    thrust::gather(ids.begin(), ids.end(), thrust::device_pointer_cast(dm_DataFluid.slots), boundarySlots.begin());
+
+    HaloState boundary;
+    boundary.lambdaSize = MultiplierStorageSize(m_precision);
+    boundary.positions.resize(ids.size());
+    boundary.velocities.resize(ids.size());
+    boundary.correctedPos.resize(ids.size());
+    boundary.lambdas.resize(ids.size() * boundary.lambdaSize);
+    GatherToHost(boundary.positions.data(), dm_DataFluid.positions, boundarySlots);
+    GatherToHost(boundary.velocities.data(), dm_DataFluid.velocities, boundarySlots);
+    GatherToHost(boundary.correctedPos.data(), dm_DataFluid.correctedPos, boundarySlots);
+    GatherMultipliersToHost(boundary.lambdas.data(), dm_DataFluid.lambdas, boundarySlots, m_precision);
+
+    // the ghosts follow the owned particles in SimBuffer IDs
+    int32_t numOwned = m_halo->GetNumOwned();
+    size_t numGhosts = m_numParticles - numOwned;
+    HaloState ghosts;
+    ghosts.lambdaSize = boundary.lambdaSize;
+    ghosts.positions.resize(numGhosts);
+    ghosts.velocities.resize(numGhosts);
+    ghosts.correctedPos.resize(numGhosts);
+    ghosts.lambdas.resize(numGhosts * ghosts.lambdaSize);
+    if (!m_halo->ExchangeHalo(boundary, ghosts))
+        return false;
+
+    thrust::device_vector<int32_t> ghostSlots(thrust::device_pointer_cast(dm_DataFluid.slots) + numOwned,
+                                              thrust::device_pointer_cast(dm_DataFluid.slots) + m_numParticles);
+    ScatterFromHost(dm_DataFluid.positions, ghosts.positions.data(), ghostSlots);
+    ScatterFromHost(dm_DataFluid.velocities, ghosts.velocities.data(), ghostSlots);
+    ScatterFromHost(dm_DataFluid.correctedPos, ghosts.correctedPos.data(), ghostSlots);
+    ScatterMultipliersFromHost(dm_DataFluid.lambdas, ghosts.lambdas.data(), ghostSlots, m_precision);
+
+    cudaError_t cudaError = cudaGetLastError();
+    if (cudaError != cudaSuccess)
+    {
+        printf("Error at HiPhysics::RefreshGhosts %s\n",cudaGetErrorString(cudaError));
+        exit(1);
     }
+    return true;
+}
+
+float HiPhysics::ComputeAdaptiveDt(const CommonParameters& commonParam) const {
+    // a particle may travel cflNumber of its diameter per step
+    float spacing = commonParam.diameter;
+    float acceleration = m_maxAcceleration + glm::length(commonParam.gravity);
+    float dt = commonParam.maxDt;
+    if (m_maxSpeed > 0.0f)
+        dt = std::min(dt, commonParam.cflNumber * spacing / m_maxSpeed);
+    if (acceleration > 0.0f)
+        dt = std::min(dt, sqrtf(commonParam.cflNumber * spacing / acceleration));
+
+    // shrink at once on violent steps, grow by at most 20% per step
+    dt = std::min(dt, 1.2f * m_nextDt);
+    return glm::clamp(dt, commonParam.minDt, commonParam.maxDt);
 }
 
-bool HiPhysics::MemsetFromHost(SimBufferPtr simBuffer) {
+bool HiPhysics::MemsetFromHost(SimBufferPtr simBuffer, float dt) {
     cudaError_t cudaError;
     uint64_t count = simBuffer->GetNumParticles();
 
+    // the device parameters carry the time step of this step, the host ones keep the scene's
+    CommonParameters commonParam = simBuffer->m_commonParam;
+    commonParam.dt = dt;
+
 	// cudaMemcpy(dm_DataFluid.positions, simBuffer->m_positions.data(), count*sizeof(glm::vec3), cudaMemcpyHostToDevice);
 	// cudaDeviceSynchronize(); 
     // cudaError = cudaGetLastError();
@@ -466,7 +1138,7 @@ bool HiPhysics::MemsetFromHost(SimBufferPtr simBuffer) {
     //     return false;
   	// }
     
-	cudaMemcpy(dm_DataFluid.commonParam, &simBuffer->m_commonParam, sizeof(CommonParameters), cudaMemcpyHostToDevice);
+	cudaMemcpy(dm_DataFluid.commonParam, &commonParam, sizeof(CommonParameters), cudaMemcpyHostToDevice);
 	cudaDeviceSynchronize(); 
     cudaError = cudaGetLastError();
 	if (cudaError != cudaSuccess)
@@ -486,6 +1158,26 @@ bool HiPhysics::MemsetFromHost(SimBufferPtr simBuffer) {
         return false;
   	}
 
+	cudaMemcpy(dm_SimParameters.commonParam, &commonParam, sizeof(CommonParameters), cudaMemcpyHostToDevice);
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("Memcpy dm_SimParameters.commonParam %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
+
+	cudaMemcpy(dm_SimParameters.phaseParam, simBuffer->m_phaseParam.data(), simBuffer->m_phaseParam.size()*sizeof(PhaseParameters), cudaMemcpyHostToDevice);
+	cudaDeviceSynchronize(); 
+    cudaError = cudaGetLastError();
+	if (cudaError != cudaSuccess)
+  	{
+        printf("Memcpy dm_SimParameters.phaseParam %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+        return false;
+  	}
+
     return true;
 }
 
@@ -502,6 +1194,16 @@ bool HiPhysics::PredictPosition(SimBufferPtr simBuffer) {
         printf("Error at HiPhysicsPBD::kePredictPosition :%s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
+
+    // XPBD multipliers accumulate over the iterations of one substep only
+    cudaMemset(dm_DataFluid.lambdas, 0, m_numParticles*MultiplierStorageSize(m_precision));
+    cudaMemset(dm_DataCloth.constraintLambdas, 0, simBuffer->GetNumClothConstraints()*sizeof(float));
+    cudaError = cudaGetLastError();
+    if (cudaError != cudaSuccess)
+    {
+        printf("clear(Memset) lambdas %s\n",cudaGetErrorString(cudaError));
+        exit(1);
+    }
     cudaDeviceSynchronize();
 
     return true;
@@ -511,20 +1213,28 @@ bool HiPhysics::ComputeGridIndices(SimBufferPtr simBuffer){
 
     cudaError_t cudaError; // TODO : make it as a member variable.
 
-    glm::vec3 maxPosition = max_element_xyz(&simBuffer->m_positions) + glm::vec3(simBuffer->m_commonParam.radius);
-    glm::vec3 minPosition = min_element_xyz(&simBuffer->m_positions) - glm::vec3(simBuffer->m_commonParam.radius);
-    float H = simBuffer->m_commonParam.radius * 1.2f * 2.0f * 2.0f;
-    int32_t ix = static_cast<int32_t>((maxPosition.x - (simBuffer->m_commonParam.radius) - minPosition.x)/H)+1;
-    int32_t iy = static_cast<int32_t>((maxPosition.y - (simBuffer->m_commonParam.radius) - minPosition.y)/H)+1;
-    int32_t iz = static_cast<int32_t>((maxPosition.z - (simBuffer->m_commonParam.radius) - minPosition.z)/H)+1;
-    cudaMemset(dm_DataFluid.numPartInGrids, 0, (ix)*(iy)*(iz)*sizeof(int32_t));
+    // bounds of the positions about to be binned, only the two corners come back to the host
+    thrust::device_ptr<glm::vec3> correctedPos = thrust::device_pointer_cast(dm_DataFluid.correctedPos);
+    PositionBounds empty { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+    PositionBounds bounds = thrust::transform_reduce(correctedPos, correctedPos + m_numParticles, 
+                                                     ToPositionBounds(), empty, MergePositionBounds());
+    m_maxPosition = bounds.maxPoint + glm::vec3(simBuffer->m_commonParam.radius);
+    m_minPosition = bounds.minPoint - glm::vec3(simBuffer->m_commonParam.radius);
+    glm::vec3 minPosition = m_minPosition;
+    glm::vec3 maxPosition = m_maxPosition;
+    uint64_t numCells = GridCellCount(minPosition, maxPosition, simBuffer->m_commonParam.radius);
+    if (numCells > m_gridCapacity)
+    {
+        m_gridCapacity = numCells + numCells / 4;
+        ReallocDevice(dm_DataFluid.numPartInGrids, m_gridCapacity);
+    }
+    cudaMemset(dm_DataFluid.numPartInGrids, 0, numCells*sizeof(int32_t));
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
         printf("clear(Memset) dm_DataFluid.numPartInGrids %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
 
     // 1. assign Grid ID to Particles.
     keComputeGridID<<< 1 +  m_numParticles/256, 256>>>(dm_DataFluid, minPosition, maxPosition, m_numParticles);
@@ -534,7 +1244,6 @@ bool HiPhysics::ComputeGridIndices(SimBufferPtr simBuffer){
         printf("Error at HiPhysicsPBD::keComputeGridID %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
 
 
     // 2. Count the number of Particles in each Grids.
@@ -545,11 +1254,10 @@ bool HiPhysics::ComputeGridIndices(SimBufferPtr simBuffer){
         printf("Error at HiPhysicsPBD::keCountParticlesInGrids %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
 
     // 3. Inclusive scan the number of particels in each Grids.
     {
-        thrust::device_vector<int32_t> temp(dm_DataFluid.numPartInGrids,dm_DataFluid.numPartInGrids + ix*iy*iz);
+        thrust::device_vector<int32_t> temp(dm_DataFluid.numPartInGrids,dm_DataFluid.numPartInGrids + numCells);
         thrust::device_ptr<int32_t> dev_ptr = thrust::device_pointer_cast(dm_DataFluid.numPartInGrids);
         thrust::inclusive_scan(temp.begin(), temp.end(), dev_ptr);
     }
@@ -593,11 +1301,15 @@ bool HiPhysics::SortVariablesByIndices(SimBufferPtr simBuffer) {
         thrust::gather(indices.begin(),indices.end(), temp.data(), dev_ptr);
     }
 
+    GatherMultipliers(dm_DataFluid.lambdas, indices, m_numParticles, m_precision);
+    
     {
-        thrust::device_ptr<float> dev_ptr = thrust::device_pointer_cast(dm_DataFluid.lambdas);
-        thrust::device_vector<float> temp(dm_DataFluid.lambdas,dm_DataFluid.lambdas+m_numParticles);
+        thrust::device_ptr<glm::vec3> dev_ptr = thrust::device_pointer_cast(dm_DataFluid.vorticity);
+        thrust::device_vector<glm::vec3> temp(dm_DataFluid.vorticity,dm_DataFluid.vorticity+m_numParticles);
         thrust::gather(indices.begin(),indices.end(), temp.data(), dev_ptr);
     }
+
+    GatherMultipliers(dm_DataFluid.deltaLambdas, indices, m_numParticles, m_precision);
     
     {
         thrust::device_ptr<glm::vec3> dev_ptr = thrust::device_pointer_cast(dm_DataFluid.deltaPos);
@@ -611,296 +1323,232 @@ bool HiPhysics::SortVariablesByIndices(SimBufferPtr simBuffer) {
         thrust::gather(indices.begin(),indices.end(), temp.data(), dev_ptr);
     }
 
-    return true;
+    {
+        thrust::device_ptr<float> dev_ptr = thrust::device_pointer_cast(dm_DataFluid.invMasses);
+        thrust::device_vector<float> temp(dm_DataFluid.invMasses,dm_DataFluid.invMasses+m_numParticles);
+        thrust::gather(indices.begin(),indices.end(), temp.data(), dev_ptr);
+    }
+
+    {
+        thrust::device_ptr<uint8_t> dev_ptr = thrust::device_pointer_cast(dm_DataFluid.surfaceFlags);
+        thrust::device_vector<uint8_t> temp(dm_DataFluid.surfaceFlags,dm_DataFluid.surfaceFlags+m_numParticles);
+        thrust::gather(indices.begin(),indices.end(), temp.data(), dev_ptr);
+    }
+
+    {
+        thrust::device_ptr<int32_t> dev_ptr = thrust::device_pointer_cast(dm_DataFluid.originalIDs);
+        thrust::device_vector<int32_t> temp(dm_DataFluid.originalIDs,dm_DataFluid.originalIDs+m_numParticles);
+        thrust::gather(indices.begin(),indices.end(), temp.data(), dev_ptr);
+    }
+
+    // slots[originalIDs[slot]] = slot
+    thrust::scatter(thrust::counting_iterator<int32_t>(0), thrust::counting_iterator<int32_t>(m_numParticles),
+                    thrust::device_pointer_cast(dm_DataFluid.originalIDs), 
+                    thrust::device_pointer_cast(dm_DataFluid.slots));
+
+    return GroupParticlesByPhase();
 }
 
-bool HiPhysics::ComputeConstraint(SimBufferPtr simBuffer){
+template <typename Policy>
+bool HiPhysics::ComputeFluidConstraint(glm::vec3 minPosition, glm::vec3 maxPosition, bool lastIteration, bool classifySurface){
 
     cudaError_t cudaError;
 
-    glm::vec3 maxPosition = max_element_xyz(&simBuffer->m_positions) + glm::vec3(simBuffer->m_commonParam.radius);
-    glm::vec3 minPosition = min_element_xyz(&simBuffer->m_positions) - glm::vec3(simBuffer->m_commonParam.radius);
+    // Compress the sorted positions : both traversals below read them
+    if (m_quantizedPositions)
+    {
+        keQuantizePositions<<< 1 + m_numParticles / 256, 256, 0, m_fluidStream >>>(dm_DataFluid, minPosition, maxPosition, m_numParticles);
+        cudaError = cudaGetLastError();
+        if (cudaError != cudaSuccess)
+        {
+            printf("Error at HiPhysics::ComputeConstraint-keQuantizePositions  %s\n",cudaGetErrorString(cudaError));
+            exit(1);
+        }
+    }
 
     // Compute Constraints
-    keComputeConstraint<<< 1 + m_numParticles / 32, 32 >>>(dm_DataFluid, minPosition, maxPosition, m_numParticles);
+    keComputeConstraint<Policy><<< 1 + m_numFluidParticles / 32, 32, 0, m_fluidStream >>>(dm_DataFluid, minPosition, maxPosition, m_numFluidParticles);
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
         printf("Error at HiPhysics::ComputeConstraint-keComputeConstraint  %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
 
-    // Correct Positions
-    keComputePositionCorrection<<< 1 + m_numParticles / 256, 256 >>>(dm_DataFluid, minPosition, maxPosition, m_numParticles);
-    cudaError = cudaGetLastError();
-    if (cudaError != cudaSuccess)
+    // Classify the surface from the positions before their correction, as the density saw them
+    if (classifySurface)
     {
-        printf("Error at HiPhysics::ComputeConstraint-keComputePositionCorrection  %s\n",cudaGetErrorString(cudaError));
-        exit(1);
+        keClassifySurface<<< 1 + m_numFluidParticles / 256, 256, 0, m_fluidStream >>>(dm_DataFluid, minPosition, maxPosition, m_numFluidParticles);
+        cudaError = cudaGetLastError();
+        if (cudaError != cudaSuccess)
+        {
+            printf("Error at HiPhysics::ComputeConstraint-keClassifySurface  %s\n",cudaGetErrorString(cudaError));
+            exit(1);
+        }
     }
-    cudaDeviceSynchronize();
 
-    // Update Corrected Positions
-    keUpdateCorretedPosition<<< 1 +  m_numParticles/256, 256>>>(dm_DataFluid, m_numParticles);
+    // Correct Positions
+    keComputePositionCorrection<Policy><<< 1 + m_numFluidParticles / 256, 256, 0, m_fluidStream >>>(dm_DataFluid, minPosition, maxPosition, lastIteration, m_numFluidParticles);
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
-        printf("Error at HiPhysics::ComputeConstraint-keUpdatePosition :%s\n",cudaGetErrorString(cudaError));
+        printf("Error at HiPhysics::ComputeConstraint-keComputePositionCorrection  %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
-
-	cudaMemcpy(simBuffer->m_positions.data(),      dm_DataFluid.correctedPos,      m_numParticles*sizeof(glm::vec3),  cudaMemcpyDeviceToHost);
-	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
-	if (cudaError != cudaSuccess)
-  	{
-        printf("Error at HiPhysics::ComputeConstraint-memcpyDelPos :%s\n",cudaGetErrorString(cudaError));
-        exit(1);
-        return false;
-  	}
 
     return true;
 }
 
-bool HiPhysics::UpdateVelPos(SimBufferPtr simBuffer){
+bool HiPhysics::ComputeConstraint(SimBufferPtr simBuffer, bool lastIteration, bool classifySurface){
 
-    cudaError_t cudaError; // TODO : 맴버변수화 
+    cudaError_t cudaError;
 
-    keUpdateVelPos<<< 1 +  m_numParticles/256, 256>>>(dm_DataFluid, m_numParticles);
+    // the grid the particles were just sorted into
+    glm::vec3 minPosition = m_minPosition;
+    glm::vec3 maxPosition = m_maxPosition;
 
+    // fluid density and cloth contacts both read correctedPos and write deltaPos of their own particles
+    ForkStreams();
+
+    switch (m_precision)
+    {
+    case Precision::HALF_STORAGE :  ComputeFluidConstraint<PrecisionHalfStorage>(minPosition, maxPosition, lastIteration, classifySurface); break;
+    case Precision::DOUBLE :        ComputeFluidConstraint<PrecisionDouble>(minPosition, maxPosition, lastIteration, classifySurface); break;
+    default :                       ComputeFluidConstraint<PrecisionSingle>(minPosition, maxPosition, lastIteration, classifySurface); break;
+    }
+
+    // Cloth contacts with fluid and with itself
+    keCollisionCloth<<< 1 + m_numClothParticles / 256, 256, 0, m_clothStream >>>(dm_DataCloth, dm_SimParameters, minPosition, maxPosition, m_clothHashSize, m_numClothParticles);
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
-        printf("Error at HiPhysics::UpdateVelPos :%s\n",cudaGetErrorString(cudaError));
+        printf("Error at HiPhysics::ComputeConstraint-keCollisionCloth  %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
-    return true;
-}
-
-bool HiPhysics::GetRenderingVariable(SimBufferPtr simBuffer){
 
-    cudaError_t cudaError;
-
-    keGetRenderValues<<< 1 +  m_numParticles/256, 256>>>(dm_DataFluid, m_numParticles);
+    JoinStreams();
 
+    // Update Corrected Positions
+    keUpdateCorretedPosition<<< 1 +  m_numParticles/256, 256>>>(dm_DataFluid, m_numParticles);
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
-        printf("Error at HiPhysicsPBD::keGetRenderValues %s\n",cudaGetErrorString(cudaError));
+        printf("Error at HiPhysics::ComputeConstraint-keUpdatePosition :%s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
-    return true;
-}
-
-
-
-
-
-
 
-
-
-
-void HiPhysics::UpdateSolverCloth(SimBufferPtr simBuffer) {
-    m_numParticles = simBuffer->GetNumParticles();
-    
-    if (m_numParticles > 0)
+    // exact contacts with the triangle meshes, after the SDF and box projections
+    if (dm_DataFluid.numMeshColliders > 0)
     {
-        /// APPLY THE CHANGE BY USER INTERFACE
-        MemsetFromHostCloth(simBuffer);
-
-        /// 
-        PredictPositionCloth(simBuffer);
-
-        ///
-        
-        for (int32_t ii = 0; ii < simBuffer->m_commonParam.iterationNumber; ++ii)
+        keCollideMeshes<<< 1 +  m_numParticles/256, 256>>>(dm_DataFluid, m_numParticles);
+        cudaError = cudaGetLastError();
+        if (cudaError != cudaSuccess)
         {
-            ComputeConstraintCloth(simBuffer);
+            printf("Error at HiPhysics::ComputeConstraint-keCollideMeshes :%s\n",cudaGetErrorString(cudaError));
+            exit(1);
         }
-            
-        /// UPDATE PARTICLE POSITIONS
-        UpdateVelPosCloth(simBuffer);
-
-        /// GET VALUES FOR RENDERING PARTICLE COLOR
-        GetRenderingVariableCloth(simBuffer);
     }
-}
-
-
-bool HiPhysics::MemsetFromHostCloth(SimBufferPtr simBuffer) {
-    cudaError_t cudaError;
-    uint64_t count = simBuffer->GetNumParticles();
-    
-	cudaMemcpy(dm_SimParameters.commonParam, &simBuffer->m_commonParam, sizeof(CommonParameters), cudaMemcpyHostToDevice);
-	cudaDeviceSynchronize(); 
-    cudaError = cudaGetLastError();
-	if (cudaError != cudaSuccess)
-  	{
-        printf("Memcpy dm_SimParameters.commonParam %s\n",cudaGetErrorString(cudaError));
-        exit(1);
-        return false;
-  	}
-
-	cudaMemcpy(dm_SimParameters.phaseParam, simBuffer->m_phaseParam.data(), simBuffer->m_phaseParam.size()*sizeof(PhaseParameters), cudaMemcpyHostToDevice);
-	cudaDeviceSynchronize(); 
-    cudaError = cudaGetLastError();
-	if (cudaError != cudaSuccess)
-  	{
-        printf("Memcpy dm_SimParameters.phaseParam %s\n",cudaGetErrorString(cudaError));
-        exit(1);
-        return false;
-  	}
 
     return true;
 }
 
-bool HiPhysics::PredictPositionCloth(SimBufferPtr simBuffer) {
+bool HiPhysics::UpdateVelPos(SimBufferPtr simBuffer){
 
-    cudaError_t cudaError; // TODO : make it as a member variable.
+    cudaError_t cudaError; // TODO : 맴버변수화 
 
-    // 0. Predict Position
-    kePredictPositionCloth<<< 1 +  m_numParticles/256, 256>>>(dm_DataCloth, dm_SimParameters, m_numParticles);
+    keUpdateVelPos<<< 1 +  m_numParticles/256, 256>>>(dm_DataFluid, m_numParticles);
 
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
-        printf("Error at HiPhysicsPBD::kePredictPosition :%s\n",cudaGetErrorString(cudaError));
+        printf("Error at HiPhysics::UpdateVelPos :%s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
     cudaDeviceSynchronize();
-
     return true;
 }
 
-
-bool HiPhysics::ComputeConstraintCloth(SimBufferPtr simBuffer){
+bool HiPhysics::GetRenderingVariable(SimBufferPtr simBuffer){
 
     cudaError_t cudaError;
-    // Compute Constraints
-    keComputeStretchCloth<<< 1 +  simBuffer->GetNumStretchLines()/256, 256>>>(dm_DataCloth, dm_SimParameters, simBuffer->GetNumStretchLines());
-    cudaError = cudaGetLastError();
-    if (cudaError != cudaSuccess)
-    {
-        printf("Error at HiPhysics::ComputeConstraint-keComputeConstraintCloth  %s\n",cudaGetErrorString(cudaError));
-        exit(1);
-    }
-    cudaDeviceSynchronize();
-    
-    keComputeBendCloth<<< 1 +  simBuffer->GetNumBendLines()/256, 256>>>(dm_DataCloth, dm_SimParameters, simBuffer->GetNumBendLines());
-    cudaError = cudaGetLastError();
-    if (cudaError != cudaSuccess)
+
+    ForkStreams();
+
+    switch (m_precision)
     {
-        printf("Error at HiPhysics::ComputeConstraint-keComputeConstraintCloth  %s\n",cudaGetErrorString(cudaError));
-        exit(1);
+    case Precision::HALF_STORAGE :  keGetRenderValues<PrecisionHalfStorage><<< 1 +  m_numFluidParticles/256, 256, 0, m_fluidStream>>>(dm_DataFluid, m_numFluidParticles); break;
+    case Precision::DOUBLE :        keGetRenderValues<PrecisionDouble><<< 1 +  m_numFluidParticles/256, 256, 0, m_fluidStream>>>(dm_DataFluid, m_numFluidParticles); break;
+    default :                       keGetRenderValues<PrecisionSingle><<< 1 +  m_numFluidParticles/256, 256, 0, m_fluidStream>>>(dm_DataFluid, m_numFluidParticles); break;
     }
-    cudaDeviceSynchronize();
-    
-    keComputeShearCloth<<< 1 +  simBuffer->GetNumShearLines()/256, 256>>>(dm_DataCloth, dm_SimParameters, simBuffer->GetNumShearLines());
+
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
-        printf("Error at HiPhysics::ComputeConstraint-keComputeConstraintCloth  %s\n",cudaGetErrorString(cudaError));
+        printf("Error at HiPhysicsPBD::keGetRenderValues %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
 
-    // Update Corrected Positions
-    keUpdateCorretedPositionCloth<<< 1 +  m_numParticles/256, 256>>>(dm_DataCloth, dm_SimParameters, m_numParticles);
+    keGetRenderValuesCloth<<< 1 +  m_numClothParticles/256, 256, 0, m_clothStream>>>(dm_DataCloth, m_numClothParticles);
+
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
-        printf("Error at HiPhysics::ComputeConstraint-keUpdateCorretedPositionCloth :%s\n",cudaGetErrorString(cudaError));
+        printf("Error at HiPhysicsPBD::keGetRenderValuesCloth %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
-
-	// cudaMemcpy(simBuffer->m_positions.data(),      dm_DataCloth.correctedPos,      m_numParticles*sizeof(glm::vec3),  cudaMemcpyDeviceToHost);
-	// cudaDeviceSynchronize(); cudaError = cudaGetLastError();
-	// if (cudaError != cudaSuccess)
-  	// {
-    //     printf("Error at HiPhysics::ComputeConstraint-memcpyDelPos :%s\n",cudaGetErrorString(cudaError));
-    //     exit(1);
-    //     return false;
-  	// }
 
+    JoinStreams();
+    cudaDeviceSynchronize();
     return true;
 }
 
-bool HiPhysics::UpdateVelPosCloth(SimBufferPtr simBuffer){
-
-    cudaError_t cudaError; // TODO : 맴버변수화 
+bool HiPhysics::ComputeHashCloth(SimBufferPtr simBuffer){
 
-    keUpdateVelPosCloth<<< 1 +  m_numParticles/256, 256>>>(dm_DataCloth, dm_SimParameters, m_numParticles);
+    cudaError_t cudaError;
+    if (m_numClothParticles == 0) return true;
 
+    keComputeHashCloth<<< 1 +  m_numClothParticles/256, 256>>>(dm_DataCloth, dm_SimParameters, m_clothHashSize, m_numClothParticles);
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
-        printf("Error at HiPhysics::UpdateVelPos :%s\n",cudaGetErrorString(cudaError));
+        printf("Error at HiPhysicsPBD::keComputeHashCloth %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
-    return true;
-}
-
-bool HiPhysics::GetRenderingVariableCloth(SimBufferPtr simBuffer){
-
-    cudaError_t cudaError;
 
-    keGetRenderValuesCloth<<< 1 +  m_numParticles/256, 256>>>(dm_DataCloth, m_numParticles);
+    thrust::sort_by_key(thrust::device_pointer_cast(dm_DataCloth.hashKeys), 
+                        thrust::device_pointer_cast(dm_DataCloth.hashKeys) + m_numClothParticles, 
+                        thrust::device_pointer_cast(dm_DataCloth.hashIDs));
 
+    cudaMemset(dm_DataCloth.cellStart, 0xff, m_clothHashSize*sizeof(int32_t));
+    keFindCellRangeCloth<<< 1 +  m_numClothParticles/256, 256>>>(dm_DataCloth, m_numClothParticles);
     cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess)
     {
-        printf("Error at HiPhysicsPBD::keGetRenderValues %s\n",cudaGetErrorString(cudaError));
+        printf("Error at HiPhysicsPBD::keFindCellRangeCloth %s\n",cudaGetErrorString(cudaError));
         exit(1);
     }
-    cudaDeviceSynchronize();
+
     return true;
 }
 
+bool HiPhysics::ComputeConstraintCloth(SimBufferPtr simBuffer){
 
-
-bool HiPhysics::GetMemoryCloth(SimBufferPtr simBuffer) {
     cudaError_t cudaError;
+    // Compute Constraints : one Gauss-Seidel batch per color
+    for (size_t k = 0; k + 1 < m_clothColorOffsets.size(); ++k)
+    {
+        int64_t offset = m_clothColorOffsets[k];
+        int64_t nConstraints = m_clothColorOffsets[k + 1] - offset;
 
-    uint64_t count = simBuffer->GetNumParticles();
-
-	cudaMemcpy(simBuffer->m_colorValues.data(), dm_DataCloth.colorValues, count*sizeof(float),    cudaMemcpyDeviceToHost);
-	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
-	if (cudaError != cudaSuccess)
-  	{
-        printf("Error at HiPhysics::GetMemory %s\n",cudaGetErrorString(cudaError));
-        exit(1);
-        return false;
-  	}
-	cudaMemcpy(simBuffer->m_positions.data(),   dm_DataCloth.positions,   count*sizeof(glm::vec3),cudaMemcpyDeviceToHost);
-	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
-	if (cudaError != cudaSuccess)
-  	{
-        printf("Error at HiPhysics::GetMemory %s\n",cudaGetErrorString(cudaError));
-        exit(1);
-        return false;
-  	}
-	cudaMemcpy(simBuffer->m_velocities.data(),  dm_DataCloth.velocities,  count*sizeof(glm::vec3),cudaMemcpyDeviceToHost);
-	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
-	if (cudaError != cudaSuccess)
-  	{
-        printf("Error at HiPhysics::GetMemory %s\n",cudaGetErrorString(cudaError));
-        exit(1);
-        return false;
-  	}
-	cudaMemcpy(simBuffer->m_phases.data(),      dm_DataCloth.phases,      count*sizeof(int32_t),  cudaMemcpyDeviceToHost);
-	cudaDeviceSynchronize(); cudaError = cudaGetLastError();
-	if (cudaError != cudaSuccess)
-  	{
-        printf("Error at HiPhysics::GetMemory %s\n",cudaGetErrorString(cudaError));
-        exit(1);
-        return false;
-  	}
+        keSolveDistanceCloth<<< 1 +  nConstraints/256, 256>>>(dm_DataCloth, dm_SimParameters, offset, nConstraints);
+        cudaError = cudaGetLastError();
+        if (cudaError != cudaSuccess)
+        {
+            printf("Error at HiPhysics::ComputeConstraint-keSolveDistanceCloth  %s\n",cudaGetErrorString(cudaError));
+            exit(1);
+        }
+    }
 
     return true;
 }
+
@@ -5,6 +5,11 @@
 #include "../core/vec3.h"
 #include "../src/common.h"
 #include "../src/simbuffer.h"
+#include "../src/halo.h"
+
+// same declarations as the CUDA runtime, so host only translation units can hold streams
+typedef struct CUstream_st* cudaStream_t;
+typedef struct CUevent_st* cudaEvent_t;
 struct DeviceSimParams{
 
 	CommonParameters* commonParam;
@@ -16,11 +21,47 @@ struct DeviceSimParams{
         {};
 };
 
+// Position relative to the origin of its grid cell, in 1/65535 of the cell size
+struct QuantizedPosition {
+    uint16_t x;
+    uint16_t y;
+    uint16_t z;
+};
+
+// Rigid transform of a collider : world = rotation * collider space + translation
+struct ColliderPose {
+    glm::mat3 rotation;
+    glm::vec3 translation;
+};
+
+// Grid of one SdfCollider, its distances start at offset in DeviceDataFluid::colliderDistances.
+// Kinematic colliders move from previousPose to pose over the current substep.
+struct DeviceCollider {
+    glm::vec3 origin;
+    float cellSize;
+    glm::ivec3 dims;
+    float bandWidth;
+    int64_t offset;
+    ColliderPose pose;
+    ColliderPose previousPose;
+    float friction;
+};
+
+// One MeshCollider, its nodes, triangles and vertices start at these offsets in DeviceDataFluid.
+// Triangle vertex IDs are local to the collider.
+struct DeviceMeshCollider {
+    int32_t nodeOffset;
+    int32_t triangleOffset;
+    int32_t vertexOffset;
+    ColliderPose pose;
+    ColliderPose previousPose;
+    float friction;
+};
+
 struct DeviceParticleData{
     // To search near particles.
     int32_t* gridIndices;      // Particle Grid Index
     int32_t* numPartInGrids;   // Particle Number of PArticles in each Grid
-    int32_t* nearGridID;       // Near Grid IDs of each Grids
     
     // Interchangable Data with Host
     float* colorValues;
@@ -31,11 +72,15 @@ struct DeviceParticleData{
     // To compute next position
     glm::vec3* deltaPos;       // Particle Positions Displace 
     glm::vec3* correctedPos;   // Particle Corrected Positions
+    float* invMasses;          // Particle inverse mass, 0 : pinned
+
+    // Particles are reordered by grid index every iteration
+    int32_t* originalIDs;      // SimBuffer ID of the particle in each slot
+    int32_t* slots;            // Current slot of each SimBuffer particle
 
     DeviceParticleData() : 
         gridIndices(nullptr),
         numPartInGrids(nullptr),
-        nearGridID(nullptr),
 
         colorValues(nullptr), 
         positions(nullptr),
@@ -43,15 +88,46 @@ struct DeviceParticleData{
         phases(nullptr),
 
         deltaPos(nullptr),
-        correctedPos(nullptr)
+        correctedPos(nullptr),
+        invMasses(nullptr),
+
+        originalIDs(nullptr),
+        slots(nullptr)
         {};  
 };
 
+// Holds every particle of the scene, fluid or not.
 struct DeviceDataFluid : DeviceParticleData{
 
     // Only for Device
     float* constraints;        // Particle Constraints
-    float* lambdas;            // Particle Lambdas
+    // Lagrange multipliers, stored in the type of the precision policy (see MultiplierBuffer)
+    void* lambdas;             // Particle Lambdas, accumulated over the iterations of a substep
+    void* deltaLambdas;        // Lambda change of the current iteration
+    int32_t* fluidIDs;         // Slots of the fluid particles, in grid order
+    float* stepStatistics;     // [0] max speed, [1] max constraint acceleration of the step
+    uint8_t* surfaceFlags;     // 0 : fluid particle away from the free surface, classified once per step while the renderer draws the surface only
+
+    // accumulated by the last correction pass of a substep, applied in keUpdateVelPos
+    glm::vec3* xsphVelocity;       // XSPH viscosity velocity change
+    glm::vec3* vorticity;          // curl of the previous substep, follows the particles through the sort
+    glm::vec3* vorticityNext;      // curl of the current substep, swapped with vorticity
+    glm::vec3* vorticityGradient;  // gradient of |curl|, from the previous substep curl of the neighbors
+
+    // compressed copy of correctedPos, encoded after each sort, nullptr if disabled
+    QuantizedPosition* quantizedPos;
+
+    // static SDF colliders, the corrected positions are pushed out of them
+    DeviceCollider* colliders;
+    float* colliderDistances;
+    int32_t numColliders;
+
+    // triangle mesh colliders, flattened BVHs of every collider one after the other
+    DeviceMeshCollider* meshColliders;
+    BvhNode* meshNodes;
+    int32_t* meshTriangles;
+    glm::vec3* meshVertices;
+    int32_t numMeshColliders;
     
     // Parameters : TODO : move to simParameters
 	CommonParameters* commonParam;
@@ -60,24 +136,65 @@ struct DeviceDataFluid : DeviceParticleData{
     DeviceDataFluid() :
         constraints(nullptr),
         lambdas(nullptr),
+        deltaLambdas(nullptr),
+        fluidIDs(nullptr),
+        stepStatistics(nullptr),
+        surfaceFlags(nullptr),
+        xsphVelocity(nullptr),
+        vorticity(nullptr),
+        vorticityNext(nullptr),
+        vorticityGradient(nullptr),
+        quantizedPos(nullptr),
+        colliders(nullptr),
+        colliderDistances(nullptr),
+        numColliders(0),
+        meshColliders(nullptr),
+        meshNodes(nullptr),
+        meshTriangles(nullptr),
+        meshVertices(nullptr),
+        numMeshColliders(0),
         
         commonParam(nullptr),
         phaseParam(nullptr)
         {};
 };
 
-
+// Cloth view of the particles : the DeviceParticleData arrays alias the ones of DeviceDataFluid.
+// Constraint and adjacency IDs are SimBuffer IDs, resolved through slots.
 struct DeviceDataCloth : DeviceParticleData{
-    int32_t* stretchID; 
-    int32_t* bendID; 
-    int32_t* shearID; 
+    // distance constraints grouped by color : 
+    // no two constraints of the same color share a particle
+    int32_t* constraintID0;    // Particle ID of the first end
+    int32_t* constraintID1;    // Particle ID of the second end
+    float* restLengths;
+    float* compliance;
+    float* constraintLambdas;  // XPBD multipliers, reset every substep
     int32_t* triangles;
+    int32_t* clothIDs;         // Slots of the cloth particles, in grid order
+
+    int32_t* adjacencyOffsets; // CSR constraint graph : connected pairs never collide
+    int32_t* adjacencyIDs;
+
+    // self collision : cloth particles hashed by their predicted position once per substep
+    int32_t* hashKeys;         // Hash cell of each entry, sorted
+    int32_t* hashIDs;          // SimBuffer ID of each entry, resolved through slots
+    int32_t* cellStart;        // First entry of each hash cell, -1 : empty
+    int32_t* cellEnd;          // One past the last entry of each hash cell
 
     DeviceDataCloth() :
-        stretchID(nullptr),
-        bendID(nullptr),
-        shearID(nullptr),
-        triangles(nullptr)
+        constraintID0(nullptr),
+        constraintID1(nullptr),
+        restLengths(nullptr),
+        compliance(nullptr),
+        constraintLambdas(nullptr),
+        triangles(nullptr),
+        clothIDs(nullptr),
+        adjacencyOffsets(nullptr),
+        adjacencyIDs(nullptr),
+        hashKeys(nullptr),
+        hashIDs(nullptr),
+        cellStart(nullptr),
+        cellEnd(nullptr)
         {};
 };
 
@@ -92,15 +209,25 @@ public:
     
     bool SetMemory(SimBufferPtr simBuffer);
 
-    bool SetMemoryCloth(SimBufferPtr simBuffer);
+    // replace the particles after the SimBuffer added, removed or reordered them.
+    // Time, time step controller, parameters, colliders, cloth constraints and streams are kept,
+    // the particle arrays are only reallocated when they outgrow their capacity.
+    bool UploadParticles(SimBufferPtr simBuffer);
+
+    // a decomposed scene : the ghosts are refreshed before every iteration and the ranks agree on the
+    // adaptive time step, the solver steps even without particles. nullptr : a single process
+    void SetHaloExchange(HaloExchange* halo) { m_halo = halo; }
     
     bool GetMemory(SimBufferPtr simBuffer);
     
-    bool MemsetFromHost(SimBufferPtr simBuffer);
-    
-    bool MemsetFromHostCloth(SimBufferPtr simBuffer);
+    // upload the parameters, with dt as the time step of the coming step
+    bool MemsetFromHost(SimBufferPtr simBuffer, float dt);
+
+    // upload the vertices and nodes of the mesh colliders after they deformed and were refit,
+    // rigid motions only need their ColliderMotion
+    bool UpdateMeshColliders(SimBufferPtr simBuffer);
     
-    // Physics Functions
+    // Physics Functions : one step for fluid and cloth particles together
 
 	void UpdateSolver(SimBufferPtr simBuffer);
     
@@ -110,44 +237,125 @@ public:
     
     bool SortVariablesByIndices(SimBufferPtr simBuffer);
     
-    bool ComputeConstraint(SimBufferPtr simBuffer);
+    // the last iteration of a substep also accumulates viscosity and vorticity,
+    // the last one of a step also classifies the surface particles when the renderer asks for them
+    bool ComputeConstraint(SimBufferPtr simBuffer, bool lastIteration = false, bool classifySurface = false);
+
+    bool ComputeConstraintCloth(SimBufferPtr simBuffer);
+
+    // bin the predicted cloth positions for self collision
+    bool ComputeHashCloth(SimBufferPtr simBuffer);
     
     bool UpdateVelPos(SimBufferPtr simBuffer);
 
     bool GetRenderingVariable(SimBufferPtr simBuffer);
 
-    // Cloth Functions
+    uint32_t GetActiveCount() const { return m_numParticles; }
 
-	void UpdateSolverCloth(SimBufferPtr simBuffer);
-    
-    bool PredictPositionCloth(SimBufferPtr simBuffer);
+    // time step the adaptive controller takes next, 0 before the first adaptive step
+    float GetNextDt() const { return m_nextDt; }
 
-    bool ComputeConstraintCloth(SimBufferPtr simBuffer);
-    
-    bool UpdateVelPosCloth(SimBufferPtr simBuffer);
-    
-    bool GetRenderingVariableCloth(SimBufferPtr simBuffer);
+private:
 
-    bool GetMemoryCloth(SimBufferPtr simBuffer);
+    HiPhysics() {};
 
+    bool Init();
 
-    uint32_t GetActiveCount() const { return m_numParticles; }
+    // advance by dt : prediction, iterations and velocity update for every substep
+    bool Step(SimBufferPtr simBuffer, float dt);
 
-private:
+    // CFL time step from the statistics of the last step, smoothed and bounded
+    float ComputeAdaptiveDt(const CommonParameters& commonParam) const;
 
-    HiPhysics() {};
+    bool SetMemoryCloth(SimBufferPtr simBuffer);
 
-    bool Init();
+    bool SetMemoryColliders(SimBufferPtr simBuffer);
+
+    bool SetMemoryMeshColliders(SimBufferPtr simBuffer);
+
+    // poses of the kinematic colliders at the start and the end of a substep
+    bool UpdateColliderPoses(SimBufferPtr simBuffer, float startTime, float endTime);
+
+    // rebuild the fluid and cloth slot lists after the particles moved
+    bool GroupParticlesByPhase();
+
+    // grow the self collision hash cells to the counted cloth particles
+    bool ResizeClothHash();
+
+    // send the boundary particles through m_halo and write the state of their copies into the ghosts
+    bool RefreshGhosts();
+
+    // density constraint and position correction with the kernels of one precision policy
+    template <typename Policy>
+    bool ComputeFluidConstraint(glm::vec3 minPosition, glm::vec3 maxPosition, bool lastIteration, bool classifySurface);
     
     uint32_t m_numParticles { 0 };
 
     uint32_t m_numFluidParticles { 0 };
 
+    uint32_t m_numClothParticles { 0 };
+
+    // particles the device arrays hold room for
+    uint64_t m_particleCapacity { 0 };
+
+    // cells numPartInGrids holds room for, the grid of the AnalysisBox at least
+    uint64_t m_gridCapacity { 0 };
+
+    float m_nextDt { 0.0f };
+
+    // grid bounds of the current iteration, reduced on the device by ComputeGridIndices and padded by the radius
+    glm::vec3 m_minPosition { 0.0f };
+
+    glm::vec3 m_maxPosition { 0.0f };
+
+    // simulated time since SetMemory, drives the kinematic colliders
+    float m_time { 0.0f };
+
+    // host copies of the collider descriptions, their poses are uploaded every substep if any collider moves
+    std::vector<DeviceCollider> m_hostColliders;
+
+    std::vector<DeviceMeshCollider> m_hostMeshColliders;
+
+    bool m_kinematicColliders { false };
+
+    float m_maxSpeed { 0.0f };
+
+    float m_maxAcceleration { 0.0f };
+
+    // fixed at SetMemory : the multipliers are allocated for it
+    Precision m_precision { Precision::SINGLE };
+
+    bool m_quantizedPositions { false };
+
+    HaloExchange* m_halo { nullptr };
+
+    // Fluid and cloth stages that only read each other's positions run on their own streams :
+    // they fork from the default stream after m_forkEvent and are joined before the next shared stage.
+    bool ForkStreams();
+
+    bool JoinStreams();
+
+    cudaStream_t m_fluidStream { nullptr };
+
+    cudaStream_t m_clothStream { nullptr };
+
+    cudaEvent_t m_forkEvent { nullptr };
+
+    cudaEvent_t m_fluidDone { nullptr };
+
+    cudaEvent_t m_clothDone { nullptr };
+
     DeviceSimParams dm_SimParameters {};
 
     DeviceDataFluid dm_DataFluid {};
 
     DeviceDataCloth dm_DataCloth {};
+
+    // first constraint of each color, computed once at SetMemoryCloth
+    std::vector<int32_t> m_clothColorOffsets;
+
+    // number of spatial hash cells for cloth self collision, a power of two
+    int32_t m_clothHashSize { 0 };
     
 };
 
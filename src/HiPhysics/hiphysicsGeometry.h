@@ -0,0 +1,93 @@
+#ifndef __HIPHYSICSGEOMETRY_H__
+#define __HIPHYSICSGEOMETRY_H__
+
+#include "../common.h"
+
+#ifndef HI_HOST_DEVICE
+#ifdef __CUDACC__
+#define HI_HOST_DEVICE __host__ __device__
+#else
+#define HI_HOST_DEVICE
+#endif
+#endif
+
+// Closest point of triangle abc to p, by the Voronoi regions of its vertices, edges and face
+// (Ericson, Real-Time Collision Detection 5.1.5)
+inline HI_HOST_DEVICE glm::vec3 ClosestPointOnTriangle(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+    glm::vec3 ab = b - a;
+    glm::vec3 ac = c - a;
+    glm::vec3 ap = p - a;
+    float d1 = glm::dot(ab, ap);
+    float d2 = glm::dot(ac, ap);
+    if ((d1 <= 0.0f) && (d2 <= 0.0f)) return a;
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp);
+    float d4 = glm::dot(ac, bp);
+    if ((d3 >= 0.0f) && (d4 <= d3)) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if ((vc <= 0.0f) && (d1 >= 0.0f) && (d3 <= 0.0f)) return a + (d1 / (d1 - d3)) * ab;
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp);
+    float d6 = glm::dot(ac, cp);
+    if ((d6 >= 0.0f) && (d5 <= d6)) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if ((vb <= 0.0f) && (d2 >= 0.0f) && (d6 <= 0.0f)) return a + (d2 / (d2 - d6)) * ac;
+
+    float va = d3 * d6 - d5 * d4;
+    if ((va <= 0.0f) && (d4 - d3 >= 0.0f) && (d5 - d6 >= 0.0f))
+        return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+
+    float denom = 1.0f / (va + vb + vc);
+    return a + (vb * denom) * ab + (vc * denom) * ac;
+}
+
+// Crossing of the segment origin + t * direction, t in [0, tMax), with triangle abc, from either side
+// (Moller-Trumbore). t is the parameter of the crossing.
+inline HI_HOST_DEVICE bool SegmentTriangle(glm::vec3 origin, glm::vec3 direction, float tMax,
+                                           glm::vec3 a, glm::vec3 b, glm::vec3 c, float &t)
+{
+    glm::vec3 ab = b - a;
+    glm::vec3 ac = c - a;
+    glm::vec3 pvec = glm::cross(direction, ac);
+    float det = glm::dot(ab, pvec);
+    if (fabsf(det) < 1.0e-12f)
+        return false;
+    float invDet = 1.0f / det;
+    glm::vec3 tvec = origin - a;
+    float u = glm::dot(tvec, pvec) * invDet;
+    if ((u < 0.0f) || (u > 1.0f))
+        return false;
+    glm::vec3 qvec = glm::cross(tvec, ab);
+    float v = glm::dot(direction, qvec) * invDet;
+    if ((v < 0.0f) || (u + v > 1.0f))
+        return false;
+    t = glm::dot(ac, qvec) * invDet;
+    return (t >= 0.0f) && (t < tMax);
+}
+
+// Parameter where the segment origin + t * direction enters the box, larger than tMax if it misses it
+// within [0, tMax). invDirection is 1 / direction per axis.
+inline HI_HOST_DEVICE float SegmentBoxEntry(glm::vec3 origin, glm::vec3 invDirection, float tMax,
+                                            glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+    glm::vec3 t0 = (boundsMin - origin) * invDirection;
+    glm::vec3 t1 = (boundsMax - origin) * invDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar  = glm::max(t0, t1);
+    float entry = fmaxf(fmaxf(tNear.x, tNear.y), fmaxf(tNear.z, 0.0f));
+    float exit  = fminf(fminf(tFar.x, tFar.y), fminf(tFar.z, tMax));
+    return (entry <= exit) ? entry : tMax + 1.0f;
+}
+
+inline HI_HOST_DEVICE float DistanceSquaredToBox(glm::vec3 p, glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+    glm::vec3 outside = glm::max(glm::max(boundsMin - p, p - boundsMax), glm::vec3(0.0f));
+    return glm::dot(outside, outside);
+}
+
+#endif // __HIPHYSICSGEOMETRY_H__
@@ -0,0 +1,108 @@
+#ifndef __HIPHYSICSNEIGHBOR_H__
+#define __HIPHYSICSNEIGHBOR_H__
+
+#include "hiphysics.h"
+
+#ifdef __CUDACC__
+#define HI_HOST_DEVICE __host__ __device__
+#else
+#define HI_HOST_DEVICE
+#endif
+
+// One neighbor of the particle in slot IID.
+// The geometry is computed once per pair and shared by every term of the traversal.
+struct NeighborPair {
+    int32_t JID;
+    glm::vec3 displacement;    // position[IID] - position[JID]
+    float distanceSquared;
+};
+
+// Uniform grid built by ComputeGridIndices and SortVariablesByIndices :
+// particles are sorted by cell and numPartInGrids is the inclusive scan of the cell counts.
+// With quantizedPos set, neighbor positions are decoded from 16 bit offsets to the cell origin
+// (error below cellSize/131070 per axis) instead of being read from the full precision array.
+struct NeighborGrid {
+    const int32_t* gridIndices;
+    const int32_t* numPartInGrids;
+    const glm::vec3* positions;
+    const QuantizedPosition* quantizedPos;
+    glm::vec3 gridOrigin;
+    float cellSize;
+    int32_t ix;
+    int32_t iy;
+    int32_t iz;
+
+    HI_HOST_DEVICE NeighborGrid(const DeviceParticleData& data,
+                                const CommonParameters* commonParam,
+                                glm::vec3 v3MinPosition,
+                                glm::vec3 v3MaxPosition) :
+        gridIndices(data.gridIndices),
+        numPartInGrids(data.numPartInGrids),
+        positions(data.correctedPos),
+        quantizedPos(nullptr)
+    {
+        cellSize = commonParam->radius * 1.2f * 2.0f * 2.0f;
+        gridOrigin = v3MinPosition + glm::vec3(commonParam->radius);
+        ix = static_cast<int32_t>((v3MaxPosition.x - (commonParam->radius) - v3MinPosition.x)/cellSize)+1;
+        iy = static_cast<int32_t>((v3MaxPosition.y - (commonParam->radius) - v3MinPosition.y)/cellSize)+1;
+        iz = static_cast<int32_t>((v3MaxPosition.z - (commonParam->radius) - v3MinPosition.z)/cellSize)+1;
+    }
+
+    // grid IDs are x + ix*z + ix*iz*y
+    HI_HOST_DEVICE glm::vec3 CellOrigin(int32_t gridID) const
+    {
+        int32_t cx = gridID % ix;
+        int32_t cz = (gridID / ix) % iz;
+        int32_t cy = gridID / (ix * iz);
+        return gridOrigin + cellSize * glm::vec3(static_cast<float>(cx), static_cast<float>(cy), static_cast<float>(cz));
+    }
+
+    HI_HOST_DEVICE QuantizedPosition Quantize(glm::vec3 position, glm::vec3 cellOrigin) const
+    {
+        glm::vec3 q = (position - cellOrigin) * (65535.0f / cellSize) + glm::vec3(0.5f);
+        QuantizedPosition res;
+        res.x = static_cast<uint16_t>(fminf(fmaxf(q.x, 0.0f), 65535.0f));
+        res.y = static_cast<uint16_t>(fminf(fmaxf(q.y, 0.0f), 65535.0f));
+        res.z = static_cast<uint16_t>(fminf(fmaxf(q.z, 0.0f), 65535.0f));
+        return res;
+    }
+
+    HI_HOST_DEVICE glm::vec3 Position(int32_t ID, glm::vec3 cellOrigin) const
+    {
+        if (quantizedPos == nullptr) return positions[ID];
+        QuantizedPosition q = quantizedPos[ID];
+        return cellOrigin + (cellSize / 65535.0f) * glm::vec3(static_cast<float>(q.x), static_cast<float>(q.y), static_cast<float>(q.z));
+    }
+};
+
+// Visit every particle of the 27 cells around IID that is closer than cutoff, IID included,
+// and hand the same pair to each term. Terms are functors with operator()(const NeighborPair&),
+// resolved at compile time and inlined, so several physics terms share one traversal.
+template <typename... Terms>
+HI_HOST_DEVICE inline void ForEachNeighbor(const NeighborGrid& grid, int32_t IID, float cutoff, Terms&... terms)
+{
+    float cutoffSquared = cutoff * cutoff;
+    int32_t gridID = grid.gridIndices[IID];
+    glm::vec3 positionI = grid.Position(IID, grid.CellOrigin(gridID));
+    for (int32_t yyy = -1 ; yyy < 2  ; ++yyy)
+        for (int32_t zzz = -1 ; zzz < 2  ; ++zzz)
+            for (int32_t xxx = -1 ; xxx < 2  ; ++xxx)
+            {
+                int32_t nearGridID = gridID + xxx + grid.ix*zzz + grid.ix*grid.iz*yyy;
+                if ( (nearGridID < 0) || (nearGridID > grid.ix*grid.iy*grid.iz-1) ) continue;
+                int32_t staJID = nearGridID == 0 ? 0 : grid.numPartInGrids[nearGridID-1];
+                int32_t endJID = grid.numPartInGrids[nearGridID];
+                glm::vec3 cellOrigin = grid.CellOrigin(nearGridID);
+                for (int32_t JID = staJID; JID < endJID; ++JID)
+                {
+                    NeighborPair pair;
+                    pair.JID = JID;
+                    pair.displacement = positionI - grid.Position(JID, cellOrigin);
+                    pair.distanceSquared = glm::dot(pair.displacement, pair.displacement);
+                    if (pair.distanceSquared >= cutoffSquared) continue;
+                    (terms(pair), ...);
+                }
+            }
+}
+
+#endif // __HIPHYSICSNEIGHBOR_H__
@@ -1,4 +1,5 @@
 #include "hiphysicsPBD.h"
+#include "hiphysicsGeometry.h"
 
 #define PI  3.1415926535897932f
 #define iPI 0.3183098861837906f
@@ -7,39 +8,53 @@
 	
 // }
 
-__device__ float Poly6Kernel(float	H, float	R)
+// time step of one substep of the small steps mode
+inline HI_HOST_DEVICE float SubstepDt(const CommonParameters* commonParam)
 {
-	float iH = 1.0f/H;
+	return commonParam->dt / static_cast<float>(commonParam->substepNumber);
+}
+
+// kernels in the compute type of the caller : float, or double for the double precision policy
+template <typename Real>
+HI_HOST_DEVICE Real Poly6Kernel(Real	H, Real	R)
+{
+	Real iH = Real(1)/H;
+	Real iH3 = iH*iH*iH;
+	Real d = H*H - R*R;
 	//    res = 315    /(    64    *  PI *    H^9  ) * pow((H*H - R*R),3);
-	float res = 315.0f * 0.015625f * iPI * pow(iH,9) * pow((H*H - R*R),3);
-	if (R >= H) res = 0.0f;
+	Real res = Real(315) * Real(0.015625) * Real(0.31830988618379067) * iH3*iH3*iH3 * d*d*d;
+	if (R >= H) res = Real(0);
 	return res;
 }
 
-__device__ glm::vec3 SpikyGradKernel(float H, glm::vec3 dR)
+template <typename Real>
+HI_HOST_DEVICE glm::vec<3, Real> SpikyGradKernel(Real H, glm::vec<3, Real> dR)
 {
-	float iH = 1.0f/H;
-	float R = length(dR);
-	float iR = 1.0f/R;
+	Real iH = Real(1)/H;
+	Real iH3 = iH*iH*iH;
+	Real R = glm::length(dR);
+	Real iR = Real(1)/R;
 	
 	//    res = 45    /(   PI *    H^6  ) * pow((H - |dR|),2) dR / |dR|;
-	glm::vec3 res = - 45.0f * iPI * powf(iH, 6) * powf((H - R), 2) * iR * dR;
-	if (R >= H) res = glm::vec3(0.0f);
-	if (R < 0.0001f) res = glm::vec3(0.0f);
+	glm::vec<3, Real> res = - Real(45) * Real(0.31830988618379067) * iH3*iH3 * (H - R)*(H - R) * iR * dR;
+	if (R >= H) res = glm::vec<3, Real>(0);
+	if (R < Real(0.0001)) res = glm::vec<3, Real>(0);
 
 	return res;
 }
 
+template <typename Policy>
 __global__ void keGetRenderValues(DeviceDataFluid dDataFluid,
 								int64_t 	nParticles)
 {
 	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
 	if(idx < nParticles)
 	{
-		// dDataFluid.colorValues[idx] = length(dDataFluid.velocities[idx]);
-		// dDataFluid.colorValues[idx] = static_cast<float>(dDataFluid.gridIndices[idx]);
-		// dDataFluid.colorValues[idx] = dDataFluid.constraints[idx];
-		dDataFluid.colorValues[idx] = dDataFluid.lambdas[idx];
+		int32_t IID = dDataFluid.fluidIDs[idx];
+		// dDataFluid.colorValues[IID] = length(dDataFluid.velocities[IID]);
+		// dDataFluid.colorValues[IID] = static_cast<float>(dDataFluid.gridIndices[IID]);
+		// dDataFluid.colorValues[IID] = dDataFluid.constraints[IID];
+		dDataFluid.colorValues[IID] = static_cast<float>(MultiplierBuffer<Policy>(dDataFluid.lambdas, dDataFluid.commonParam).Load(IID));
 		// dDataFluid.colorValues[idx] = length(dDataFluid.DeviceDataFluid[idx]);
 	}
 }
@@ -90,433 +105,813 @@ __global__ void keCountParticlesInGrids(DeviceDataFluid dDataFluid,
 	}
 }
 
-/*
-keComputeConstraint
-1. 로컬 변수 정의
-2. 그리드 순회
-	3. 그리드 내 입자 순회
-		4. 예외처리
-		5. 실제물리식 (1에서 정의된 변수도 사용함)
-6. 글로벌 변수 업데이트
- 
- // Lambda 함수 시급
-kernelVariable kv;
-for_NearParticles(DeviceDataFluid dDataFluid, FunctionPointer PhysicsComputation(KV));
-
-*/
-// struct kernelVariables;
-// __device__ void for_NearParticles(DeviceDataFluid dDataFluid, FunctionPointer Computeconstraint(kernelVariables KV))
-// {
-// 	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
-// 	int32_t IID = idx;
-// 	int32_t ix = static_cast<int32_t>((v3MaxPosition.x - (dDataFluid.commonParam->radius) - v3MinPosition.x)/KV.H)+1;
-// 	int32_t iy = static_cast<int32_t>((v3MaxPosition.y - (dDataFluid.commonParam->radius) - v3MinPosition.y)/KV.H)+1;
-// 	int32_t iz = static_cast<int32_t>((v3MaxPosition.z - (dDataFluid.commonParam->radius) - v3MinPosition.z)/KV.H)+1;
-// 	for (int32_t yyy = -1 ; yyy < 2  ; ++yyy)
-// 		for (int32_t zzz = -1 ; zzz < 2  ; ++zzz)
-// 			for (int32_t xxx = -1 ; xxx < 2  ; ++xxx)
-// 			{
-// 				int32_t nearGridID = dDataFluid.gridIndices[idx] + xxx + ix*zzz + ix*iz*yyy;
-// 				if ( (nearGridID < 0) || (nearGridID > ix*iy*iz-1) ) continue;
-// 				int32_t staJID = nearGridID == 0 ? 0 : dDataFluid.numPartInGrids[nearGridID-1];
-// 				int32_t endJID = dDataFluid.numPartInGrids[nearGridID];
-// 				for (int32_t JID = staJID; JID < endJID; ++JID)
-// 				{
-					
-// 				}
-// 			}
-
-// 	KV.gradConstraintSqrSum += dot(KV.gradConstraintI,KV.gradConstraintI);
-// 	KV.constraintI = KV.densityI*KV.iDensityI0 - 1.0f;
-// }
-struct kernelVariables {
+__global__ void keQuantizePositions(DeviceDataFluid dDataFluid,
+									glm::vec3 	v3MinPosition, 
+									glm::vec3 	v3MaxPosition,
+									int64_t 	nParticles)
+{
+	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
+	if(idx < nParticles)
+	{
+		NeighborGrid grid(dDataFluid, dDataFluid.commonParam, v3MinPosition, v3MaxPosition);
+		dDataFluid.quantizedPos[idx] = grid.Quantize(dDataFluid.correctedPos[idx], grid.CellOrigin(dDataFluid.gridIndices[idx]));
+	}
+}
+
+// Density constraint of particle IID, accumulated over its neighbors (IID included).
+template <typename Policy>
+struct DensityConstraintTerm {
+	typedef typename Policy::Real Real;
+	typedef glm::vec<3, Real> RealVec3;
+
+	DeviceDataFluid &dDataFluid;
 	int32_t IID;
-	float densityI0;
-	float iDensityI0;
 	float H;
-};
+	Real particleVolume;
+	Real iDensityI0;
+	Real densityI = Real(0);
+	RealVec3 gradConstraintI = RealVec3(0);
+	Real gradConstraintSqrSum = Real(0);
 
-struct computeConstraintKernelVariables : kernelVariables {
-	float densityI = 0.0f;
-	float constraintI = 0.0f;
-	glm::vec3 gradConstraintI = glm::vec3(0.0f);
-	float gradConstraintSqrSum = 0.0f;
+	HI_HOST_DEVICE void operator()(const NeighborPair &pair)
+	{
+		RealVec3 displacement = RealVec3(pair.displacement);
+		Real distanceIJ = glm::length(displacement);
+		Real kernelH = static_cast<Real>(0.5f * H);
+		Real densityJ0 = static_cast<Real>(dDataFluid.phaseParam[dDataFluid.phases[pair.JID]].density);
+
+		densityI += densityJ0 * particleVolume * Poly6Kernel(kernelH, distanceIJ);
+
+		if (IID == pair.JID) return;
+		if (distanceIJ < static_cast<Real>(H * 0.00001f)) return;
+
+		RealVec3 gradConstraintIJ = iDensityI0 * densityJ0 * particleVolume * SpikyGradKernel(kernelH, displacement);
+		gradConstraintI += gradConstraintIJ;
+		gradConstraintSqrSum += dot(gradConstraintIJ, gradConstraintIJ);
+	}
+
+	HI_HOST_DEVICE void ToGlobal()
+	{
+		gradConstraintSqrSum += dot(gradConstraintI, gradConstraintI);
+		Real constraintI = densityI*iDensityI0 - Real(1);
+
+		// XPBD : the compliance term makes the stiffness independent of the iteration count
+		Real dt = static_cast<Real>(SubstepDt(dDataFluid.commonParam));
+		Real alphaTilde = static_cast<Real>(dDataFluid.commonParam->densityCompliance) / (dt * dt);
+		MultiplierBuffer<Policy> lambdas(dDataFluid.lambdas, dDataFluid.commonParam);
+		MultiplierBuffer<Policy> deltaLambdas(dDataFluid.deltaLambdas, dDataFluid.commonParam);
+		Real lambdaI = lambdas.Load(IID);
+		Real denominator = gradConstraintSqrSum + alphaTilde;
+		Real deltaLambdaI = denominator > Real(0) ? (- constraintI - alphaTilde * lambdaI) / denominator : Real(0);
+		deltaLambdas.Store(IID, deltaLambdaI);
+		lambdas.Store(IID, lambdaI + deltaLambdaI);
+	}
 };
 
-inline __device__ void ComputeConstraint(int32_t &JID, 
-									DeviceDataFluid &dDataFluid,
-									computeConstraintKernelVariables &KV)
-{
-	int32_t IID = KV.IID;
-	glm::vec3 displaceVectorIJ = dDataFluid.correctedPos[IID] - dDataFluid.correctedPos[JID];
-	float distanceIJ = sqrt(glm::dot(displaceVectorIJ, displaceVectorIJ));
+// Free surface classification for the renderer, from the color field c = sum_j V_j W_ij over the whole cell :
+// |grad c| H / c is near 0 inside the fluid and above 1 on a flat surface whatever the packing,
+// and a sparse neighborhood (c < 0.5 : spray, thin sheets) is surface as well.
+struct SurfaceTerm {
+	float H;
+	float particleVolume;
+	float colorField = 0.0f;
+	glm::vec3 colorGradient = glm::vec3(0.0f);
 
-	if (distanceIJ < (KV.H * 0.5f))
+	HI_HOST_DEVICE void operator()(const NeighborPair &pair)
 	{
-		float particleVolume = pow(2.0f * dDataFluid.commonParam->radius, 3);
-		float kernelWeight = Poly6Kernel(0.5f * KV.H, distanceIJ);
-		float densityJ0 = dDataFluid.phaseParam[dDataFluid.phases[JID]].density;
+		colorField += particleVolume * Poly6Kernel(H, sqrtf(pair.distanceSquared));
+		if (pair.distanceSquared < (H*H*0.0000001f)) return;
+		colorGradient += particleVolume * SpikyGradKernel(H, pair.displacement);
+	}
 
-		KV.densityI += densityJ0 * particleVolume * kernelWeight;
+	HI_HOST_DEVICE bool IsSurface(float threshold) const
+	{
+		return (colorField < 0.5f) || (length(colorGradient) * H > threshold * colorField);
+	}
+};
 
-		if (IID == JID) return;
-		if (distanceIJ < KV.H * 0.00001f) return;
+// Position correction from the multiplier increments, with the artificial pressure (scorr).
+template <typename Policy>
+struct PositionCorrectionTerm {
+	typedef typename Policy::Real Real;
+	typedef glm::vec<3, Real> RealVec3;
 
-		glm::vec3 gradKernelWeight = SpikyGradKernel(0.5f * KV.H, displaceVectorIJ);
-		glm::vec3 gradConstraintIJ = KV.iDensityI0 * densityJ0 * particleVolume * gradKernelWeight;
-		KV.gradConstraintI += gradConstraintIJ;
-		KV.gradConstraintSqrSum += dot(-gradConstraintIJ, -gradConstraintIJ);
+	DeviceDataFluid &dDataFluid;
+	int32_t IID;
+	float H;
+	Real particleVolume;
+	Real iDensityI0;
+	MultiplierBuffer<Policy> deltaLambdas;
+	Real deltaLambdaI;
+	RealVec3 deltaPos = RealVec3(0);
+
+	HI_HOST_DEVICE void operator()(const NeighborPair &pair)
+	{
+		if (IID == pair.JID) return;
+		if (pair.distanceSquared < (H*H*0.0000001f)) return;
+
+		const CommonParameters *commonParam = dDataFluid.commonParam;
+		RealVec3 displacement = RealVec3(pair.displacement);
+		Real kernelH = static_cast<Real>(0.5f * H);
+		Real kernelRatio = Poly6Kernel(kernelH, glm::length(displacement)) / Poly6Kernel(kernelH, kernelH * static_cast<Real>(commonParam->scorrDq));
+		Real scorr = - static_cast<Real>(commonParam->scorrK) * kernelRatio*kernelRatio*kernelRatio*kernelRatio;
+		Real lambdaIJ = (deltaLambdaI + deltaLambdas.Load(pair.JID))*Real(0.5);
+		Real densityJ0 = static_cast<Real>(dDataFluid.phaseParam[dDataFluid.phases[pair.JID]].density);
+		deltaPos += iDensityI0 * (lambdaIJ + scorr) * densityJ0 * particleVolume * SpikyGradKernel(kernelH, displacement);
 	}
-}
+};
 
-inline __device__ void ComputeConstraintToGlobal(DeviceDataFluid &dDataFluid,
-										computeConstraintKernelVariables &KV)
-{
-	KV.gradConstraintSqrSum += dot(KV.gradConstraintI,KV.gradConstraintI);
-	KV.constraintI = KV.densityI*KV.iDensityI0 - 1.0f;
-	dDataFluid.lambdas[KV.IID] = - KV.constraintI / (KV.gradConstraintSqrSum + dDataFluid.commonParam->relaxationParameter);
-}
+// XSPH viscosity, the curl and the gradient of |curl| (from the lagged curl of the neighbors),
+// using the velocity implied by the corrected positions. Only fluid neighbors contribute.
+struct ViscosityVorticityTerm {
+	DeviceDataFluid &dDataFluid;
+	int32_t IID;
+	float H;
+	float particleVolume;
+	float iDt;
+	glm::vec3 velocityI;
+	glm::vec3 xsphVelocity = glm::vec3(0.0f);
+	glm::vec3 vorticity = glm::vec3(0.0f);
+	glm::vec3 vorticityGradient = glm::vec3(0.0f);
+
+	HI_HOST_DEVICE void operator()(const NeighborPair &pair)
+	{
+		if (IID == pair.JID) return;
+		if (pair.distanceSquared < (H*H*0.0000001f)) return;
+		if (dDataFluid.phaseParam[dDataFluid.phases[pair.JID]].phaseType != StateOfMatter::FLUID) return;
+
+		glm::vec3 gradKernel = SpikyGradKernel(0.5f*H, pair.displacement);
+		glm::vec3 velocityJI = (dDataFluid.correctedPos[pair.JID] - dDataFluid.positions[pair.JID]) * iDt - velocityI;
+		xsphVelocity      += particleVolume * Poly6Kernel(0.5f*H, sqrtf(pair.distanceSquared)) * velocityJI;
+		vorticity         += particleVolume * glm::cross(gradKernel, velocityJI);
+		vorticityGradient += particleVolume * glm::length(dDataFluid.vorticity[pair.JID]) * gradKernel;
+	}
+};
 
+template <typename Policy>
 __global__ void keComputeConstraint(DeviceDataFluid dDataFluid,
 									glm::vec3 	v3MinPosition, 
 									glm::vec3 	v3MaxPosition,
 									int64_t 	nParticles)
 {
-	__shared__ int gridIndices[32];
-	__shared__ float correctedPos[32 * 64 * 27];
-	__shared__ int phases[32 * 64 * 27];
+	typedef typename Policy::Real Real;
 	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
 
 	if(idx < nParticles)
 	{
-		gridIndices[threadIdx.x] = dDataFluid.gridIndices[idx];
-		__syncthreads();
-		// KernelVariables KV; 
-		// for_NearParticles(ComputeConstraint, dDataFluid, KV); ==> 안에서 IID는 고정, JID는 내부에서 계산
-		// dDataFluid.update;
-		                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                       
-		computeConstraintKernelVariables KV; 
-		KV.IID					= idx;
-		KV.densityI0			= dDataFluid.phaseParam[dDataFluid.phases[KV.IID]].density;
-		KV.iDensityI0			= 1.0f/dDataFluid.phaseParam[dDataFluid.phases[KV.IID]].density;
-		KV.H					= dDataFluid.commonParam->radius * 1.2f * 2.0f * 2.0f;
-
-		int32_t ix = static_cast<int32_t>((v3MaxPosition.x - (dDataFluid.commonParam->radius) - v3MinPosition.x)/KV.H)+1;
-		int32_t iy = static_cast<int32_t>((v3MaxPosition.y - (dDataFluid.commonParam->radius) - v3MinPosition.y)/KV.H)+1;
-		int32_t iz = static_cast<int32_t>((v3MaxPosition.z - (dDataFluid.commonParam->radius) - v3MinPosition.z)/KV.H)+1;
-		for (int32_t yyy = -1 ; yyy < 2  ; ++yyy)
-			for (int32_t zzz = -1 ; zzz < 2  ; ++zzz)
-				for (int32_t xxx = -1 ; xxx < 2  ; ++xxx)
-				{
-					int32_t nearGridID = gridIndices[threadIdx.x] + xxx + ix*zzz + ix*iz*yyy;
-					if ( (nearGridID < 0) || (nearGridID > ix*iy*iz-1) ) continue;
-					int32_t staJID = nearGridID == 0 ? 0 : dDataFluid.numPartInGrids[nearGridID-1];
-					int32_t endJID = dDataFluid.numPartInGrids[nearGridID];
-					for (int32_t JID = staJID; JID < endJID; ++JID)
-					{
-						// 모두 이런 형식일 것이므로!
-						ComputeConstraint(JID, dDataFluid, KV);
-					}
-				}
-		ComputeConstraintToGlobal(dDataFluid, KV);
+		int32_t IID = dDataFluid.fluidIDs[idx];
+		float H = dDataFluid.commonParam->radius * 1.2f * 2.0f * 2.0f;
+		float particleVolume = pow(2.0f * dDataFluid.commonParam->radius, 3);
+		NeighborGrid grid(dDataFluid, dDataFluid.commonParam, v3MinPosition, v3MaxPosition);
+		grid.quantizedPos = dDataFluid.quantizedPos;
+
+		DensityConstraintTerm<Policy> density{dDataFluid, IID, H};
+		density.particleVolume	= static_cast<Real>(particleVolume);
+		density.iDensityI0		= Real(1)/static_cast<Real>(dDataFluid.phaseParam[dDataFluid.phases[IID]].density);
+
+		ForEachNeighbor(grid, IID, 0.5f * H, density);
+		density.ToGlobal();
 	}
 }
 
+// Only when the renderer draws the surface particles, once per step : the color field alone over the whole cell
+__global__ void keClassifySurface(DeviceDataFluid dDataFluid,
+								  glm::vec3 	v3MinPosition, 
+								  glm::vec3 	v3MaxPosition,
+								  int64_t 		nParticles)
+{
+	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
+
+	if(idx < nParticles)
+	{
+		int32_t IID = dDataFluid.fluidIDs[idx];
+		float H = dDataFluid.commonParam->radius * 1.2f * 2.0f * 2.0f;
+		float particleVolume = pow(2.0f * dDataFluid.commonParam->radius, 3);
+		NeighborGrid grid(dDataFluid, dDataFluid.commonParam, v3MinPosition, v3MaxPosition);
+		grid.quantizedPos = dDataFluid.quantizedPos;
+
+		SurfaceTerm surface{H, particleVolume};
+		ForEachNeighbor(grid, IID, H, surface);
+		dDataFluid.surfaceFlags[IID] = surface.IsSurface(dDataFluid.commonParam->surfaceThreshold) ? 1 : 0;
+	}
+}
+
+// On the last iteration of a substep the XSPH / vorticity term rides along
+// the position correction in the same neighbor traversal.
+template <typename Policy>
 __global__ void keComputePositionCorrection(DeviceDataFluid dDataFluid,
 											glm::vec3 	v3MinPosition, 
 											glm::vec3 	v3MaxPosition,
+											bool 		accumulateVelocityTerms,
 											int64_t 	nParticles)
 {
+	typedef typename Policy::Real Real;
 	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
-	int32_t IID = idx;
 
 	if(idx < nParticles)
 	{
-		float density0 = dDataFluid.phaseParam[dDataFluid.phases[IID]].density;
-		float iDensity0 = 1.0f/density0;
-		dDataFluid.deltaPos[IID] = glm::vec3(0.0f);
+		int32_t IID = dDataFluid.fluidIDs[idx];
 		float H = dDataFluid.commonParam->radius * 1.2f * 2.0f * 2.0f;
-		int32_t ix = static_cast<int32_t>((v3MaxPosition.x - (dDataFluid.commonParam->radius) - v3MinPosition.x)/H)+1;
-		int32_t iy = static_cast<int32_t>((v3MaxPosition.y - (dDataFluid.commonParam->radius) - v3MinPosition.y)/H)+1;
-		int32_t iz = static_cast<int32_t>((v3MaxPosition.z - (dDataFluid.commonParam->radius) - v3MinPosition.z)/H)+1;
-		
-		for (int32_t yyy = -1 ; yyy < 2  ; ++yyy)
-			for (int32_t zzz = -1 ; zzz < 2  ; ++zzz)
-				for (int32_t xxx = -1 ; xxx < 2  ; ++xxx)
-				{
-					int32_t nearGridID = dDataFluid.gridIndices[idx] + xxx + ix*zzz + ix*iz*yyy;
-					if ( (nearGridID < 0) || (nearGridID > ix*iy*iz-1) ) continue;
-					int32_t staJID = nearGridID == 0 ? 0 : dDataFluid.numPartInGrids[nearGridID-1];
-					int32_t endJID = dDataFluid.numPartInGrids[nearGridID];
-					for (int32_t JID = staJID; JID < endJID; ++JID)
-					{
-						glm::vec3 dr = dDataFluid.correctedPos[IID] - dDataFluid.correctedPos[JID];
-						float dr2  = glm::dot(dr,dr);
-						if ( dr2 < (H*H*0.25f) )
-						{
-							if (IID == JID) continue;
-							if ( dr2 < (H*H*0.0000001f) ) continue;
-
-							float volume = pow(2.0f*dDataFluid.commonParam->radius,3);
-							float dlen   = sqrt(dr2);
-							glm::vec3 gradKernel = SpikyGradKernel(0.5f*H, dr);
-							
-							float scorr = - dDataFluid.commonParam->scorrK * powf(Poly6Kernel(0.5f*H, dlen) / Poly6Kernel(0.5f*H, 0.5f*H*dDataFluid.commonParam->scorrDq),4.0f);
-
-							dDataFluid.deltaPos[IID] += iDensity0 * ((dDataFluid.lambdas[IID] + dDataFluid.lambdas[JID])*0.5f + scorr) * dDataFluid.phaseParam[dDataFluid.phases[JID]].density * volume * gradKernel;							
-						}
-					}
-				}
-		// bool check = false;
-		// if (dDataFluid.correctedPos[IID].x < dDataFluid.commonParam->AnalysisBox.minPoint.x)  check = true;
-		// if (dDataFluid.correctedPos[IID].x > dDataFluid.commonParam->AnalysisBox.maxPoint.x)  check = true;
-		// if (dDataFluid.correctedPos[IID].y < dDataFluid.commonParam->AnalysisBox.minPoint.y)  check = true;
-		// if (dDataFluid.correctedPos[IID].y > dDataFluid.commonParam->AnalysisBox.maxPoint.y)  check = true;
-		// if (dDataFluid.correctedPos[IID].z < dDataFluid.commonParam->AnalysisBox.minPoint.z)  check = true;
-		// if (dDataFluid.correctedPos[IID].z > dDataFluid.commonParam->AnalysisBox.maxPoint.z)  check = true;
-		// dDataFluid.deltaPos[IID] = -0.01f*dDataFluid.deltaPos[IID];
+		float particleVolume = pow(2.0f*dDataFluid.commonParam->radius,3);
+		NeighborGrid grid(dDataFluid, dDataFluid.commonParam, v3MinPosition, v3MaxPosition);
+		grid.quantizedPos = dDataFluid.quantizedPos;
+
+		MultiplierBuffer<Policy> deltaLambdas(dDataFluid.deltaLambdas, dDataFluid.commonParam);
+		PositionCorrectionTerm<Policy> correction{dDataFluid, IID, H, static_cast<Real>(particleVolume),
+			Real(1)/static_cast<Real>(dDataFluid.phaseParam[dDataFluid.phases[IID]].density),
+			deltaLambdas, deltaLambdas.Load(IID)};
+
+		bool velocityTerms = accumulateVelocityTerms && 
+			((dDataFluid.commonParam->xsphViscosity > 0.0f) || (dDataFluid.commonParam->vorticityEpsilon > 0.0f));
+		ViscosityVorticityTerm velocity{dDataFluid, IID, H, particleVolume};
+		velocity.iDt       = 1.0f/SubstepDt(dDataFluid.commonParam);
+		velocity.velocityI = (dDataFluid.correctedPos[IID] - dDataFluid.positions[IID]) * velocity.iDt;
+
+		if (velocityTerms)	ForEachNeighbor(grid, IID, 0.5f * H, correction, velocity);
+		else				ForEachNeighbor(grid, IID, 0.5f * H, correction);
+
+		// pinned particles (fixed boxes, ghosts of a neighbor rank) only act as neighbors
+		dDataFluid.deltaPos[IID] = dDataFluid.invMasses[IID] > 0.0f ? glm::vec3(correction.deltaPos) : glm::vec3(0.0f);
+		if (accumulateVelocityTerms)
+		{
+			dDataFluid.xsphVelocity[IID]      = dDataFluid.commonParam->xsphViscosity * velocity.xsphVelocity;
+			dDataFluid.vorticityNext[IID]     = velocity.vorticity;
+			dDataFluid.vorticityGradient[IID] = velocity.vorticityGradient;
+		}
 	}
 }
 
+#define INSTANTIATE_FLUID_KERNELS(Policy) \
+	template __global__ void keGetRenderValues<Policy>(DeviceDataFluid, int64_t); \
+	template __global__ void keComputeConstraint<Policy>(DeviceDataFluid, glm::vec3, glm::vec3, int64_t); \
+	template __global__ void keComputePositionCorrection<Policy>(DeviceDataFluid, glm::vec3, glm::vec3, bool, int64_t);
+
+INSTANTIATE_FLUID_KERNELS(PrecisionSingle)
+INSTANTIATE_FLUID_KERNELS(PrecisionHalfStorage)
+INSTANTIATE_FLUID_KERNELS(PrecisionDouble)
+
+#undef INSTANTIATE_FLUID_KERNELS
+
 __global__ void kePredictPosition(DeviceDataFluid dDataFluid, 
 						 		int64_t 	nParticles)
 {
 	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
 	if(idx < nParticles)
 	{
-		dDataFluid.velocities[idx] += dDataFluid.commonParam->dt * dDataFluid.commonParam->gravity;
-		dDataFluid.correctedPos[idx] = dDataFluid.positions[idx] + dDataFluid.commonParam->dt*dDataFluid.velocities[idx];
+		float dt = SubstepDt(dDataFluid.commonParam);
+		if (dDataFluid.invMasses[idx] > 0.0f)
+			dDataFluid.velocities[idx] += dt * dDataFluid.commonParam->gravity;
+		dDataFluid.correctedPos[idx] = dDataFluid.positions[idx] + dt*dDataFluid.velocities[idx];
 	}
 }
 
-__global__ void keUpdateCorretedPosition(DeviceDataFluid dDataFluid, 
-						 				int64_t 	nParticles)
+inline __device__ glm::vec3 ToColliderSpace(const ColliderPose& pose, glm::vec3 position)
 {
-	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
-	if(idx < nParticles)
-	{
-		dDataFluid.correctedPos[idx] = dDataFluid.correctedPos[idx] + dDataFluid.deltaPos[idx];
-		
-		if (dDataFluid.correctedPos[idx].x < dDataFluid.commonParam->AnalysisBox.minPoint.x + dDataFluid.commonParam->radius) dDataFluid.correctedPos[idx].x = dDataFluid.commonParam->AnalysisBox.minPoint.x + dDataFluid.commonParam->radius;
-		if (dDataFluid.correctedPos[idx].x > dDataFluid.commonParam->AnalysisBox.maxPoint.x - dDataFluid.commonParam->radius) dDataFluid.correctedPos[idx].x = dDataFluid.commonParam->AnalysisBox.maxPoint.x - dDataFluid.commonParam->radius;
-		if (dDataFluid.correctedPos[idx].y < dDataFluid.commonParam->AnalysisBox.minPoint.y + dDataFluid.commonParam->radius) dDataFluid.correctedPos[idx].y = dDataFluid.commonParam->AnalysisBox.minPoint.y + dDataFluid.commonParam->radius;
-		if (dDataFluid.correctedPos[idx].y > dDataFluid.commonParam->AnalysisBox.maxPoint.y - dDataFluid.commonParam->radius) dDataFluid.correctedPos[idx].y = dDataFluid.commonParam->AnalysisBox.maxPoint.y - dDataFluid.commonParam->radius;
-		if (dDataFluid.correctedPos[idx].z < dDataFluid.commonParam->AnalysisBox.minPoint.z + dDataFluid.commonParam->radius) dDataFluid.correctedPos[idx].z = dDataFluid.commonParam->AnalysisBox.minPoint.z + dDataFluid.commonParam->radius;
-		if (dDataFluid.correctedPos[idx].z > dDataFluid.commonParam->AnalysisBox.maxPoint.z - dDataFluid.commonParam->radius) dDataFluid.correctedPos[idx].z = dDataFluid.commonParam->AnalysisBox.maxPoint.z - dDataFluid.commonParam->radius;
-	}
+	return glm::transpose(pose.rotation) * (position - pose.translation);
 }
 
-__global__ void keUpdateVelPos(DeviceDataFluid dDataFluid, 
-						 		int64_t 	nParticles)
+inline __device__ glm::vec3 ToWorldSpace(const ColliderPose& pose, glm::vec3 position)
 {
-	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
-	if(idx < nParticles)
-	{
-		dDataFluid.velocities[idx] = (dDataFluid.correctedPos[idx] - dDataFluid.positions[idx])/dDataFluid.commonParam->dt;
-		dDataFluid.positions[idx]  =  dDataFluid.correctedPos[idx];
-		
-		if (dDataFluid.positions[idx].x < dDataFluid.commonParam->AnalysisBox.minPoint.x + dDataFluid.commonParam->radius) dDataFluid.positions[idx].x = dDataFluid.commonParam->AnalysisBox.minPoint.x + dDataFluid.commonParam->radius;
-		if (dDataFluid.positions[idx].x > dDataFluid.commonParam->AnalysisBox.maxPoint.x - dDataFluid.commonParam->radius) dDataFluid.positions[idx].x = dDataFluid.commonParam->AnalysisBox.maxPoint.x - dDataFluid.commonParam->radius;
-		if (dDataFluid.positions[idx].y < dDataFluid.commonParam->AnalysisBox.minPoint.y + dDataFluid.commonParam->radius) dDataFluid.positions[idx].y = dDataFluid.commonParam->AnalysisBox.minPoint.y + dDataFluid.commonParam->radius;
-		if (dDataFluid.positions[idx].y > dDataFluid.commonParam->AnalysisBox.maxPoint.y - dDataFluid.commonParam->radius) dDataFluid.positions[idx].y = dDataFluid.commonParam->AnalysisBox.maxPoint.y - dDataFluid.commonParam->radius;
-		if (dDataFluid.positions[idx].z < dDataFluid.commonParam->AnalysisBox.minPoint.z + dDataFluid.commonParam->radius) dDataFluid.positions[idx].z = dDataFluid.commonParam->AnalysisBox.minPoint.z + dDataFluid.commonParam->radius;
-		if (dDataFluid.positions[idx].z > dDataFluid.commonParam->AnalysisBox.maxPoint.z - dDataFluid.commonParam->radius) dDataFluid.positions[idx].z = dDataFluid.commonParam->AnalysisBox.maxPoint.z - dDataFluid.commonParam->radius;
-	}
+	return pose.rotation * position + pose.translation;
 }
 
+// remove friction of the slip from start to position along the surface of normal, all in collider space :
+// the start is where the particle was relative to the collider, so a moving collider drags its contacts along
+inline __device__ glm::vec3 ApplyColliderFriction(glm::vec3 start, glm::vec3 position, glm::vec3 normal, float friction)
+{
+	glm::vec3 slip = position - start;
+	return position - friction * (slip - glm::dot(slip, normal) * normal);
+}
 
+// trilinear distance and gradient of a collider at position, false outside its grid
+inline __device__ bool SampleCollider(const DeviceCollider& collider, const float* distances, glm::vec3 position,
+									  float& distance, glm::vec3& gradient)
+{
+	glm::vec3 g = (position - collider.origin) / collider.cellSize;
+	glm::ivec3 i0 = glm::ivec3(glm::floor(g));
+	if ((i0.x < 0) || (i0.y < 0) || (i0.z < 0) ||
+		(i0.x >= collider.dims.x - 1) || (i0.y >= collider.dims.y - 1) || (i0.z >= collider.dims.z - 1))
+		return false;
+	glm::vec3 f = g - glm::vec3(i0);
+
+	const float* d = distances + collider.offset + i0.x + int64_t(collider.dims.x) * (i0.y + int64_t(collider.dims.y) * i0.z);
+	int64_t sy = collider.dims.x;
+	int64_t sz = int64_t(collider.dims.x) * collider.dims.y;
+	float d000 = d[0],       d100 = d[1];
+	float d010 = d[sy],      d110 = d[sy + 1];
+	float d001 = d[sz],      d101 = d[sz + 1];
+	float d011 = d[sy + sz], d111 = d[sy + sz + 1];
+
+	// along x, then y, then z
+	float d00 = glm::mix(d000, d100, f.x), d10 = glm::mix(d010, d110, f.x);
+	float d01 = glm::mix(d001, d101, f.x), d11 = glm::mix(d011, d111, f.x);
+	float d0 = glm::mix(d00, d10, f.y), d1 = glm::mix(d01, d11, f.y);
+	distance = glm::mix(d0, d1, f.z);
+
+	gradient.x = glm::mix(glm::mix(d100 - d000, d110 - d010, f.y), glm::mix(d101 - d001, d111 - d011, f.y), f.z);
+	gradient.y = glm::mix(d10 - d00, d11 - d01, f.z);
+	gradient.z = d1 - d0;
+	gradient /= collider.cellSize;
+	return true;
+}
 
-inline __device__ bool isInsideBox( glm::vec3 p1, glm::vec3 p2, glm::vec3 point) 
+// keep a particle one radius away from the surface of every collider, queried in collider space
+inline __device__ glm::vec3 ProjectOutOfColliders(const DeviceDataFluid& dDataFluid, glm::vec3 start, glm::vec3 position, float radius)
 {
-    return (point.x >= p1.x && point.x <= p2.x &&\
-			point.y >= p1.y && point.y <= p2.y &&\
-			point.z >= p1.z && point.z <= p2.z); 
+	for (int32_t c = 0; c < dDataFluid.numColliders; ++c)
+	{
+		const DeviceCollider& collider = dDataFluid.colliders[c];
+		glm::vec3 local = ToColliderSpace(collider.pose, position);
+		float distance;
+		glm::vec3 gradient;
+		if (!SampleCollider(collider, dDataFluid.colliderDistances, local, distance, gradient))
+			continue;
+		float gradientLength = length(gradient);
+		if ((distance < radius) && (gradientLength > 1.0e-6f))
+		{
+			glm::vec3 normal = gradient / gradientLength;
+			local += (radius - distance) * normal;
+			if (collider.friction > 0.0f)
+				local = ApplyColliderFriction(ToColliderSpace(collider.previousPose, start), local, normal, collider.friction);
+			position = ToWorldSpace(collider.pose, local);
+		}
+	}
+	return position;
 }
 
+// keep a particle a radius inside the analysis box
+inline __device__ glm::vec3 ClampToAnalysisBox(const CommonParameters* commonParam, glm::vec3 position)
+{
+	glm::vec3 minPoint = commonParam->AnalysisBox.minPoint + commonParam->radius;
+	glm::vec3 maxPoint = commonParam->AnalysisBox.maxPoint - commonParam->radius;
+	return glm::clamp(position, minPoint, maxPoint);
+}
 
-__global__ void kePredictPositionCloth(DeviceDataCloth dDataCloth, 
-								DeviceSimParams dSimParam,
-						 		int64_t 	nParticles)
+__global__ void keUpdateCorretedPosition(DeviceDataFluid dDataFluid, 
+						 				int64_t 	nParticles)
 {
 	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
-	
 	if(idx < nParticles)
 	{
-		if ((idx == 0) || (idx == 148))
-			dDataCloth.velocities[idx] += glm::vec3(0.0f);
-		else
-			dDataCloth.velocities[idx] += dSimParam.commonParam->dt * dSimParam.commonParam->gravity;
-
-		dDataCloth.correctedPos[idx] = dDataCloth.positions[idx] + dSimParam.commonParam->dt*dDataCloth.velocities[idx];
-
-		// if (idx == 0)
-		// {
-		// 	dDataCloth.velocities[idx]  = glm::vec3(0.0);
-		// 	dDataCloth.correctedPos[idx]= dDataCloth.positions[idx];
-		// }
+		dDataFluid.correctedPos[idx] = dDataFluid.correctedPos[idx] + dDataFluid.deltaPos[idx];
+		if ((dDataFluid.numColliders > 0) && (dDataFluid.invMasses[idx] > 0.0f))
+			dDataFluid.correctedPos[idx] = ProjectOutOfColliders(dDataFluid, dDataFluid.positions[idx], dDataFluid.correctedPos[idx], dDataFluid.commonParam->radius);
+		
+		// with mesh colliders, keCollideMeshes clamps after its projection
+		if (dDataFluid.numMeshColliders == 0)
+			dDataFluid.correctedPos[idx] = ClampToAnalysisBox(dDataFluid.commonParam, dDataFluid.correctedPos[idx]);
 	}
 }
 
-__global__ void keComputeStretchCloth(DeviceDataCloth dDataCloth,
-    								  DeviceSimParams dSimParam,
-									  int64_t 	nStretchLines)
+// first crossing of the segment origin + t * direction, t in [0, tMax), with a mesh collider.
+// The nearer child is visited first, so subtrees beyond the closest hit so far are skipped.
+inline __device__ bool NearestSegmentHit(const DeviceDataFluid& dDataFluid, const DeviceMeshCollider& collider,
+										 glm::vec3 origin, glm::vec3 direction, float tMax,
+										 float& tHit, glm::vec3& normal)
 {
-	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
-
-	if(idx < nStretchLines)
+	const BvhNode* nodes = dDataFluid.meshNodes + collider.nodeOffset;
+	const int32_t* triangles = dDataFluid.meshTriangles + collider.triangleOffset;
+	const glm::vec3* vertices = dDataFluid.meshVertices + collider.vertexOffset;
+	glm::vec3 invDirection = 1.0f / direction;
+
+	bool hit = false;
+	tHit = tMax;
+	int32_t stack[bvhMaxDepth];
+	int32_t top = 0;
+	int32_t nodeID = 0;
+	if (SegmentBoxEntry(origin, invDirection, tHit, nodes[0].boundsMin, nodes[0].boundsMax) > tHit)
+		return false;
+	while (true)
 	{
-		int32_t id0 = dDataCloth.stretchID[2*idx];
-		int32_t id1 = dDataCloth.stretchID[2*idx + 1];
-
-        glm::vec3 p0 = dDataCloth.correctedPos[id0];
-        glm::vec3 p1 = dDataCloth.correctedPos[id1];
-        
-        glm::vec3 d = p1 - p0;
-		glm::vec3 norm = glm::normalize(d);
-		float len = glm::length(d);
-		float len0= 2.0f * dSimParam.commonParam->radius;
-
-        glm::vec3 dP = norm * 0.2f * (len - len0);
-
-		if ((id0 == 0) || (id0 == 148))
+		const BvhNode& node = nodes[nodeID];
+		if (node.count > 0)
 		{
-
+			for (int32_t t = node.rightOrFirst; t < node.rightOrFirst + node.count; ++t)
+			{
+				glm::vec3 a = vertices[triangles[3*t]];
+				glm::vec3 b = vertices[triangles[3*t + 1]];
+				glm::vec3 c = vertices[triangles[3*t + 2]];
+				float tTriangle;
+				if (SegmentTriangle(origin, direction, tHit, a, b, c, tTriangle))
+				{
+					hit = true;
+					tHit = tTriangle;
+					normal = glm::cross(b - a, c - a);
+				}
+			}
 		}
 		else
 		{
-			atomicAdd(&dDataCloth.deltaPos[id0].x, dP.x);
-			atomicAdd(&dDataCloth.deltaPos[id0].y, dP.y);
-			atomicAdd(&dDataCloth.deltaPos[id0].z, dP.z);	
+			int32_t nearID = nodeID + 1;
+			int32_t farID = node.rightOrFirst;
+			float tNear = SegmentBoxEntry(origin, invDirection, tHit, nodes[nearID].boundsMin, nodes[nearID].boundsMax);
+			float tFar  = SegmentBoxEntry(origin, invDirection, tHit, nodes[farID].boundsMin, nodes[farID].boundsMax);
+			if (tFar < tNear)
+			{
+				int32_t id = nearID; nearID = farID; farID = id;
+				float t = tNear; tNear = tFar; tFar = t;
+			}
+			if (tNear <= tHit)
+			{
+				// BuildBvh keeps the depth within bvhMaxDepth : one far child per level fits
+				if (tFar <= tHit)
+					stack[top++] = farID;
+				nodeID = nearID;
+				continue;
+			}
 		}
+		// a popped subtree may lie beyond a hit found since it was pushed : its leaves reject it cheaply
+		if (top == 0)
+			break;
+		nodeID = stack[--top];
+	}
+	return hit;
+}
 
-		if ((id1 == 0) || (id1 == 148))
+// closest point of a mesh collider within sqrt(maxDistanceSquared) of p, false if none
+inline __device__ bool ClosestMeshPoint(const DeviceDataFluid& dDataFluid, const DeviceMeshCollider& collider,
+										glm::vec3 p, float maxDistanceSquared, glm::vec3& closest)
+{
+	const BvhNode* nodes = dDataFluid.meshNodes + collider.nodeOffset;
+	const int32_t* triangles = dDataFluid.meshTriangles + collider.triangleOffset;
+	const glm::vec3* vertices = dDataFluid.meshVertices + collider.vertexOffset;
+
+	bool found = false;
+	float bestSquared = maxDistanceSquared;
+	int32_t stack[bvhMaxDepth];
+	int32_t top = 0;
+	int32_t nodeID = 0;
+	if (DistanceSquaredToBox(p, nodes[0].boundsMin, nodes[0].boundsMax) > bestSquared)
+		return false;
+	while (true)
+	{
+		const BvhNode& node = nodes[nodeID];
+		if (node.count > 0)
 		{
-			
+			for (int32_t t = node.rightOrFirst; t < node.rightOrFirst + node.count; ++t)
+			{
+				glm::vec3 q = ClosestPointOnTriangle(p, vertices[triangles[3*t]], vertices[triangles[3*t + 1]], vertices[triangles[3*t + 2]]);
+				float distanceSquared = glm::dot(q - p, q - p);
+				if (distanceSquared < bestSquared)
+				{
+					found = true;
+					bestSquared = distanceSquared;
+					closest = q;
+				}
+			}
 		}
 		else
 		{
-			atomicAdd(&dDataCloth.deltaPos[id1].y, -dP.y);
-			atomicAdd(&dDataCloth.deltaPos[id1].x, -dP.x);
-			atomicAdd(&dDataCloth.deltaPos[id1].z, -dP.z);
+			int32_t nearID = nodeID + 1;
+			int32_t farID = node.rightOrFirst;
+			float dNear = DistanceSquaredToBox(p, nodes[nearID].boundsMin, nodes[nearID].boundsMax);
+			float dFar  = DistanceSquaredToBox(p, nodes[farID].boundsMin, nodes[farID].boundsMax);
+			if (dFar < dNear)
+			{
+				int32_t id = nearID; nearID = farID; farID = id;
+				float d = dNear; dNear = dFar; dFar = d;
+			}
+			if (dNear < bestSquared)
+			{
+				if (dFar < bestSquared)
+					stack[top++] = farID;
+				nodeID = nearID;
+				continue;
+			}
 		}
-
-
+		if (top == 0)
+			break;
+		nodeID = stack[--top];
 	}
+	return found;
 }
 
-
-__global__ void keComputeBendCloth(DeviceDataCloth dDataCloth,
-    								DeviceSimParams dSimParam,
-									int64_t 	nBendLines)
+// Particles can't tunnel through or rest closer than a radius to a mesh collider. The motion of the
+// substep relative to the collider, from positions to correctedPos in collider space, is tested first;
+// then the end point keeps its distance, on the side of the triangles the particle came from.
+// Threads follow the grid order of the slots, so the neighbors of a warp walk the same nodes.
+__global__ void keCollideMeshes(DeviceDataFluid dDataFluid,
+								int64_t 	nParticles)
 {
-	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
-	if(idx < nBendLines)
-	{
+	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
+	if (idx >= nParticles)
+		return;
 
-		int32_t id0 = dDataCloth.bendID[2*idx];
-		int32_t id1 = dDataCloth.bendID[2*idx + 1];
+	float radius = dDataFluid.commonParam->radius;
+	glm::vec3 worldPosition = dDataFluid.correctedPos[idx];
+	int32_t numMeshColliders = (dDataFluid.invMasses[idx] > 0.0f) ? dDataFluid.numMeshColliders : 0;
+	for (int32_t c = 0; c < numMeshColliders; ++c)
+	{
+		const DeviceMeshCollider& collider = dDataFluid.meshColliders[c];
+		glm::vec3 start = ToColliderSpace(collider.previousPose, dDataFluid.positions[idx]);
+		glm::vec3 position = ToColliderSpace(collider.pose, worldPosition);
+		bool contact = false;
+		glm::vec3 contactNormal;
+
+		// continuous : stop a radius before the first crossing of the motion
+		glm::vec3 motion = position - start;
+		float tHit;
+		glm::vec3 normal;
+		if ((glm::dot(motion, motion) > 1.0e-12f) &&
+			NearestSegmentHit(dDataFluid, collider, start, motion, 1.0f, tHit, normal))
+		{
+			float normalLength = length(normal);
+			if (normalLength > 1.0e-12f)
+			{
+				normal /= normalLength;
+				if (glm::dot(normal, motion) > 0.0f)
+					normal = -normal;
+				position = start + tHit * motion + radius * normal;
+				contact = true;
+				contactNormal = normal;
+			}
+		}
 
-        glm::vec3 p0 = dDataCloth.correctedPos[id0];
-        glm::vec3 p1 = dDataCloth.correctedPos[id1];
-        
-        glm::vec3 d = p1 - p0;
-		glm::vec3 norm = glm::normalize(d);
-		float len = glm::length(d);
-		float len0= 4.0f * dSimParam.commonParam->radius;
+		// proximity : push out to a radius from the closest point, towards the start side
+		glm::vec3 closest;
+		if (ClosestMeshPoint(dDataFluid, collider, position, radius * radius, closest))
+		{
+			glm::vec3 away = position - closest;
+			float distance = length(away);
+			glm::vec3 direction = (distance > 1.0e-6f) ? away / distance : start - closest;
+			if ((distance <= 1.0e-6f) && (glm::dot(direction, direction) > 1.0e-12f))
+				direction = normalize(direction);
+			if (glm::dot(direction, direction) > 0.5f)
+			{
+				position = closest + radius * direction;
+				contact = true;
+				contactNormal = direction;
+			}
+		}
 
+		if (contact && (collider.friction > 0.0f))
+			position = ApplyColliderFriction(start, position, contactNormal, collider.friction);
+		worldPosition = ToWorldSpace(collider.pose, position);
+	}
+	dDataFluid.correctedPos[idx] = ClampToAnalysisBox(dDataFluid.commonParam, worldPosition);
+}
 
-        glm::vec3 dP = norm * 0.2f * (len - len0);
+// atomicMax on the bit pattern orders non-negative floats correctly
+inline __device__ void AtomicMaxPositive(float* address, float value)
+{
+	atomicMax(reinterpret_cast<int*>(address), __float_as_int(value));
+}
 
-		if ((id0 == 0) || (id0 == 148))
-		{
+// the block size must be 256 : max speed and acceleration are reduced in shared memory, 
+// then merged across blocks with one atomic per block
+__global__ void keUpdateVelPos(DeviceDataFluid dDataFluid, 
+						 		int64_t 	nParticles)
+{
+	__shared__ float blockSpeed[256];
+	__shared__ float blockAcceleration[256];
+	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
+	float speed = 0.0f;
+	float acceleration = 0.0f;
+	if(idx < nParticles)
+	{
+		float dt = SubstepDt(dDataFluid.commonParam);
+		glm::vec3 velocity = (dDataFluid.correctedPos[idx] - dDataFluid.positions[idx])/dt;
+		// velocities still holds the prediction : the difference is the constraint acceleration
+		acceleration = length(velocity - dDataFluid.velocities[idx])/dt;
 
-		}
-		else
+		// viscosity and vorticity confinement accumulated by the last correction pass
+		if ((dDataFluid.phaseParam[dDataFluid.phases[idx]].phaseType == StateOfMatter::FLUID) && (dDataFluid.invMasses[idx] > 0.0f))
 		{
-			atomicAdd(&dDataCloth.deltaPos[id0].x, dP.x);
-			atomicAdd(&dDataCloth.deltaPos[id0].y, dP.y);
-			atomicAdd(&dDataCloth.deltaPos[id0].z, dP.z);	
+			velocity += dDataFluid.xsphVelocity[idx];
+			glm::vec3 vorticityGradient = dDataFluid.vorticityGradient[idx];
+			float gradientLength = length(vorticityGradient);
+			if (gradientLength > 1.0e-12f)
+				velocity += dt * dDataFluid.commonParam->vorticityEpsilon * glm::cross(vorticityGradient / gradientLength, dDataFluid.vorticityNext[idx]);
 		}
+		speed = length(velocity);
+		dDataFluid.velocities[idx] = velocity;
+		dDataFluid.positions[idx]  =  dDataFluid.correctedPos[idx];
+		
+		if (dDataFluid.positions[idx].x < dDataFluid.commonParam->AnalysisBox.minPoint.x + dDataFluid.commonParam->radius) dDataFluid.positions[idx].x = dDataFluid.commonParam->AnalysisBox.minPoint.x + dDataFluid.commonParam->radius;
+		if (dDataFluid.positions[idx].x > dDataFluid.commonParam->AnalysisBox.maxPoint.x - dDataFluid.commonParam->radius) dDataFluid.positions[idx].x = dDataFluid.commonParam->AnalysisBox.maxPoint.x - dDataFluid.commonParam->radius;
+		if (dDataFluid.positions[idx].y < dDataFluid.commonParam->AnalysisBox.minPoint.y + dDataFluid.commonParam->radius) dDataFluid.positions[idx].y = dDataFluid.commonParam->AnalysisBox.minPoint.y + dDataFluid.commonParam->radius;
+		if (dDataFluid.positions[idx].y > dDataFluid.commonParam->AnalysisBox.maxPoint.y - dDataFluid.commonParam->radius) dDataFluid.positions[idx].y = dDataFluid.commonParam->AnalysisBox.maxPoint.y - dDataFluid.commonParam->radius;
+		if (dDataFluid.positions[idx].z < dDataFluid.commonParam->AnalysisBox.minPoint.z + dDataFluid.commonParam->radius) dDataFluid.positions[idx].z = dDataFluid.commonParam->AnalysisBox.minPoint.z + dDataFluid.commonParam->radius;
+		if (dDataFluid.positions[idx].z > dDataFluid.commonParam->AnalysisBox.maxPoint.z - dDataFluid.commonParam->radius) dDataFluid.positions[idx].z = dDataFluid.commonParam->AnalysisBox.maxPoint.z - dDataFluid.commonParam->radius;
+	}
 
-		if ((id1 == 0) || (id1 == 148))
-		{
-			
-		}
-		else
+	blockSpeed[threadIdx.x] = speed;
+	blockAcceleration[threadIdx.x] = acceleration;
+	__syncthreads();
+	for (int32_t stride = blockDim.x/2; stride > 0; stride >>= 1)
+	{
+		if (threadIdx.x < stride)
 		{
-			atomicAdd(&dDataCloth.deltaPos[id1].y, -dP.y);
-			atomicAdd(&dDataCloth.deltaPos[id1].x, -dP.x);
-			atomicAdd(&dDataCloth.deltaPos[id1].z, -dP.z);
+			blockSpeed[threadIdx.x] = fmaxf(blockSpeed[threadIdx.x], blockSpeed[threadIdx.x + stride]);
+			blockAcceleration[threadIdx.x] = fmaxf(blockAcceleration[threadIdx.x], blockAcceleration[threadIdx.x + stride]);
 		}
+		__syncthreads();
+	}
+	if (threadIdx.x == 0)
+	{
+		AtomicMaxPositive(&dDataFluid.stepStatistics[0], blockSpeed[0]);
+		AtomicMaxPositive(&dDataFluid.stepStatistics[1], blockAcceleration[0]);
 	}
 }
 
 
-__global__ void keComputeShearCloth(DeviceDataCloth dDataCloth,
-    								DeviceSimParams dSimParam,
-									int64_t 	nShearLines)
+
+inline __device__ bool isInsideBox( glm::vec3 p1, glm::vec3 p2, glm::vec3 point) 
 {
-	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
-	if(idx < nShearLines)
+    return (point.x >= p1.x && point.x <= p2.x &&\
+			point.y >= p1.y && point.y <= p2.y &&\
+			point.z >= p1.z && point.z <= p2.z); 
+}
+
+
+// Gauss-Seidel XPBD projection of one color batch :
+// constraints of a color share no particle, so they write corrected positions directly.
+__global__ void keSolveDistanceCloth(DeviceDataCloth dDataCloth,
+    								 DeviceSimParams dSimParam,
+									 int64_t 	constraintOffset,
+									 int64_t 	nConstraints)
+{
+	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
+	if(idx < nConstraints)
 	{
+		int64_t cid = constraintOffset + idx;
+		int32_t id0 = dDataCloth.slots[dDataCloth.constraintID0[cid]];
+		int32_t id1 = dDataCloth.slots[dDataCloth.constraintID1[cid]];
 
-		int32_t id0 = dDataCloth.shearID[2*idx];
-		int32_t id1 = dDataCloth.shearID[2*idx + 1];
+		float w0 = dDataCloth.invMasses[id0];
+		float w1 = dDataCloth.invMasses[id1];
+		if (w0 + w1 == 0.0f) return;
 
         glm::vec3 p0 = dDataCloth.correctedPos[id0];
         glm::vec3 p1 = dDataCloth.correctedPos[id1];
         
         glm::vec3 d = p1 - p0;
-		glm::vec3 norm = glm::normalize(d);
 		float len = glm::length(d);
-		float len0= sqrt(2.0f) * 2.0f * dSimParam.commonParam->radius;
+		if (len < 1.0e-12f) return;
 
-        glm::vec3 dP = norm * 0.2f * (len - len0);
+		float dt = SubstepDt(dSimParam.commonParam);
+		float alphaTilde = dDataCloth.compliance[cid] / (dt * dt);
+		float constraint = len - dDataCloth.restLengths[cid];
+		float lambda = dDataCloth.constraintLambdas[cid];
+		float deltaLambda = (- constraint - alphaTilde * lambda) / (w0 + w1 + alphaTilde);
+		dDataCloth.constraintLambdas[cid] = lambda + deltaLambda;
 
-		if ((id0 == 0) || (id0 == 148))
-		{
+        glm::vec3 dP = d * (deltaLambda / len);
 
-		}
-		else
-		{
-			atomicAdd(&dDataCloth.deltaPos[id0].x, dP.x);
-			atomicAdd(&dDataCloth.deltaPos[id0].y, dP.y);
-			atomicAdd(&dDataCloth.deltaPos[id0].z, dP.z);	
-		}
+		dDataCloth.correctedPos[id0] = p0 - w0 * dP;
+		dDataCloth.correctedPos[id1] = p1 + w1 * dP;
+	}
+}
 
-		if ((id1 == 0) || (id1 == 148))
-		{
-			
-		}
-		else
-		{
-			atomicAdd(&dDataCloth.deltaPos[id1].y, -dP.y);
-			atomicAdd(&dDataCloth.deltaPos[id1].x, -dP.x);
-			atomicAdd(&dDataCloth.deltaPos[id1].z, -dP.z);
-		}
+// adjacency lists are sorted, so a binary search tells if two particles share a constraint
+// IID and JID are SimBuffer IDs, not slots
+inline HI_HOST_DEVICE bool IsConnectedCloth(DeviceDataCloth &dDataCloth, int32_t IID, int32_t JID)
+{
+	int32_t lo = dDataCloth.adjacencyOffsets[IID];
+	int32_t hi = dDataCloth.adjacencyOffsets[IID + 1];
+	while (lo < hi)
+	{
+		int32_t mid = (lo + hi) / 2;
+		int32_t id = dDataCloth.adjacencyIDs[mid];
+		if (id == JID) return true;
+		if (id < JID) lo = mid + 1;
+		else hi = mid;
 	}
+	return false;
+}
+
+inline __device__ glm::ivec3 CellCoordCloth(glm::vec3 position, float cellSize)
+{
+	return glm::ivec3(glm::floor(position / cellSize));
 }
 
-__global__ void keUpdateCorretedPositionCloth(DeviceDataCloth dDataCloth, DeviceSimParams dSimParam, int64_t nParticles)
+inline __device__ int32_t HashCellCloth(glm::ivec3 cell, int32_t hashSize)
+{
+	uint32_t h = (static_cast<uint32_t>(cell.x) * 73856093u) 
+			   ^ (static_cast<uint32_t>(cell.y) * 19349663u) 
+			   ^ (static_cast<uint32_t>(cell.z) * 83492791u);
+	return static_cast<int32_t>(h & static_cast<uint32_t>(hashSize - 1));
+}
+
+// Hash the predicted cloth positions once per substep. Entries keep SimBuffer IDs :
+// the grid sort moves the particles between the iterations of the substep.
+__global__ void keComputeHashCloth(DeviceDataCloth dDataCloth,
+								   DeviceSimParams dSimParam,
+								   int32_t 	hashSize,
+								   int64_t 	nParticles)
 {
 	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
 	if(idx < nParticles)
 	{
-		dDataCloth.correctedPos[idx] = dDataCloth.correctedPos[idx] + dDataCloth.deltaPos[idx];
-		dDataCloth.deltaPos[idx] = glm::vec3(0.0f);
+		int32_t IID = dDataCloth.clothIDs[idx];
+		glm::ivec3 cell = CellCoordCloth(dDataCloth.correctedPos[IID], dSimParam.commonParam->H);
+		dDataCloth.hashKeys[idx] = HashCellCloth(cell, hashSize);
+		dDataCloth.hashIDs[idx]  = dDataCloth.originalIDs[IID];
 	}
 }
 
-__global__ void keUpdateVelPosCloth(DeviceDataCloth dDataCloth, 
-    								DeviceSimParams dSimParam,
-						 			int64_t 	nParticles)
+// hashKeys is sorted here : every run of equal hashes is one cell
+__global__ void keFindCellRangeCloth(DeviceDataCloth dDataCloth,
+									 int64_t 	nParticles)
 {
 	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
 	if(idx < nParticles)
 	{
-		// if (idx == 0) return;
-		dDataCloth.velocities[idx] = (dDataCloth.correctedPos[idx] - dDataCloth.positions[idx])/dSimParam.commonParam->dt;
-		dDataCloth.positions[idx]  =  dDataCloth.correctedPos[idx];
+		int32_t hash = dDataCloth.hashKeys[idx];
+		if ((idx == 0) || (hash != dDataCloth.hashKeys[idx - 1]))
+			dDataCloth.cellStart[hash] = idx;
+		if ((idx == nParticles - 1) || (hash != dDataCloth.hashKeys[idx + 1]))
+			dDataCloth.cellEnd[hash] = idx + 1;
+	}
+}
+
+// Contact with particles closer than one diameter, averaged over all contacts of the particle.
+struct ClothContactTerm {
+	DeviceDataCloth &dDataCloth;
+	int32_t IID;
+	float wi;
+	float minDistance;
+	glm::vec3 deltaPos = glm::vec3(0.0f);
+	int32_t nContacts = 0;
+
+	HI_HOST_DEVICE void operator()(const NeighborPair &pair)
+	{
+		if (pair.JID == IID) return;
+
+		float distanceIJ = sqrt(pair.distanceSquared);
+		if ((distanceIJ >= minDistance) || (distanceIJ < 1.0e-12f)) return;
+
+		float wj = dDataCloth.invMasses[pair.JID];
+		deltaPos += (wi / (wi + wj)) * (minDistance - distanceIJ) / distanceIJ * pair.displacement;
+		++nContacts;
+	}
+};
+
+// fluid neighbors come from the shared grid, the cloth ones from the self collision hash
+struct FluidOnlyTerm {
+	const DeviceDataCloth &dDataCloth;
+	const PhaseParameters* phaseParam;
+	ClothContactTerm &contact;
+
+	HI_HOST_DEVICE void operator()(const NeighborPair &pair)
+	{
+		if (phaseParam[dDataCloth.phases[pair.JID]].phaseType != StateOfMatter::FLUID) return;
+		contact(pair);
+	}
+};
+
+// Jacobi contact projection : cloth particles keep one diameter away from fluid particles
+// and from non-adjacent cloth particles. Each thread only writes its own particle.
+__global__ void keCollisionCloth(DeviceDataCloth dDataCloth,
+								 DeviceSimParams dSimParam,
+								 glm::vec3 	v3MinPosition, 
+								 glm::vec3 	v3MaxPosition,
+								 int32_t 	hashSize,
+								 int64_t 	nParticles)
+{
+	int32_t idx = threadIdx.x + blockIdx.x*blockDim.x;
+	if(idx < nParticles)
+	{
+		int32_t IID = dDataCloth.clothIDs[idx];
+		float wi = dDataCloth.invMasses[IID];
+		if (wi == 0.0f)
+		{
+			dDataCloth.deltaPos[IID] = glm::vec3(0.0f);
+			return;
+		}
+
+		ClothContactTerm contact{dDataCloth, IID, wi, dSimParam.commonParam->diameter};
+
+		NeighborGrid grid(dDataCloth, dSimParam.commonParam, v3MinPosition, v3MaxPosition);
+		FluidOnlyTerm fluid{dDataCloth, dSimParam.phaseParam, contact};
+		ForEachNeighbor(grid, IID, contact.minDistance, fluid);
+
+		int32_t originalI = dDataCloth.originalIDs[IID];
+		glm::vec3 posI = dDataCloth.correctedPos[IID];
+		glm::ivec3 cellI = CellCoordCloth(posI, dSimParam.commonParam->H);
+		for (int32_t yyy = -1 ; yyy < 2  ; ++yyy)
+			for (int32_t zzz = -1 ; zzz < 2  ; ++zzz)
+				for (int32_t xxx = -1 ; xxx < 2  ; ++xxx)
+				{
+					int32_t hash = HashCellCloth(cellI + glm::ivec3(xxx, yyy, zzz), hashSize);
+					int32_t staK = dDataCloth.cellStart[hash];
+					if (staK < 0) continue;
+					int32_t endK = dDataCloth.cellEnd[hash];
+					for (int32_t k = staK; k < endK; ++k)
+					{
+						int32_t originalJ = dDataCloth.hashIDs[k];
+						if (originalJ == originalI) continue;
+						if (IsConnectedCloth(dDataCloth, originalI, originalJ)) continue;
+
+						NeighborPair pair;
+						pair.JID = dDataCloth.slots[originalJ];
+						pair.displacement = posI - dDataCloth.correctedPos[pair.JID];
+						pair.distanceSquared = glm::dot(pair.displacement, pair.displacement);
+						contact(pair);
+					}
+				}
+
+		dDataCloth.deltaPos[IID] = contact.nContacts > 0 ? contact.deltaPos / static_cast<float>(contact.nContacts) : contact.deltaPos;
 	}
 }
 
@@ -526,10 +921,8 @@ __global__ void keGetRenderValuesCloth(DeviceDataCloth dDataCloth,
 	int64_t idx = threadIdx.x + blockIdx.x*blockDim.x;
 	if(idx < nParticles)
 	{
-		// dDataCloth.colorValues[idx] = length(dDataCloth.velocities[idx]);
-		// dDataCloth.colorValues[idx] = static_cast<float>(dDataCloth.gridIndices[idx]);
-		// dDataCloth.colorValues[idx] = dDataCloth.constraints[idx];
-		dDataCloth.colorValues[idx] = dDataCloth.velocities[idx].x;
-		// dDataCloth.colorValues[idx] = length(dDataCloth.DeviceDataFluid[idx]);
+		int32_t IID = dDataCloth.clothIDs[idx];
+		// colored by the speed magnitude
+		dDataCloth.colorValues[IID] = glm::length(dDataCloth.velocities[IID]);
 	}
 }
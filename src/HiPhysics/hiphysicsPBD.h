@@ -2,10 +2,13 @@
 #define __HIPHYSICSPBD_H__
 
 #include "hiphysics.h"
+#include "hiphysicsPrecision.h"
 #include <thrust/device_vector.h>
 #include <thrust/iterator/constant_iterator.h>
 #include <thrust/gather.h>
+#include <thrust/sort.h>
 
+template <typename Policy>
 __global__ void keGetRenderValues(
     DeviceDataFluid dDataFluid,
     int64_t nParticles);
@@ -24,16 +27,33 @@ __global__ void keCountParticlesInGrids(
     glm::vec3 v3MaxPosition,
     int64_t nParticles);
 
+// Encode correctedPos relative to the cell of each (sorted) particle
+__global__ void keQuantizePositions(
+    DeviceDataFluid dDataFluid,
+    glm::vec3 v3MinPosition,
+    glm::vec3 v3MaxPosition,
+    int64_t nParticles);
+
+template <typename Policy>
 __global__ void keComputeConstraint(
     DeviceDataFluid dDataFluid,
     glm::vec3 v3MinPosition,
     glm::vec3 v3MaxPosition,
     int64_t nParticles);
 
+// Flag the fluid particles on the free surface for the renderer
+__global__ void keClassifySurface(
+    DeviceDataFluid dDataFluid,
+    glm::vec3 v3MinPosition,
+    glm::vec3 v3MaxPosition,
+    int64_t nParticles);
+
+template <typename Policy>
 __global__ void keComputePositionCorrection(
     DeviceDataFluid dDataFluid,
     glm::vec3 v3MinPosition,
     glm::vec3 v3MaxPosition,
+    bool accumulateVelocityTerms,
     int64_t nParticles);
 
 __global__ void kePredictPosition(
@@ -44,6 +64,10 @@ __global__ void keUpdateCorretedPosition(
     DeviceDataFluid dDataFluid,
     int64_t nParticles);
 
+__global__ void keCollideMeshes(
+    DeviceDataFluid dDataFluid,
+    int64_t nParticles);
+
 /// Update Particles Positions
 __global__ void keUpdateVelPos(
     DeviceDataFluid dDataFluid,
@@ -51,34 +75,30 @@ __global__ void keUpdateVelPos(
 
 
 
-__global__ void kePredictPositionCloth(
-    DeviceDataCloth dDataCloth,
-    DeviceSimParams dSimParam,
-    int64_t nParticles);
-
-__global__ void keComputeStretchCloth(
-    DeviceDataCloth dDataCloth,
-    DeviceSimParams dSimParam,
-    int64_t nStretchLine);
-
-__global__ void keComputeBendCloth(
+__global__ void keSolveDistanceCloth(
     DeviceDataCloth dDataCloth,
     DeviceSimParams dSimParam,
-    int64_t nStretchLine);
+    int64_t constraintOffset,
+    int64_t nConstraints);
 
-__global__ void keComputeShearCloth(
+/// Cloth self collision : spatial hash of the cloth particles, built once per substep
+__global__ void keComputeHashCloth(
     DeviceDataCloth dDataCloth,
     DeviceSimParams dSimParam,
-    int64_t nStretchLine);
+    int32_t hashSize,
+    int64_t nParticles);
 
-__global__ void keUpdateCorretedPositionCloth(
+__global__ void keFindCellRangeCloth(
     DeviceDataCloth dDataCloth,
-    DeviceSimParams dSimParam,
     int64_t nParticles);
 
-__global__ void keUpdateVelPosCloth(
+/// Cloth contacts with fluid particles on the shared grid and with cloth particles in the hash
+__global__ void keCollisionCloth(
     DeviceDataCloth dDataCloth,
     DeviceSimParams dSimParam,
+    glm::vec3 v3MinPosition,
+    glm::vec3 v3MaxPosition,
+    int32_t hashSize,
     int64_t nParticles);
 
 __global__ void keGetRenderValuesCloth(
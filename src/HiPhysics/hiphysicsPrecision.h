@@ -0,0 +1,83 @@
+#ifndef __HIPHYSICSPRECISION_H__
+#define __HIPHYSICSPRECISION_H__
+
+#include "hiphysicsNeighbor.h"
+#include <cuda_fp16.h>
+
+// Precision policies of the fluid density solve, positions and velocities stay float in every one.
+// Real    : type the neighbor geometry, kernel values, neighbor sums and multiplier updates are computed in
+// Storage : type the Lagrange multipliers are kept in between kernels
+struct PrecisionSingle {
+    typedef float Real;
+    typedef float Storage;
+};
+
+struct PrecisionHalfStorage {
+    typedef float Real;
+    typedef __half Storage;
+};
+
+struct PrecisionDouble {
+    typedef double Real;
+    typedef double Storage;
+};
+
+inline size_t MultiplierStorageSize(Precision precision)
+{
+    switch (precision)
+    {
+    case Precision::HALF_STORAGE :  return sizeof(__half);
+    case Precision::DOUBLE :        return sizeof(double);
+    default :                       return sizeof(float);
+    }
+}
+
+// conversions between a storage type and the compute type, half goes through float
+template <typename Storage>
+struct StorageConversion {
+    template <typename Real>
+    HI_HOST_DEVICE static Real Load(Storage value) { return static_cast<Real>(value); }
+    template <typename Real>
+    HI_HOST_DEVICE static Storage Store(Real value) { return static_cast<Storage>(value); }
+};
+
+template <>
+struct StorageConversion<__half> {
+    template <typename Real>
+    HI_HOST_DEVICE static Real Load(__half value) { return static_cast<Real>(__half2float(value)); }
+    template <typename Real>
+    HI_HOST_DEVICE static __half Store(Real value) { return __float2half(static_cast<float>(value)); }
+};
+
+// Typed view of lambdas or deltaLambdas.
+// Multipliers scale like the particle volume, so they are kept divided by it :
+// this keeps them in the normal range of a half.
+template <typename Policy>
+struct MultiplierBuffer {
+    typedef typename Policy::Real Real;
+    typedef typename Policy::Storage Storage;
+
+    Storage* data;
+    Real particleVolume;
+    Real iParticleVolume;
+
+    HI_HOST_DEVICE MultiplierBuffer(void* buffer, const CommonParameters* commonParam) :
+        data(static_cast<Storage*>(buffer))
+    {
+        Real diameter = static_cast<Real>(2.0f * commonParam->radius);
+        particleVolume  = diameter * diameter * diameter;
+        iParticleVolume = static_cast<Real>(1.0) / particleVolume;
+    }
+
+    HI_HOST_DEVICE Real Load(int32_t ID) const
+    {
+        return StorageConversion<Storage>::template Load<Real>(data[ID]) * particleVolume;
+    }
+
+    HI_HOST_DEVICE void Store(int32_t ID, Real value)
+    {
+        data[ID] = StorageConversion<Storage>::template Store<Real>(value * iParticleVolume);
+    }
+};
+
+#endif // __HIPHYSICSPRECISION_H__
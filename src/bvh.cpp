@@ -0,0 +1,183 @@
+#include "bvh.h"
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+int32_t const bvhBins = 12;
+int32_t const bvhMaxLeafTriangles = 4;
+
+struct Bounds {
+    glm::vec3 minPoint {FLT_MAX};
+    glm::vec3 maxPoint {-FLT_MAX};
+
+    void Grow(const glm::vec3 &p)
+    {
+        minPoint = glm::min(minPoint, p);
+        maxPoint = glm::max(maxPoint, p);
+    }
+    void Grow(const Bounds &b)
+    {
+        minPoint = glm::min(minPoint, b.minPoint);
+        maxPoint = glm::max(maxPoint, b.maxPoint);
+    }
+    float HalfArea() const
+    {
+        glm::vec3 e = maxPoint - minPoint;
+        return (e.x < 0.0f) ? 0.0f : e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+static Bounds TriangleBounds(const MeshCollider &collider, const std::vector<int32_t> &triangles, int32_t t)
+{
+    Bounds bounds;
+    for (int32_t k = 0; k < 3; ++k)
+        bounds.Grow(collider.vertices[triangles[3*t + k]]);
+    return bounds;
+}
+
+// node of the triangles order[first, first + count) at depth, returns its index
+static int32_t BuildNode(MeshCollider &collider, std::vector<int32_t> &order, const std::vector<Bounds> &triangleBounds,
+                         const std::vector<glm::vec3> &centroids, int32_t first, int32_t count, int32_t depth)
+{
+    assert(depth <= bvhMaxDepth);
+    int32_t nodeID = static_cast<int32_t>(collider.nodes.size());
+    collider.nodes.push_back(BvhNode());
+
+    Bounds bounds, centroidBounds;
+    for (int32_t i = first; i < first + count; ++i)
+    {
+        bounds.Grow(triangleBounds[order[i]]);
+        centroidBounds.Grow(centroids[order[i]]);
+    }
+    collider.nodes[nodeID].boundsMin = bounds.minPoint;
+    collider.nodes[nodeID].boundsMax = bounds.maxPoint;
+
+    // cheapest split plane among the bin boundaries of every axis
+    float bestCost = FLT_MAX;
+    int32_t bestAxis = -1;
+    int32_t bestSplit = 0;
+    glm::vec3 extent = centroidBounds.maxPoint - centroidBounds.minPoint;
+    for (int32_t axis = 0; (axis < 3) && (count > bvhMaxLeafTriangles); ++axis)
+    {
+        if (extent[axis] <= 0.0f)
+            continue;
+        Bounds bins[bvhBins];
+        int32_t binCounts[bvhBins] = {};
+        float scale = bvhBins / extent[axis];
+        for (int32_t i = first; i < first + count; ++i)
+        {
+            int32_t bin = std::min(bvhBins - 1, static_cast<int32_t>((centroids[order[i]][axis] - centroidBounds.minPoint[axis]) * scale));
+            bins[bin].Grow(triangleBounds[order[i]]);
+            ++binCounts[bin];
+        }
+
+        // cost of the split after bin s = area left * count left + area right * count right
+        float leftCost[bvhBins - 1];
+        Bounds left;
+        int32_t leftCount = 0;
+        for (int32_t s = 0; s < bvhBins - 1; ++s)
+        {
+            left.Grow(bins[s]);
+            leftCount += binCounts[s];
+            leftCost[s] = left.HalfArea() * leftCount;
+        }
+        Bounds right;
+        int32_t rightCount = 0;
+        for (int32_t s = bvhBins - 1; s > 0; --s)
+        {
+            right.Grow(bins[s]);
+            rightCount += binCounts[s];
+            float cost = leftCost[s - 1] + right.HalfArea() * rightCount;
+            if ((rightCount < count) && (cost < bestCost))
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = s;
+            }
+        }
+    }
+
+    // a leaf when splitting doesn't pay off : traversal cost counted as one triangle test
+    bool leaf = (bestAxis < 0) || ((count <= 2 * bvhMaxLeafTriangles) && (bestCost >= bounds.HalfArea() * count));
+    if (leaf && (count > bvhMaxLeafTriangles) && (bestAxis < 0) && (depth < bvhMaxDepth))
+    {
+        // coincident centroids : split in halves anyway, leaves stay small
+        bestAxis = 0;
+        bestSplit = -1;
+        leaf = false;
+    }
+    // the traversal stacks can't go deeper : a large leaf is slower but still exact
+    if (depth == bvhMaxDepth)
+        leaf = true;
+    if (leaf)
+    {
+        collider.nodes[nodeID].rightOrFirst = first;
+        collider.nodes[nodeID].count = count;
+        return nodeID;
+    }
+
+    int32_t middle = first + count / 2;
+    if (bestSplit >= 0)
+    {
+        float scale = bvhBins / extent[bestAxis];
+        auto split = std::partition(order.begin() + first, order.begin() + first + count, [&](int32_t t) {
+            return std::min(bvhBins - 1, static_cast<int32_t>((centroids[t][bestAxis] - centroidBounds.minPoint[bestAxis]) * scale)) < bestSplit;
+        });
+        middle = static_cast<int32_t>(split - order.begin());
+    }
+
+    BuildNode(collider, order, triangleBounds, centroids, first, middle - first, depth + 1);
+    int32_t right = BuildNode(collider, order, triangleBounds, centroids, middle, first + count - middle, depth + 1);
+    collider.nodes[nodeID].rightOrFirst = right;
+    collider.nodes[nodeID].count = 0;
+    return nodeID;
+}
+
+void BuildBvh(MeshCollider &collider)
+{
+    int32_t nTriangles = static_cast<int32_t>(collider.triangles.size() / 3);
+    std::vector<Bounds> triangleBounds(nTriangles);
+    std::vector<glm::vec3> centroids(nTriangles);
+    for (int32_t t = 0; t < nTriangles; ++t)
+    {
+        triangleBounds[t] = TriangleBounds(collider, collider.triangles, t);
+        centroids[t] = 0.5f * (triangleBounds[t].minPoint + triangleBounds[t].maxPoint);
+    }
+
+    std::vector<int32_t> order(nTriangles);
+    std::iota(order.begin(), order.end(), 0);
+    collider.nodes.clear();
+    collider.nodes.reserve(2 * nTriangles);
+    if (nTriangles > 0)
+        BuildNode(collider, order, triangleBounds, centroids, 0, nTriangles, 0);
+
+    std::vector<int32_t> triangles(collider.triangles.size());
+    for (int32_t t = 0; t < nTriangles; ++t)
+        for (int32_t k = 0; k < 3; ++k)
+            triangles[3*t + k] = collider.triangles[3*order[t] + k];
+    collider.triangles = std::move(triangles);
+}
+
+void RefitBvh(MeshCollider &collider)
+{
+    // children follow their parent : in reverse order, both children are up to date
+    for (int32_t nodeID = static_cast<int32_t>(collider.nodes.size()) - 1; nodeID >= 0; --nodeID)
+    {
+        BvhNode &node = collider.nodes[nodeID];
+        Bounds bounds;
+        if (node.count > 0)
+        {
+            for (int32_t t = node.rightOrFirst; t < node.rightOrFirst + node.count; ++t)
+                bounds.Grow(TriangleBounds(collider, collider.triangles, t));
+        }
+        else
+        {
+            const BvhNode &left  = collider.nodes[nodeID + 1];
+            const BvhNode &right = collider.nodes[node.rightOrFirst];
+            bounds.minPoint = glm::min(left.boundsMin, right.boundsMin);
+            bounds.maxPoint = glm::max(left.boundsMax, right.boundsMax);
+        }
+        node.boundsMin = bounds.minPoint;
+        node.boundsMax = bounds.maxPoint;
+    }
+}
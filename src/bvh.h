@@ -0,0 +1,14 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include "common.h"
+#include "simbuffer.h"
+
+// Build the BVH of collider.vertices and triangles with the binned surface area heuristic,
+// triangles are reordered so every leaf holds a contiguous range
+void BuildBvh(MeshCollider &collider);
+
+// Bounds of every node from the current vertices, the tree is kept : the mesh moved but kept its topology
+void RefitBvh(MeshCollider &collider);
+
+#endif // __BVH_H__
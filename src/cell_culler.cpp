@@ -0,0 +1,188 @@
+#include "cell_culler.h"
+#include "hostworkers.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+enum class CellDraw { Culled, Particles, Splat };
+
+// particles of a run without solver cell IDs
+int64_t const cullBlockSize = 64;
+
+struct CullView {
+    glm::vec4 planes[6];    // inside where dot(xyz, p) + w >= 0
+    glm::vec3 cameraPos;
+    float pointRadius;
+    float lodDistance;      // runs farther away are drawn as splats
+};
+
+static CellDraw ClassifyRun(const CullView &view, const glm::vec3 *positions, const int32_t *order, int64_t begin, int64_t end)
+{
+    // the bounds of the particles grown by the sprite radius
+    glm::vec3 lower(FLT_MAX);
+    glm::vec3 upper(-FLT_MAX);
+    for (int64_t idx = begin; idx < end; ++idx)
+    {
+        const glm::vec3 &position = positions[order ? order[idx] : idx];
+        lower = glm::min(lower, position);
+        upper = glm::max(upper, position);
+    }
+    lower -= glm::vec3(view.pointRadius);
+    upper += glm::vec3(view.pointRadius);
+    for (const glm::vec4 &plane : view.planes)
+    {
+        glm::vec3 farthest(plane.x > 0.0f ? upper.x : lower.x,
+                           plane.y > 0.0f ? upper.y : lower.y,
+                           plane.z > 0.0f ? upper.z : lower.z);
+        if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.0f)
+            return CellDraw::Culled;
+    }
+    glm::vec3 center = 0.5f * (lower + upper);
+    return (glm::length(center - view.cameraPos) > view.lodDistance) ? CellDraw::Splat : CellDraw::Particles;
+}
+
+// the splat standing for the particles [begin, end) of the walk
+static glm::vec4 MergeParticles(const glm::vec3 *positions, const int32_t *order, int64_t begin, int64_t end)
+{
+    glm::vec3 centroid(0.0f);
+    for (int64_t idx = begin; idx < end; ++idx)
+        centroid += positions[order ? order[idx] : idx];
+    float numParticles = static_cast<float>(end - begin);
+    return glm::vec4(centroid / numParticles, cbrtf(numParticles));
+}
+
+CellCullerUPtr CellCuller::Create()
+{
+    auto culler = CellCullerUPtr(new CellCuller());
+    culler->Init();
+    return std::move(culler);
+}
+
+void CellCuller::Init()
+{
+    m_workerLists.resize(HostWorkers::Get().Size());
+    m_surfaceOffsets.resize(m_workerLists.size());
+}
+
+void CellCuller::Update(const glm::vec3 *positions, const int32_t *order, const int32_t *cells, const uint8_t *surfaceFlags,
+                        size_t count, const glm::mat4 &viewProj, const glm::vec3 &cameraPos,
+                        float pointRadius, float pointScale, float lodPointSize)
+{
+    CullView view;
+    for (int32_t axis = 0; axis < 3; ++axis)
+    {
+        glm::vec4 row(viewProj[0][axis], viewProj[1][axis], viewProj[2][axis], viewProj[3][axis]);
+        glm::vec4 wRow(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+        view.planes[2 * axis]     = wRow + row;
+        view.planes[2 * axis + 1] = wRow - row;
+    }
+    view.cameraPos = cameraPos;
+    view.pointRadius = pointRadius;
+    view.lodDistance = (lodPointSize > 0.0f) ? pointScale * pointRadius / lodPointSize : FLT_MAX;
+
+    // a worker left without a range keeps its lists of the previous frame otherwise
+    for (WorkerLists &lists : m_workerLists)
+    {
+        lists.firsts.clear();
+        lists.counts.clear();
+        lists.surfacePoints.clear();
+        lists.lodSplats.clear();
+        lists.proxySplats.clear();
+        lists.numMerged = 0;
+    }
+
+    HostWorkers::Get().RunChunks(count, [&](int32_t worker, int64_t begin, int64_t end) {
+        WorkerLists &lists = m_workerLists[worker];
+        int64_t idx = begin;
+        while (idx < end)
+        {
+            int64_t runEnd = idx + 1;
+            if (cells)
+                while ((runEnd < end) && (cells[runEnd] == cells[idx]))
+                    ++runEnd;
+            else
+                runEnd = std::min(end, idx + cullBlockSize);
+
+            CellDraw draw = ClassifyRun(view, positions, order, idx, runEnd);
+            if (draw == CellDraw::Splat)
+            {
+                lists.lodSplats.push_back(MergeParticles(positions, order, idx, runEnd));
+                lists.numMerged += runEnd - idx;
+            }
+            else if ((draw == CellDraw::Particles) && surfaceFlags)
+            {
+                // the surface particles are copied out, the interior ones merge into one thickness proxy
+                glm::vec3 interiorSum(0.0f);
+                int64_t numInterior = 0;
+                for (int64_t jdx = idx; jdx < runEnd; ++jdx)
+                {
+                    const glm::vec3 &position = positions[order ? order[jdx] : jdx];
+                    if (surfaceFlags[jdx])
+                        lists.surfacePoints.push_back(position);
+                    else
+                    {
+                        interiorSum += position;
+                        ++numInterior;
+                    }
+                }
+                if (numInterior > 0)
+                {
+                    float numParticles = static_cast<float>(numInterior);
+                    lists.proxySplats.push_back(glm::vec4(interiorSum / numParticles, cbrtf(numParticles)));
+                    lists.numMerged += numInterior;
+                }
+            }
+            else if (draw == CellDraw::Particles)
+            {
+                if (!lists.counts.empty() && (lists.firsts.back() + lists.counts.back() == idx))
+                    lists.counts.back() += static_cast<GLsizei>(runEnd - idx);
+                else
+                {
+                    lists.firsts.push_back(static_cast<GLint>(idx));
+                    lists.counts.push_back(static_cast<GLsizei>(runEnd - idx));
+                }
+            }
+            idx = runEnd;
+        }
+    });
+
+    // in worker order, which is walk order : ranges that meet across workers are merged
+    m_firsts.clear();
+    m_counts.clear();
+    m_splats.clear();
+    m_numSurfacePoints = 0;
+    m_numDrawn = 0;
+    m_numMerged = 0;
+    for (size_t ww = 0; ww < m_workerLists.size(); ++ww)
+    {
+        const WorkerLists &lists = m_workerLists[ww];
+        for (size_t rr = 0; rr < lists.firsts.size(); ++rr)
+        {
+            if (!m_counts.empty() && (m_firsts.back() + m_counts.back() == lists.firsts[rr]))
+                m_counts.back() += lists.counts[rr];
+            else
+            {
+                m_firsts.push_back(lists.firsts[rr]);
+                m_counts.push_back(lists.counts[rr]);
+            }
+            m_numDrawn += lists.counts[rr];
+        }
+        m_surfaceOffsets[ww] = m_numSurfacePoints;
+        m_numSurfacePoints += lists.surfacePoints.size();
+        m_splats.insert(m_splats.end(), lists.lodSplats.begin(), lists.lodSplats.end());
+        m_numMerged += lists.numMerged;
+    }
+    m_numLodSplats = static_cast<int32_t>(m_splats.size());
+    for (const WorkerLists &lists : m_workerLists)
+        m_splats.insert(m_splats.end(), lists.proxySplats.begin(), lists.proxySplats.end());
+    m_numDrawn += m_numSurfacePoints;
+}
+
+void CellCuller::CopySurfacePoints(glm::vec3 *destination) const
+{
+    HostWorkers::Get().Run(m_workerLists.size(), [&](int32_t, int64_t begin, int64_t end) {
+        for (int64_t ww = begin; ww < end; ++ww)
+            memcpy(destination + m_surfaceOffsets[ww], m_workerLists[ww].surfacePoints.data(),
+                   m_workerLists[ww].surfacePoints.size() * sizeof(glm::vec3));
+    });
+}
@@ -0,0 +1,65 @@
+#ifndef __CELL_CULLER_H__
+#define __CELL_CULLER_H__
+
+#include "common.h"
+#include "simbuffer.h"
+
+// Draw lists of the particles that can be seen. Walked in the solver's grid order with the cell ID of every
+// particle (see HiPhysics::GetMemory), a cell of its neighbor grid is a run of equal IDs; without them the
+// runs are fixed blocks of consecutive particles. A run is culled as a whole by the bounds of its particles
+// against the view frustum, the visible ones are drawn as ranges merged where they touch. A run whose
+// particles project smaller than the LOD point size is drawn as a single splat at their centroid instead,
+// its radius scaled by the cube root of their number. With surface flags, only the surface particles of a
+// run are drawn, its interior ones become such a splat as well : a proxy that only adds thickness.
+CLASS_PTR(CellCuller)
+class CellCuller
+{
+public:
+    static CellCullerUPtr Create();
+
+    // order : particle IDs in grid order, nullptr to walk the particles as they are.
+    // cells : solver cell ID of every particle of the walk, nullptr to cut the walk into fixed blocks.
+    // surfaceFlags : in the same order as the walk, nullptr draws every particle of the visible runs
+    void Update(const glm::vec3 *positions, const int32_t *order, const int32_t *cells, const uint8_t *surfaceFlags,
+                size_t count, const glm::mat4 &viewProj, const glm::vec3 &cameraPos,
+                float pointRadius, float pointScale, float lodPointSize);
+
+    // without surface flags : ranges of the visible particles, in walk order
+    const std::vector<GLint>& GetFirsts() const { return m_firsts; }
+    const std::vector<GLsizei>& GetCounts() const { return m_counts; }
+    // with surface flags : the visible surface particles
+    int64_t GetNumSurfacePoints() const { return m_numSurfacePoints; }
+    void CopySurfacePoints(glm::vec3 *destination) const;
+    // xyz : centroid, w : radius scale. The distant cells first, then the interior proxies
+    const std::vector<glm::vec4>& GetSplats() const { return m_splats; }
+    int32_t GetNumLodSplats() const { return m_numLodSplats; }
+
+    int64_t GetNumDrawn() const { return m_numDrawn; }
+    int64_t GetNumMerged() const { return m_numMerged; }
+
+private:
+    CellCuller() {}
+    void Init();
+
+    // draw lists of one host worker, over its own range of the walk
+    struct WorkerLists {
+        std::vector<GLint> firsts;
+        std::vector<GLsizei> counts;
+        std::vector<glm::vec3> surfacePoints;
+        std::vector<glm::vec4> lodSplats;
+        std::vector<glm::vec4> proxySplats;
+        int64_t numMerged {0};
+    };
+    std::vector<WorkerLists> m_workerLists;
+    std::vector<int64_t> m_surfaceOffsets;   // first surface point of each worker
+
+    std::vector<GLint> m_firsts;
+    std::vector<GLsizei> m_counts;
+    std::vector<glm::vec4> m_splats;
+    int32_t m_numLodSplats {0};
+    int64_t m_numSurfacePoints {0};
+    int64_t m_numDrawn {0};
+    int64_t m_numMerged {0};
+};
+
+#endif // __CELL_CULLER_H__
@@ -1,5 +1,7 @@
 #include "common.h"
+#include "hostworkers.h"
 #include <fstream>
+#include <numeric>
 #include <sstream>
 
 std::optional<std::string> LoadTextFile(const std::string& filename) {
@@ -64,4 +66,33 @@ glm::vec3 min_element_xyz(std::vector<glm::vec3>* aGlmVec3)
         if (res.z > first->z) res.z = first->z;        
     }
     return res;
-}
\ No newline at end of file
+}
+
+void minmax_element_xyz(const ParticleArray<glm::vec3>& aGlmVec3, glm::vec3& minPoint, glm::vec3& maxPoint)
+{
+    typedef std::pair<glm::vec3, glm::vec3> Box;
+    if (aGlmVec3.empty())
+    {
+        minPoint = glm::vec3(0.0f);
+        maxPoint = glm::vec3(0.0f);
+        return;
+    }
+
+    // ranges of their owners, as the workers first touched them
+    HostWorkers& workers = HostWorkers::Get();
+    std::vector<Box> boxes(workers.Size(), Box(aGlmVec3.front(), aGlmVec3.front()));
+    workers.RunChunks(aGlmVec3.size(), [&](int32_t worker, int64_t begin, int64_t end) {
+        Box box = boxes[worker];
+        for (int64_t idx = begin; idx < end; ++idx)
+            box = Box(glm::min(box.first, aGlmVec3[idx]), glm::max(box.second, aGlmVec3[idx]));
+        boxes[worker] = box;
+    });
+
+    minPoint = boxes.front().first;
+    maxPoint = boxes.front().second;
+    for (const Box& box : boxes)
+    {
+        minPoint = glm::min(minPoint, box.first);
+        maxPoint = glm::max(maxPoint, box.second);
+    }
+}
@@ -25,9 +25,32 @@ std::optional<std::string> LoadTextFile(const std::string& filename);
 
 glm::vec3 GetAttenuationCoeff(float distance);
 
+// Default construction leaves trivial elements uninitialized, so resize() writes no page :
+// the host worker owning an element writes it first, see SimBuffer::ResizeParticles.
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T>
+{
+    template <typename U> struct rebind { using other = FirstTouchAllocator<U>; };
+
+    FirstTouchAllocator() = default;
+    template <typename U> FirstTouchAllocator(const FirstTouchAllocator<U> &) {}
+
+    template <typename U> void construct(U *p) { ::new (static_cast<void *>(p)) U; }
+    template <typename U, typename... Args> void construct(U *p, Args &&...args)
+    {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T>
+using ParticleArray = std::vector<T, FirstTouchAllocator<T>>;
+
 glm::vec3 max_element_xyz(std::vector<glm::vec3>* aGlmVec3);
 
 glm::vec3 min_element_xyz(std::vector<glm::vec3>* aGlmVec3);
 
+// min and max corners in a single pass, each host worker reduces the range it owns
+void minmax_element_xyz(const ParticleArray<glm::vec3>& aGlmVec3, glm::vec3& minPoint, glm::vec3& maxPoint);
+
 #endif // __COMMON_H__
 
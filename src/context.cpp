@@ -1,5 +1,8 @@
 #include "context.h"
 #include "image.h"
+#include "hostworkers.h"
+#include "cell_culler.h"
+#include <cstring>
 #include <imgui.h>
 
 ContextUPtr Context::Create()
@@ -31,10 +34,15 @@ bool Context::Init()
     if (!m_fluidRenderProgram)
         return false;
 
+    m_fluidDepthFilterProgram = Program::Create("../shader/fluidRender.vs", "../shader/fluidDepthFilter.fs");
+    if (!m_fluidDepthFilterProgram)
+        return false;
+
     // Initializing openGL Scene
     glClearColor(0.0f, 0.1f, 0.2f, 0.0f); // default background color
 
     m_plane = Mesh::CreatePlane();
+    m_cellCuller = CellCuller::Create();
 
     return true;
 }
@@ -45,6 +53,9 @@ bool Context::MapSimBuffer(SimBufferPtr simBuffer)
     m_positions = &simBuffer->m_positions; 
     m_colors = &simBuffer->m_colorValues;
     m_commonParam = &simBuffer->m_commonParam;
+    m_gridOrder = &simBuffer->m_gridOrder;
+    m_surfaceFlags = &simBuffer->m_surfaceFlags;
+    m_gridCells = &simBuffer->m_gridCells;
     return true;
 }
 
@@ -90,10 +101,45 @@ void Context::DrawUI()
             // m_selectedScene = 0;
             m_reloadScene = true;
         }
+        ImGui::Checkbox("use state cache", &m_useStateCache);
+        const char* precisionNames[] = { "scene default", "single", "half storage", "double" };
+        if (ImGui::Combo("precision", &m_precisionOverride, precisionNames, IM_ARRAYSIZE(precisionNames)))
+            m_reloadScene = true;
         
         ImGui::Separator();
         ImGui::DragFloat("particle size", &m_particleSizeRatio, 0.01f, 0.01f, 2.0f);
         ImGui::Separator();
+
+        if (ImGui::CollapsingHeader("Fluid Rendering"))
+        {
+            const char* resolutionNames[] = { "full", "half", "quarter" };
+            int resolution = (m_fluidDownsample == 4) ? 2 : m_fluidDownsample - 1;
+            if (ImGui::Combo("fluid resolution", &resolution, resolutionNames, IM_ARRAYSIZE(resolutionNames)))
+            {
+                m_fluidDownsample = 1 << resolution;
+                CreateFluidFramebuffers();
+            }
+            const char* filterNames[] = { "off", "bilateral", "narrow range" };
+            ImGui::Combo("depth filter", &m_depthFilter, filterNames, IM_ARRAYSIZE(filterNames));
+            if (m_depthFilter != 0)
+            {
+                ImGui::SliderInt("filter iterations", &m_depthFilterIterations, 1, 4);
+                ImGui::SliderFloat("filter radius", &m_depthFilterRadius, 0.5f, 8.0f);
+                ImGui::SliderFloat("filter depth range", &m_depthFilterRange, 0.5f, 8.0f);
+            }
+            ImGui::Checkbox("cell culling", &m_cellCulling);
+            if (m_cellCulling)
+            {
+                ImGui::SliderFloat("LOD point size", &m_lodPointSize, 0.0f, 4.0f, "%.2f px");
+                ImGui::Checkbox("surface particles only", &m_surfaceOnly);
+                if (m_surfaceOnly)
+                    ImGui::SliderFloat("surface threshold", &m_commonParam->surfaceThreshold, 0.1f, 1.5f);
+                ImGui::Text("%lld particles drawn, %lld merged into %d splats",
+                            static_cast<long long>(m_cellCuller->GetNumDrawn()),
+                            static_cast<long long>(m_cellCuller->GetNumMerged()),
+                            static_cast<int>(m_cellCuller->GetSplats().size()));
+            }
+        }
         
         
         // Legend
@@ -111,12 +157,22 @@ void Context::DrawUI()
         if (ImGui::CollapsingHeader("Numerical Parameters", ImGuiTreeNodeFlags_DefaultOpen))
         {
             ImGui::SliderInt("Iterations", &m_commonParam->iterationNumber,1,30);
+            ImGui::SliderInt("Substeps", &m_commonParam->substepNumber,1,30);
             if (ImGui::InputFloat("particle radius", &m_commonParam->radius,0.1f*m_commonParam->radius, 0.2f*m_commonParam->radius, "%.5f"))
                 m_commonParam->H = m_commonParam->radius * 2.0f * 2.0f * 1.2f;
             ImGui::InputFloat("compute time step", &m_commonParam->dt, 0.1f*m_commonParam->dt, 0.2f*m_commonParam->dt, "%.5f");
-            ImGui::InputFloat("relaxationParameter", &m_commonParam->relaxationParameter,0.1f*m_commonParam->relaxationParameter, 0.2f*m_commonParam->relaxationParameter, "%.5f");
+            ImGui::Checkbox("adaptive time step", &m_commonParam->adaptiveDt);
+            if (m_commonParam->adaptiveDt)
+            {
+                ImGui::Text("adaptive time step : %.6f", m_adaptiveDt);
+                ImGui::SliderFloat("CFL number", &m_commonParam->cflNumber, 0.05f, 1.0f);
+                ImGui::InputFloat("frame time", &m_commonParam->frameDt, 0.1f*m_commonParam->frameDt, 0.2f*m_commonParam->frameDt, "%.5f");
+            }
+            ImGui::InputFloat("density compliance", &m_commonParam->densityCompliance,0.1f*m_commonParam->densityCompliance, 0.2f*m_commonParam->densityCompliance, "%.10f");
             ImGui::InputFloat("scorrK", &m_commonParam->scorrK,0.1f*m_commonParam->scorrK, 0.2f*m_commonParam->scorrK, "%.5f");
             ImGui::InputFloat("scorrDq", &m_commonParam->scorrDq,0.1f*m_commonParam->scorrDq, 0.2f*m_commonParam->scorrDq, "%.5f");
+            ImGui::SliderFloat("XSPH viscosity", &m_commonParam->xsphViscosity, 0.0f, 1.0f);
+            ImGui::InputFloat("vorticity confinement", &m_commonParam->vorticityEpsilon, 0.0001f, 0.001f, "%.5f");
         }
         ImGui::DragFloat3("gravity",  glm::value_ptr(m_commonParam->gravity), 0.01f);
 
@@ -125,11 +181,135 @@ void Context::DrawUI()
     ImGui::End();
 }
 
+int32_t Context::StreamPoints(const int32_t* order, bool surfaceOnly)
+{
+    size_t count = surfaceOnly ? static_cast<size_t>(m_cellCuller->GetNumSurfacePoints()) : m_positions->size();
+    m_numStreamedPoints = count;
+    if (!m_pointStream || (m_pointStream->GetCapacity() < count))
+    {
+        // grow by half again : a scene adding particles reallocates rarely
+        size_t capacity = std::max(count + count / 2, size_t(1024));
+        m_pointVertexLayout = VertexLayout::Create();
+        m_pointStream = StreamBuffer::Create(GL_ARRAY_BUFFER, sizeof(glm::vec3), capacity);
+        if (!m_pointStream)
+            return -1;
+        m_pointVertexLayout->SetAttrib(0, 3, GL_FLOAT, false, sizeof(glm::vec3), 0);
+    }
+
+    auto region = static_cast<glm::vec3*>(m_pointStream->BeginWrite(count));
+    if (!region)
+        return -1;
+    const glm::vec3* positions = m_positions->data();
+    if (surfaceOnly)
+        m_cellCuller->CopySurfacePoints(region);
+    else if (order)
+        HostWorkers::Get().RunChunks(count, [&](int32_t, int64_t begin, int64_t end) {
+            for (int64_t idx = begin; idx < end; ++idx)
+                region[idx] = positions[order[idx]];
+        });
+    else
+        HostWorkers::Get().RunChunks(count, [&](int32_t, int64_t begin, int64_t end) {
+            memcpy(region + begin, positions + begin, (end - begin) * sizeof(glm::vec3));
+        });
+    return m_pointStream->EndWrite();
+}
+
+int32_t Context::StreamSplats()
+{
+    const std::vector<glm::vec4>& splats = m_cellCuller->GetSplats();
+    if (splats.empty())
+        return -1;
+    if (!m_splatStream || (m_splatStream->GetCapacity() < splats.size()))
+    {
+        size_t capacity = std::max(splats.size() + splats.size() / 2, size_t(1024));
+        m_splatVertexLayout = VertexLayout::Create();
+        m_splatStream = StreamBuffer::Create(GL_ARRAY_BUFFER, sizeof(glm::vec4), capacity);
+        if (!m_splatStream)
+            return -1;
+        m_splatVertexLayout->SetAttrib(0, 4, GL_FLOAT, false, sizeof(glm::vec4), 0);
+    }
+
+    auto region = m_splatStream->BeginWrite(splats.size());
+    if (!region)
+        return -1;
+    memcpy(region, splats.data(), splats.size() * sizeof(glm::vec4));
+    return m_splatStream->EndWrite();
+}
+
+void Context::DrawPoints(int32_t firstPoint, int32_t firstSplat, bool thickness)
+{
+    if (firstPoint >= 0)
+    {
+        m_pointVertexLayout->Bind();
+        if (!m_cellCulling || m_drawSurfaceOnly)
+            glDrawArrays(GL_POINTS, firstPoint, static_cast<GLsizei>(m_numStreamedPoints));
+        else if (!m_drawFirsts.empty())
+            glMultiDrawArrays(GL_POINTS, m_drawFirsts.data(), m_cellCuller->GetCounts().data(),
+                              static_cast<GLsizei>(m_drawFirsts.size()));
+    }
+    // the interior proxies after the distant cells only add thickness
+    GLsizei numSplats = thickness ? static_cast<GLsizei>(m_cellCuller->GetSplats().size()) : m_cellCuller->GetNumLodSplats();
+    if ((firstSplat >= 0) && (numSplats > 0))
+    {
+        m_splatVertexLayout->Bind();
+        glDrawArrays(GL_POINTS, firstSplat, numSplats);
+    }
+}
+
+void Context::CreateFluidFramebuffers()
+{
+    m_fluidWidth = std::max(m_width / m_fluidDownsample, 1);
+    m_fluidHeight = std::max(m_height / m_fluidDownsample, 1);
+    m_framebuffer = Framebuffer::Create(
+        Texture::Create(m_fluidWidth, m_fluidHeight, GL_RGBA),
+        Texture::Create(m_fluidWidth, m_fluidHeight, GL_DEPTH_COMPONENT));
+    for (auto &framebuffer : m_depthFilterFramebuffers)
+        framebuffer = Framebuffer::Create(Texture::Create(m_fluidWidth, m_fluidHeight, GL_R32F));
+}
+
+const Texture* Context::FilterFluidDepth(const glm::mat4 &proj, float pointScale)
+{
+    const Texture* depth = m_framebuffer->GetDepthAttachment().get();
+    if (m_depthFilter == 0)
+        return depth;
+
+    float particleRadius = m_particleSizeRatio * m_commonParam->radius;
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    m_fluidDepthFilterProgram->Use();
+    m_fluidDepthFilterProgram->SetUniform("transform",
+                                          glm::scale(glm::mat4(1.0f), glm::vec3(2.0f, 2.0f, 1.0f)));
+    m_fluidDepthFilterProgram->SetUniform("projTransform", proj);
+    m_fluidDepthFilterProgram->SetUniform("filterRadius", m_depthFilterRadius * particleRadius);
+    m_fluidDepthFilterProgram->SetUniform("pointScale", pointScale);
+    m_fluidDepthFilterProgram->SetUniform("maxHalfWidth", 32 / m_fluidDownsample);
+    m_fluidDepthFilterProgram->SetUniform("depthRange", m_depthFilterRange * particleRadius);
+    m_fluidDepthFilterProgram->SetUniform("narrowRange", (m_depthFilter == 2) ? 1 : 0);
+    m_fluidDepthFilterProgram->SetUniform("texDepth", 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    // horizontal into the first target, vertical back into the second
+    for (int iteration = 0; iteration < m_depthFilterIterations; ++iteration)
+    {
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            m_depthFilterFramebuffers[axis]->Bind();
+            depth->Bind();
+            m_fluidDepthFilterProgram->SetUniform("direction", (axis == 0) ? glm::vec2(1.0f, 0.0f) : glm::vec2(0.0f, 1.0f));
+            m_plane->Draw(m_fluidDepthFilterProgram.get());
+            depth = m_depthFilterFramebuffers[axis]->GetColorAttachment().get();
+        }
+    }
+    return depth;
+}
+
 void Context::Render()
 {
-    DrawUI();
+    if (m_drawUI)
+        DrawUI();
 
     m_framebuffer->Bind();
+    glViewport(0, 0, m_fluidWidth, m_fluidHeight);
 
     // opengl - intialize frame
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -145,18 +325,38 @@ void Context::Render()
         glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
     auto view = glm::lookAt(m_cameraPos, m_cameraPos + m_cameraFront, m_cameraUp);
     auto proj = glm::perspective(glm::radians(fov), aspect, 0.01f, 10.0f);
+    // sphere sprites are sized in the pixels of the fluid targets
+    float pointScale = (float)m_fluidHeight * (1.0f / glm::tan(glm::radians(fov*0.5f)));
     
     // Light Settings
     glm::vec3 lightPos = m_light.position;
     glm::vec3 lightDir = (m_commonParam->AnalysisBox.minPoint + m_commonParam->AnalysisBox.maxPoint)*0.5f - m_light.position;
 
-    // Point Vertex Buffer 
-    // TODO Modulization
-    auto pointVertexLayout = VertexLayout::Create();
-    auto pointVertexBuffer = Buffer::CreateWithData(
-        GL_ARRAY_BUFFER, GL_STATIC_DRAW,
-        m_positions->data(), sizeof(glm::vec3), m_positions->size());
-    pointVertexLayout->SetAttrib(0, 3, GL_FLOAT, false, sizeof(glm::vec3), 0);
+    // Visible cells : ranges of the particles, splats for the distant cells,
+    // walked in the solver's grid order and with its surface flags while they match the particles
+    float pointRadius = m_particleSizeRatio*m_commonParam->radius;
+    const int32_t* order = (m_gridOrder->size() == m_positions->size()) ? m_gridOrder->data() : nullptr;
+    const int32_t* cells = (order && (m_gridCells->size() == m_positions->size())) ? m_gridCells->data() : nullptr;
+    m_drawSurfaceOnly = m_cellCulling && m_surfaceOnly && order && (m_surfaceFlags->size() == m_positions->size());
+    // the solver only classifies the surface while it is drawn alone
+    m_commonParam->classifySurface = m_cellCulling && m_surfaceOnly;
+    if (m_cellCulling)
+        m_cellCuller->Update(m_positions->data(), order, cells, m_drawSurfaceOnly ? m_surfaceFlags->data() : nullptr,
+                             m_positions->size(), proj*view, m_cameraPos,
+                             pointRadius, pointScale, m_lodPointSize);
+
+    // Point Vertex Stream : both passes draw the same regions
+    int32_t firstPoint = StreamPoints(order, m_drawSurfaceOnly);
+    if (firstPoint < 0)
+        SPDLOG_ERROR("failed to stream {} particles", m_positions->size());
+    int32_t firstSplat = m_cellCulling ? StreamSplats() : -1;
+    if (m_cellCulling && !m_drawSurfaceOnly && (firstPoint >= 0))
+    {
+        const std::vector<GLint>& firsts = m_cellCuller->GetFirsts();
+        m_drawFirsts.resize(firsts.size());
+        for (size_t rr = 0; rr < firsts.size(); ++rr)
+            m_drawFirsts[rr] = firstPoint + firsts[rr];
+    }
 
     {
         glEnable(GL_BLEND);
@@ -170,10 +370,9 @@ void Context::Render()
         m_fluidThicknessProgram->Use(); 
         m_fluidThicknessProgram->SetUniform("transform", proj*view);
         m_fluidThicknessProgram->SetUniform("viewTransform", view);
-        m_fluidThicknessProgram->SetUniform("pointRadius", m_particleSizeRatio*m_commonParam->radius);
-        m_fluidThicknessProgram->SetUniform("pointScale", (float)m_width/aspect * (1.0f / glm::tan(glm::radians(fov*0.5f))));
-        //pointVertexLayout->Bind();
-        glDrawArrays(GL_POINTS, 0, m_positions->size());
+        m_fluidThicknessProgram->SetUniform("pointRadius", pointRadius);
+        m_fluidThicknessProgram->SetUniform("pointScale", pointScale);
+        DrawPoints(firstPoint, firstSplat, true);
 
 
         glDepthMask(GL_TRUE);
@@ -193,15 +392,25 @@ void Context::Render()
         m_fluidDepthProgram->SetUniform("transform", proj*view);
         m_fluidDepthProgram->SetUniform("projTransform", proj);
         m_fluidDepthProgram->SetUniform("viewTransform", view);
-        m_fluidDepthProgram->SetUniform("pointRadius", m_particleSizeRatio*m_commonParam->radius);
-        m_fluidDepthProgram->SetUniform("pointScale", (float)m_width/aspect * (1.0f / glm::tan(glm::radians(fov*0.5f))));
-        //pointVertexLayout->Bind();
-        glDrawArrays(GL_POINTS, 0, m_positions->size());
+        m_fluidDepthProgram->SetUniform("pointRadius", pointRadius);
+        m_fluidDepthProgram->SetUniform("pointScale", pointScale);
+        DrawPoints(firstPoint, firstSplat, false);
 
 		glDisable(GL_PROGRAM_POINT_SIZE);
     }
-
-    Framebuffer::BindToDefault();
+    // the regions are written again three frames later, once these draws are done
+    if (firstPoint >= 0)
+        m_pointStream->Fence();
+    if (firstSplat >= 0)
+        m_splatStream->Fence();
+
+    const Texture* fluidDepth = FilterFluidDepth(proj, pointScale);
+
+    if (m_outputFramebuffer)
+        m_outputFramebuffer->Bind();
+    else
+        Framebuffer::BindToDefault();
+    glViewport(0, 0, m_width, m_height);
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_BLEND);
 
@@ -219,6 +428,8 @@ void Context::Render()
     m_fluidRenderProgram->SetUniform("iProjTransform", glm::inverse(proj));
     m_fluidRenderProgram->SetUniform("iViewTransform", glm::inverse(view));
     m_fluidRenderProgram->SetUniform("viewTransform", view);
+    m_fluidRenderProgram->SetUniform("projTransform", proj);
+    m_fluidRenderProgram->SetUniform("depthRange", m_depthFilterRange * m_particleSizeRatio * m_commonParam->radius);
 
     m_fluidRenderProgram->SetUniform("light.position", lightPos);
     m_fluidRenderProgram->SetUniform("light.direction", lightDir);
@@ -234,7 +445,7 @@ void Context::Render()
     m_fluidRenderProgram->SetUniform("tex", 0);
 
     glActiveTexture(GL_TEXTURE1);
-    m_framebuffer->GetDepthAttachment()->Bind();
+    fluidDepth->Bind();
     m_fluidRenderProgram->SetUniform("texDepth", 1);
     
     m_plane->Draw(m_fluidRenderProgram.get());
@@ -312,8 +523,9 @@ void Context::Reshape(int width, int height)
     m_height = height;
     glViewport(0, 0, m_width, m_height);
 
-    m_framebuffer = Framebuffer::Create(
-        Texture::Create(width, height, GL_RGBA), Texture::Create(width, height, GL_DEPTH_COMPONENT));
+    CreateFluidFramebuffers();
+    if (m_offscreen)
+        m_outputFramebuffer = Framebuffer::Create(Texture::Create(width, height, GL_RGBA));
 }
 
 void Context::PressKey(int key, int scancode, int action, int mods)
@@ -7,6 +7,8 @@
 #include "framebuffer.h"
 #include "simbuffer.h"
 #include "buffer.h"
+#include "stream_buffer.h"
+#include "cell_culler.h"
 #include "vertex_layout.h"
 #include "texture.h"
 #include "mesh.h"
@@ -29,15 +31,34 @@ public:
     void Reshape(int width, int height);
     void PressKey(int key, int scancode, int action, int mods);
 
+    // render into an own framebuffer instead of the window, set before Reshape
+    void SetOffscreen(bool offscreen) { m_offscreen = offscreen; }
+    const Framebuffer* GetOutputFramebuffer() const { return m_outputFramebuffer.get(); }
+
     // animation
     int32_t m_selectedScene {0};
     bool m_reloadScene {false};
+    bool m_useStateCache {true};
+    bool m_drawUI {true}; // false without imgui, as in headless runs
+    int32_t m_precisionOverride {0}; // 0 : scene default, else Precision + 1
+    float m_adaptiveDt {0.0f}; // next time step of the adaptive controller, shown with adaptiveDt
     std::vector<const char*> m_sceneList;
 
 private:
     Context() {};
     void DrawUI();
     bool Init();
+    // copy the particle positions into the next region of the point stream, returns its first vertex :
+    // in grid order when order is given, only the visible surface particles when surfaceOnly
+    int32_t StreamPoints(const int32_t* order, bool surfaceOnly);
+    // copy the splats of the distant cells into the splat stream, returns their first vertex or -1 without any
+    int32_t StreamSplats();
+    // the visible particles and splats, the thickness pass also draws the interior proxies
+    void DrawPoints(int32_t firstPoint, int32_t firstSplat, bool thickness);
+    // thickness, depth and depth filter targets at 1 / m_fluidDownsample of the output size
+    void CreateFluidFramebuffers();
+    // smooth the fluid depth with separable passes, returns the texture holding the result
+    const Texture* FilterFluidDepth(const glm::mat4 &proj, float pointScale);
     ProgramUPtr m_program;
     ProgramUPtr m_simpleProgram;
     //ProgramUPtr m_simpleLightingProgram;
@@ -48,6 +69,7 @@ private:
     ProgramUPtr m_fluidDepthProgram;
     ProgramUPtr m_fluidThicknessProgram;
     ProgramUPtr m_fluidRenderProgram;
+    ProgramUPtr m_fluidDepthFilterProgram;
 
     MeshUPtr m_sphere;
     MeshUPtr m_plane;
@@ -100,6 +122,35 @@ private:
 
     // framebuffer
     FramebufferUPtr m_framebuffer;
+    bool m_offscreen {false};
+    FramebufferUPtr m_outputFramebuffer; // final image when offscreen
+
+    // screen space fluid : thickness and depth rendered at 1 / m_fluidDownsample of the output,
+    // the depth smoothed by m_depthFilterIterations horizontal and vertical passes
+    int m_fluidDownsample {1};          // 1, 2 or 4
+    int m_fluidWidth {WINDOW_WIDTH};
+    int m_fluidHeight {WINDOW_HEIGHT};
+    int m_depthFilter {1};              // 0 : off, 1 : bilateral, 2 : narrow range
+    int m_depthFilterIterations {1};
+    float m_depthFilterRadius {2.0f};   // in particle radii
+    float m_depthFilterRange {2.0f};    // distance between surfaces, in particle radii
+    FramebufferUPtr m_depthFilterFramebuffers[2];
+
+    // particle positions, streamed every frame and drawn by the thickness and depth passes
+    VertexLayoutUPtr m_pointVertexLayout;
+    StreamBufferUPtr m_pointStream;
+
+    // cells culled against the view frustum, those with particles under m_lodPointSize pixels drawn as one splat
+    bool m_cellCulling {true};
+    float m_lodPointSize {1.0f};    // 0 : no splats
+    CellCullerUPtr m_cellCuller;
+    std::vector<GLint> m_drawFirsts; // ranges of the visible particles in the point stream
+    VertexLayoutUPtr m_splatVertexLayout;
+    StreamBufferUPtr m_splatStream;
+    size_t m_numStreamedPoints {0};
+    // only the particles flagged by the solver near the surface, a proxy per cell for the interior thickness
+    bool m_surfaceOnly {true};
+    bool m_drawSurfaceOnly {false}; // this frame : culling on and the surface flags match the particles
 
     // Particle Size
     float m_particleSizeRatio {1.0f};
@@ -110,9 +161,12 @@ private:
     float m_maxLegend {1.0f};
     
     // std::shared_ptr<std::vector<glm::vec3>> m_positions; 
-    std::vector<glm::vec3> * m_positions;
-    std::vector<float> * m_colors;
+    ParticleArray<glm::vec3> * m_positions;
+    ParticleArray<float> * m_colors;
     CommonParameters * m_commonParam;
+    ParticleArray<int32_t> * m_gridOrder;
+    ParticleArray<uint8_t> * m_surfaceFlags;
+    ParticleArray<int32_t> * m_gridCells;
 
     int m_width {WINDOW_WIDTH};
     int m_height {WINDOW_HEIGHT};
@@ -0,0 +1,272 @@
+#include "decomposition.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+// what a rank needs to simulate a particle of another rank
+struct ParticleRecord {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    int32_t phase;
+    float invMass;
+};
+
+static std::vector<uint8_t> PackParticles(const SimBufferPtr simBuffer, const std::vector<int32_t> &ids)
+{
+    std::vector<uint8_t> message(ids.size() * sizeof(ParticleRecord));
+    ParticleRecord *records = reinterpret_cast<ParticleRecord *>(message.data());
+    for (size_t ii = 0; ii < ids.size(); ++ii)
+    {
+        records[ii].position = simBuffer->m_positions[ids[ii]];
+        records[ii].velocity = simBuffer->m_velocities[ids[ii]];
+        records[ii].phase    = simBuffer->m_phases[ids[ii]];
+        records[ii].invMass  = simBuffer->m_invMasses[ids[ii]];
+    }
+    return message;
+}
+
+static void AppendParticles(SimBufferPtr simBuffer, const std::vector<uint8_t> &message, bool ghosts)
+{
+    size_t count = message.size() / sizeof(ParticleRecord);
+    const ParticleRecord *records = reinterpret_cast<const ParticleRecord *>(message.data());
+    for (size_t ii = 0; ii < count; ++ii)
+    {
+        simBuffer->m_positions.push_back(records[ii].position);
+        simBuffer->m_velocities.push_back(records[ii].velocity);
+        simBuffer->m_phases.push_back(records[ii].phase);
+        simBuffer->m_colorValues.push_back(0.0f);
+        simBuffer->m_invMasses.push_back(ghosts ? 0.0f : records[ii].invMass);
+    }
+}
+
+// keep the particles listed in ids, in that order
+static void KeepParticles(SimBufferPtr simBuffer, const std::vector<int32_t> &ids)
+{
+    for (size_t ii = 0; ii < ids.size(); ++ii)
+    {
+        simBuffer->m_positions[ii]   = simBuffer->m_positions[ids[ii]];
+        simBuffer->m_velocities[ii]  = simBuffer->m_velocities[ids[ii]];
+        simBuffer->m_phases[ii]      = simBuffer->m_phases[ids[ii]];
+        simBuffer->m_colorValues[ii] = simBuffer->m_colorValues[ids[ii]];
+        simBuffer->m_invMasses[ii]   = simBuffer->m_invMasses[ids[ii]];
+    }
+    simBuffer->m_positions.resize(ids.size());
+    simBuffer->m_velocities.resize(ids.size());
+    simBuffer->m_phases.resize(ids.size());
+    simBuffer->m_colorValues.resize(ids.size());
+    simBuffer->m_invMasses.resize(ids.size());
+
+    // no longer the solver's order : the renderer takes the particles as they are until the next GetMemory
+    simBuffer->m_gridOrder.clear();
+    simBuffer->m_surfaceFlags.clear();
+    simBuffer->m_gridCells.clear();
+}
+
+DomainDecompositionUPtr DomainDecomposition::Create(TransportUPtr transport)
+{
+    auto decomposition = DomainDecompositionUPtr(new DomainDecomposition());
+    if (!decomposition->Init(std::move(transport)))
+        return nullptr;
+    return std::move(decomposition);
+}
+
+bool DomainDecomposition::Init(TransportUPtr transport)
+{
+    if (!transport)
+        return false;
+    m_transport = std::move(transport);
+    return true;
+}
+
+void DomainDecomposition::SetSlabs(const CommonParameters &commonParam)
+{
+    glm::vec3 extent = commonParam.AnalysisBox.maxPoint - commonParam.AnalysisBox.minPoint;
+    m_axis = 0;
+    if (extent.y > extent[m_axis]) m_axis = 1;
+    if (extent.z > extent[m_axis]) m_axis = 2;
+    m_slabOrigin = commonParam.AnalysisBox.minPoint[m_axis];
+    m_slabWidth  = extent[m_axis] / static_cast<float>(Size());
+
+    // twice the kernel support : the multipliers of the inner ghosts see all their neighbors
+    m_haloWidth = commonParam.radius * 1.2f * 2.0f * 2.0f;
+    if (m_haloWidth > m_slabWidth)
+        SPDLOG_WARN("halo {} is wider than a slab {} : use fewer ranks", m_haloWidth, m_slabWidth);
+}
+
+int32_t DomainDecomposition::OwnerOf(const glm::vec3 &position) const
+{
+    int32_t slab = static_cast<int32_t>(floorf((position[m_axis] - m_slabOrigin) / m_slabWidth));
+    return std::clamp(slab, 0, Size() - 1);
+}
+
+bool DomainDecomposition::Distribute(SimBufferPtr simBuffer)
+{
+    if (simBuffer->GetNumClothConstraints() > 0)
+    {
+        SPDLOG_ERROR("domain decomposition supports fluid scenes only");
+        return false;
+    }
+
+    SetSlabs(simBuffer->m_commonParam);
+    simBuffer->m_colorValues.resize(simBuffer->GetNumParticles(), 0.0f);
+    simBuffer->ApplyFixedConstraints();
+
+    std::vector<int32_t> owned;
+    for (int32_t idx = 0; idx < simBuffer->GetNumParticles(); ++idx)
+        if (OwnerOf(simBuffer->m_positions[idx]) == Rank())
+            owned.push_back(idx);
+    KeepParticles(simBuffer, owned);
+    m_numOwned = simBuffer->GetNumParticles();
+
+    SPDLOG_INFO("rank {} owns {} particles, slab axis {} [{}, {})", Rank(), m_numOwned, m_axis,
+                m_slabOrigin + Rank() * m_slabWidth, m_slabOrigin + (Rank() + 1) * m_slabWidth);
+    return true;
+}
+
+bool DomainDecomposition::Exchange(SimBufferPtr simBuffer)
+{
+    // drop the ghosts of the previous exchange : they follow the owned particles
+    std::vector<int32_t> owned(m_numOwned);
+    std::iota(owned.begin(), owned.end(), 0);
+    KeepParticles(simBuffer, owned);
+
+    // migrate : a particle that left the slab goes to the neighbor on that side
+    std::vector<int32_t> staying, toLower, toUpper;
+    for (int32_t idx = 0; idx < m_numOwned; ++idx)
+    {
+        int32_t owner = OwnerOf(simBuffer->m_positions[idx]);
+        if (owner < Rank())         toLower.push_back(idx);
+        else if (owner > Rank())    toUpper.push_back(idx);
+        else                        staying.push_back(idx);
+    }
+    std::vector<uint8_t> lowerMessage = PackParticles(simBuffer, toLower);
+    std::vector<uint8_t> upperMessage = PackParticles(simBuffer, toUpper);
+    KeepParticles(simBuffer, staying);
+    if (!ExchangeWithNeighbors(simBuffer, lowerMessage, upperMessage, false))
+        return false;
+    m_numOwned = simBuffer->GetNumParticles();
+
+    // ghosts : owned particles within the halo of a slab boundary
+    float lowerBound = m_slabOrigin + Rank() * m_slabWidth;
+    float upperBound = lowerBound + m_slabWidth;
+    toLower.clear();
+    toUpper.clear();
+    for (int32_t idx = 0; idx < m_numOwned; ++idx)
+    {
+        float coordinate = simBuffer->m_positions[idx][m_axis];
+        if ((Rank() > 0) && (coordinate < lowerBound + m_haloWidth))
+            toLower.push_back(idx);
+        if ((Rank() < Size() - 1) && (coordinate > upperBound - m_haloWidth))
+            toUpper.push_back(idx);
+    }
+    m_boundaryIDs = toLower;
+    m_boundaryIDs.insert(m_boundaryIDs.end(), toUpper.begin(), toUpper.end());
+    m_numBoundaryLower = static_cast<int32_t>(toLower.size());
+    return ExchangeWithNeighbors(simBuffer, PackParticles(simBuffer, toLower), PackParticles(simBuffer, toUpper), true,
+                                 &m_numGhostsLower);
+}
+
+bool DomainDecomposition::ExchangeWithNeighbors(SimBufferPtr simBuffer, const std::vector<uint8_t> &lowerMessage,
+                                                const std::vector<uint8_t> &upperMessage, bool ghosts, int32_t *numFromLower)
+{
+    std::vector<uint8_t> received;
+    if (numFromLower)
+        *numFromLower = 0;
+    if (Rank() > 0)
+    {
+        if (!m_transport->Exchange(Rank() - 1, lowerMessage, received))
+            return false;
+        AppendParticles(simBuffer, received, ghosts);
+        if (numFromLower)
+            *numFromLower = static_cast<int32_t>(received.size() / sizeof(ParticleRecord));
+    }
+    if (Rank() < Size() - 1)
+    {
+        if (!m_transport->Exchange(Rank() + 1, upperMessage, received))
+            return false;
+        AppendParticles(simBuffer, received, ghosts);
+    }
+    return true;
+}
+
+// the particles [first, first + count) of a halo state as one message : the arrays one after another
+static std::vector<uint8_t> PackHalo(const HaloState &state, size_t first, size_t count)
+{
+    std::vector<uint8_t> message(count * state.RecordSize());
+    uint8_t *data = message.data();
+    memcpy(data, state.positions.data() + first, count * sizeof(glm::vec3));
+    data += count * sizeof(glm::vec3);
+    memcpy(data, state.velocities.data() + first, count * sizeof(glm::vec3));
+    data += count * sizeof(glm::vec3);
+    memcpy(data, state.correctedPos.data() + first, count * sizeof(glm::vec3));
+    data += count * sizeof(glm::vec3);
+    memcpy(data, state.lambdas.data() + first * state.lambdaSize, count * state.lambdaSize);
+    return message;
+}
+
+static bool UnpackHalo(const std::vector<uint8_t> &message, HaloState &state, size_t first, size_t count)
+{
+    if (message.size() != count * state.RecordSize())
+        return false;
+    const uint8_t *data = message.data();
+    memcpy(state.positions.data() + first, data, count * sizeof(glm::vec3));
+    data += count * sizeof(glm::vec3);
+    memcpy(state.velocities.data() + first, data, count * sizeof(glm::vec3));
+    data += count * sizeof(glm::vec3);
+    memcpy(state.correctedPos.data() + first, data, count * sizeof(glm::vec3));
+    data += count * sizeof(glm::vec3);
+    memcpy(state.lambdas.data() + first * state.lambdaSize, data, count * state.lambdaSize);
+    return true;
+}
+
+bool DomainDecomposition::ExchangeHalo(const HaloState &boundary, HaloState &ghosts)
+{
+    // same neighbors and the same order as the ghosts were gathered in : the counts match on both sides
+    size_t numGhostsLower = m_numGhostsLower;
+    size_t numGhostsUpper = ghosts.Size() - numGhostsLower;
+    std::vector<uint8_t> received;
+    if (Rank() > 0)
+    {
+        if (!m_transport->Exchange(Rank() - 1, PackHalo(boundary, 0, m_numBoundaryLower), received) ||
+            !UnpackHalo(received, ghosts, 0, numGhostsLower))
+        {
+            SPDLOG_ERROR("halo exchange with rank {} failed", Rank() - 1);
+            return false;
+        }
+    }
+    if (Rank() < Size() - 1)
+    {
+        if (!m_transport->Exchange(Rank() + 1, PackHalo(boundary, m_numBoundaryLower, boundary.Size() - m_numBoundaryLower), received) ||
+            !UnpackHalo(received, ghosts, numGhostsLower, numGhostsUpper))
+        {
+            SPDLOG_ERROR("halo exchange with rank {} failed", Rank() + 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DomainDecomposition::AgreeOnDt(float &dt)
+{
+    // the smallest proposal travels one rank further every round
+    for (int32_t round = 1; round < Size(); ++round)
+    {
+        std::vector<uint8_t> message(sizeof(float));
+        memcpy(message.data(), &dt, sizeof(float));
+        std::vector<uint8_t> received;
+        for (int32_t peer : { Rank() - 1, Rank() + 1 })
+        {
+            if ((peer < 0) || (peer >= Size()))
+                continue;
+            if (!m_transport->Exchange(peer, message, received) || (received.size() != sizeof(float)))
+            {
+                SPDLOG_ERROR("time step agreement with rank {} failed", peer);
+                return false;
+            }
+            float peerDt;
+            memcpy(&peerDt, received.data(), sizeof(float));
+            dt = std::min(dt, peerDt);
+        }
+    }
+    return true;
+}
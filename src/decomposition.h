@@ -0,0 +1,55 @@
+#ifndef __DECOMPOSITION_H__
+#define __DECOMPOSITION_H__
+
+#include "common.h"
+#include "simbuffer.h"
+#include "transport.h"
+#include "halo.h"
+
+// Slab decomposition of the AnalysisBox along its longest axis, one slab per rank.
+// A rank simulates the particles it owns followed by ghost particles : copies of the
+// neighbor slabs' particles within the halo, pinned (inverse mass 0) so the solver
+// only uses them as neighbors. The solver refreshes them from their owners before every
+// iteration through ExchangeHalo. Once per frame, Exchange drops the ghosts, migrates particles
+// that left the slab and gathers fresh ghosts. Fluid only : cloth constraints can't span ranks yet.
+CLASS_PTR(DomainDecomposition)
+class DomainDecomposition : public HaloExchange
+{
+public:
+    static DomainDecompositionUPtr Create(TransportUPtr transport);
+
+    int32_t Rank() const { return m_transport->Rank(); }
+    int32_t Size() const { return m_transport->Size(); }
+    int32_t GetNumOwned() const override { return m_numOwned; }
+    int32_t OwnerOf(const glm::vec3 &position) const;
+
+    // keep the particles of this rank out of a fully generated scene
+    bool Distribute(SimBufferPtr simBuffer);
+    bool Exchange(SimBufferPtr simBuffer);
+
+    const std::vector<int32_t> &GetBoundaryIDs() const override { return m_boundaryIDs; }
+    bool ExchangeHalo(const HaloState &boundary, HaloState &ghosts) override;
+    bool AgreeOnDt(float &dt) override;
+
+private:
+    DomainDecomposition() {}
+    bool Init(TransportUPtr transport);
+    void SetSlabs(const CommonParameters &commonParam);
+    bool ExchangeWithNeighbors(SimBufferPtr simBuffer, const std::vector<uint8_t> &lowerMessage,
+                               const std::vector<uint8_t> &upperMessage, bool ghosts, int32_t *numFromLower = nullptr);
+
+    TransportUPtr m_transport;
+    int32_t m_axis {0};
+    float m_slabOrigin {0.0f};
+    float m_slabWidth {1.0f};
+    float m_haloWidth {0.0f};
+    int32_t m_numOwned {0};
+
+    // since the last Exchange : the boundary particles sent to the lower neighbor then to the upper one,
+    // and the ghosts received from the lower neighbor, which come first
+    std::vector<int32_t> m_boundaryIDs;
+    int32_t m_numBoundaryLower {0};
+    int32_t m_numGhostsLower {0};
+};
+
+#endif // __DECOMPOSITION_H__
@@ -0,0 +1,159 @@
+#include "frame_recorder.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+
+FrameRecorderUPtr FrameRecorder::Create(const std::string &directory, int width, int height)
+{
+    auto recorder = FrameRecorderUPtr(new FrameRecorder());
+    if (!recorder->Init(directory, width, height))
+        return nullptr;
+    return std::move(recorder);
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    Finish();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_queued.notify_all();
+    for (std::thread &encoder : m_encoders)
+        encoder.join();
+    for (Readback &readback : m_readbacks)
+        if (readback.buffer)
+            glDeleteBuffers(1, &readback.buffer);
+}
+
+bool FrameRecorder::Init(const std::string &directory, int width, int height)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error)
+    {
+        SPDLOG_ERROR("failed to create frame directory {}: {}", directory, error.message());
+        return false;
+    }
+    m_directory = directory;
+    m_width = width;
+    m_height = height;
+
+    for (Readback &readback : m_readbacks)
+    {
+        glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size_t(m_width) * m_height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // a few threads : PNG deflate is slow, but the solver and the driver need the cores too
+    int32_t numEncoders = std::clamp(static_cast<int32_t>(std::thread::hardware_concurrency()) / 4, 1, 4);
+    for (int32_t e = 0; e < numEncoders; ++e)
+        m_encoders.emplace_back(&FrameRecorder::Encode, this);
+    SPDLOG_INFO("frame recorder : {} x {} to {}, {} encoders", m_width, m_height, m_directory, numEncoders);
+    return true;
+}
+
+bool FrameRecorder::Capture(const Framebuffer *framebuffer)
+{
+    int32_t slot = m_numCaptured % pixelBufferCount;
+    Collect(slot);
+
+    Readback &readback = m_readbacks[slot];
+    framebuffer->Bind();
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.frame = m_numCaptured++;
+    return true;
+}
+
+void FrameRecorder::Collect(int32_t slot)
+{
+    Readback &readback = m_readbacks[slot];
+    if (readback.frame < 0)
+        return;
+
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (true)
+    {
+        GLenum status = glClientWaitSync(readback.fence, flags, 1'000'000);
+        if ((status == GL_ALREADY_SIGNALED) || (status == GL_CONDITION_SATISFIED) || (status == GL_WAIT_FAILED))
+            break;
+        flags = 0;
+    }
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+
+    EncodeJob job;
+    job.frame = readback.frame;
+    readback.frame = -1;
+    size_t rowSize = size_t(m_width) * 4;
+    job.pixels.resize(rowSize * m_height);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    auto mapped = static_cast<const uint8_t *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, job.pixels.size(), GL_MAP_READ_BIT));
+    if (mapped)
+    {
+        // GL rows start at the bottom
+        for (int y = 0; y < m_height; ++y)
+            memcpy(job.pixels.data() + rowSize * y, mapped + rowSize * (m_height - 1 - y), rowSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!mapped)
+    {
+        SPDLOG_ERROR("failed to map the readback of frame {}", job.frame);
+        return;
+    }
+
+    // hold the renderer back rather than piling up frames when the encoders fall behind
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_dequeued.wait(lock, [this] { return m_jobs.size() < maxQueuedFrames; });
+    m_jobs.push_back(std::move(job));
+    m_queued.notify_one();
+}
+
+void FrameRecorder::Finish()
+{
+    for (int32_t k = 0; k < pixelBufferCount; ++k)
+        Collect((m_numCaptured + k) % pixelBufferCount);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_dequeued.wait(lock, [this] { return m_jobs.empty() && (m_encoding == 0); });
+}
+
+void FrameRecorder::Encode()
+{
+    while (true)
+    {
+        EncodeJob job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_queued.wait(lock, [this] { return m_quit || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            ++m_encoding;
+        }
+        m_dequeued.notify_all();
+
+        char name[32];
+        snprintf(name, sizeof(name), "/frame_%05d.png", job.frame);
+        std::string path = m_directory + name;
+        if (!stbi_write_png(path.c_str(), m_width, m_height, 4, job.pixels.data(), m_width * 4))
+            SPDLOG_ERROR("failed to write {}", path);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_encoding;
+        }
+        m_dequeued.notify_all();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef __FRAME_RECORDER_H__
+#define __FRAME_RECORDER_H__
+
+#include "common.h"
+#include "framebuffer.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Writes the color attachment of a framebuffer as <directory>/frame_00000.png, frame_00001.png ...
+// glReadPixels goes to a ring of pixel pack buffers, so it returns at once; a frame is mapped only
+// when its buffer comes round again, long after the copy finished. Encoding runs on own threads.
+CLASS_PTR(FrameRecorder)
+class FrameRecorder
+{
+public:
+    static FrameRecorderUPtr Create(const std::string &directory, int width, int height);
+    ~FrameRecorder();
+
+    int32_t GetNumCaptured() const { return m_numCaptured; }
+
+    // queue the readback of the current contents of framebuffer, same size as the recorder
+    bool Capture(const Framebuffer *framebuffer);
+    // read back the pending frames and wait until every PNG is written
+    void Finish();
+
+private:
+    FrameRecorder() {}
+    bool Init(const std::string &directory, int width, int height);
+    void Collect(int32_t slot);
+    void Encode();
+
+    static constexpr int32_t pixelBufferCount = 3;
+    static constexpr size_t maxQueuedFrames = 8;
+
+    struct Readback {
+        uint32_t buffer {0};
+        GLsync fence {nullptr};
+        int32_t frame {-1};     // -1 : nothing in flight
+    };
+    struct EncodeJob {
+        int32_t frame;
+        std::vector<uint8_t> pixels; // rows from the top
+    };
+
+    std::string m_directory;
+    int m_width {0};
+    int m_height {0};
+    int32_t m_numCaptured {0};
+    Readback m_readbacks[pixelBufferCount];
+
+    std::vector<std::thread> m_encoders;
+    std::mutex m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_dequeued;
+    std::deque<EncodeJob> m_jobs;
+    int32_t m_encoding {0};
+    bool m_quit {false};
+};
+
+#endif // __FRAME_RECORDER_H__
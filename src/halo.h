@@ -0,0 +1,39 @@
+#ifndef __HALO_H__
+#define __HALO_H__
+
+#include "common.h"
+
+// Solver state of the particles a halo exchange moves, in the order of the list they were gathered for.
+// The multipliers keep the storage of the solver precision, lambdaSize bytes each, their bits untouched.
+struct HaloState {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> velocities;
+    std::vector<glm::vec3> correctedPos;
+    std::vector<uint8_t> lambdas;
+    size_t lambdaSize {0};
+
+    size_t Size() const { return positions.size(); }
+    // bytes of one particle in a message
+    size_t RecordSize() const { return 3 * sizeof(glm::vec3) + lambdaSize; }
+};
+
+// Ghost particles of a scene split over several solver processes. Before every iteration the solver
+// reads back its boundary particles, hands them to ExchangeHalo and writes what comes back into
+// its ghost particles, whose SimBuffer IDs follow the owned ones. Every process takes the same steps.
+class HaloExchange
+{
+public:
+    virtual ~HaloExchange() = default;
+
+    // owned particles that are ghosts of the neighbors, by SimBuffer ID
+    virtual const std::vector<int32_t> &GetBoundaryIDs() const = 0;
+    virtual int32_t GetNumOwned() const = 0;
+
+    // ghosts is sized by the caller to its ghost particles, lambdaSize of both states set
+    virtual bool ExchangeHalo(const HaloState &boundary, HaloState &ghosts) = 0;
+
+    // dt becomes the smallest time step proposed by any process
+    virtual bool AgreeOnDt(float &dt) = 0;
+};
+
+#endif // __HALO_H__
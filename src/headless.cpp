@@ -0,0 +1,119 @@
+#include "headless.h"
+#ifdef HI_HAS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+
+// the surfaceless platform of Mesa needs no X or Wayland display, nor a GPU
+static EGLDisplay GetSurfacelessDisplay()
+{
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay)
+        return getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+#endif
+
+HeadlessContextUPtr HeadlessContext::Create()
+{
+    auto context = HeadlessContextUPtr(new HeadlessContext());
+    if (!context->Init())
+        return nullptr;
+    return std::move(context);
+}
+
+HeadlessContext::~HeadlessContext()
+{
+#ifdef HI_HAS_EGL
+    if (m_display)
+    {
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (m_context)
+            eglDestroyContext(m_display, m_context);
+        eglTerminate(m_display);
+    }
+#else
+    if (m_window)
+    {
+        glfwDestroyWindow(m_window);
+        glfwTerminate();
+    }
+#endif
+}
+
+void *HeadlessContext::GetProcAddress(const char *name)
+{
+#ifdef HI_HAS_EGL
+    return reinterpret_cast<void *>(eglGetProcAddress(name));
+#else
+    return reinterpret_cast<void *>(glfwGetProcAddress(name));
+#endif
+}
+
+bool HeadlessContext::Init()
+{
+#ifdef HI_HAS_EGL
+    EGLDisplay display = GetSurfacelessDisplay();
+    EGLint major = 0, minor = 0;
+    if ((display == EGL_NO_DISPLAY) || !eglInitialize(display, &major, &minor))
+    {
+        SPDLOG_ERROR("failed to initialize egl");
+        return false;
+    }
+    m_display = display;
+    SPDLOG_INFO("egl {}.{} : {}", major, minor, eglQueryString(display, EGL_VENDOR));
+
+    // the framebuffers are the render targets : no surface at all
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context") || !eglBindAPI(EGL_OPENGL_API))
+    {
+        SPDLOG_ERROR("egl has no surfaceless OpenGL context");
+        return false;
+    }
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || (numConfigs < 1))
+    {
+        SPDLOG_ERROR("no egl config for OpenGL");
+        return false;
+    }
+    EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    m_context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if ((m_context == EGL_NO_CONTEXT) || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context))
+    {
+        SPDLOG_ERROR("failed to create the headless OpenGL context");
+        return false;
+    }
+    return true;
+#else
+    if (!glfwInit())
+    {
+        SPDLOG_ERROR("failed to intialize glfw");
+        return false;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    m_window = glfwCreateWindow(16, 16, WINDOW_NAME, nullptr, nullptr);
+    if (!m_window)
+    {
+        SPDLOG_ERROR("failed to create the hidden glfw window");
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(m_window);
+    return true;
+#endif
+}
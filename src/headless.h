@@ -0,0 +1,28 @@
+#ifndef __HEADLESS_H__
+#define __HEADLESS_H__
+
+#include "common.h"
+
+// OpenGL context without a window, for rendering to framebuffers only.
+// With EGL it needs no display server : a surfaceless context of the GPU driver, or of Mesa's
+// software rasterizer on machines without one. Elsewhere it falls back to a hidden GLFW window.
+CLASS_PTR(HeadlessContext)
+class HeadlessContext
+{
+public:
+    static HeadlessContextUPtr Create();
+    ~HeadlessContext();
+
+    // loader of the GL functions for glad
+    static void *GetProcAddress(const char *name);
+
+private:
+    HeadlessContext() {}
+    bool Init();
+
+    void *m_display {nullptr};      // EGLDisplay
+    void *m_context {nullptr};      // EGLContext
+    GLFWwindow *m_window {nullptr}; // hidden window of the fallback
+};
+
+#endif // __HEADLESS_H__
@@ -0,0 +1,185 @@
+#include "hostworkers.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef _WIN32
+// (node, cpu) of every cpu of the first processor group
+static std::vector<std::pair<int32_t, int32_t>> AllowedCpus()
+{
+    std::vector<std::pair<int32_t, int32_t>> cpus;
+    int32_t numCpus = std::min<int32_t>(GetActiveProcessorCount(0), 64);
+    for (int32_t cpu = 0; cpu < numCpus; ++cpu)
+    {
+        UCHAR node = 0;
+        GetNumaProcessorNode(static_cast<UCHAR>(cpu), &node);
+        cpus.push_back({node == 0xFF ? 0 : node, cpu});
+    }
+    return cpus;
+}
+
+static bool PinThread(std::thread &thread, int32_t cpu)
+{
+    return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu) != 0;
+}
+#else
+// NUMA node of a cpu, 0 when the kernel doesn't expose the topology
+static int32_t NodeOfCpu(int32_t cpu)
+{
+    std::error_code error;
+    std::filesystem::directory_iterator entries(fmt::format("/sys/devices/system/cpu/cpu{}", cpu), error);
+    if (error)
+        return 0;
+    for (const auto &entry : entries)
+    {
+        std::string name = entry.path().filename().string();
+        if ((name.rfind("node", 0) == 0) && (name.size() > 4) && isdigit(name[4]))
+            return std::atoi(name.c_str() + 4);
+    }
+    return 0;
+}
+
+// (node, cpu) of every cpu this process may run on
+static std::vector<std::pair<int32_t, int32_t>> AllowedCpus()
+{
+    std::vector<std::pair<int32_t, int32_t>> cpus;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0)
+    {
+        for (int32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back({NodeOfCpu(cpu), cpu});
+    }
+    return cpus;
+}
+
+static bool PinThread(std::thread &thread, int32_t cpu)
+{
+    cpu_set_t core;
+    CPU_ZERO(&core);
+    CPU_SET(cpu, &core);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &core) == 0;
+}
+#endif
+
+HostWorkers &HostWorkers::Get()
+{
+    static HostWorkersUPtr workers = Create();
+    return *workers;
+}
+
+HostWorkersUPtr HostWorkers::Create()
+{
+    auto workers = HostWorkersUPtr(new HostWorkers());
+    workers->Init();
+    return std::move(workers);
+}
+
+void HostWorkers::Init()
+{
+    std::vector<std::pair<int32_t, int32_t>> cpus = AllowedCpus();
+    if (cpus.empty())
+        cpus.push_back({0, -1});
+
+    // workers of a node are consecutive, so a node owns one contiguous block of every range
+    std::stable_sort(cpus.begin(), cpus.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    m_numWorkers = static_cast<int32_t>(cpus.size());
+    for (int32_t worker = 0; worker < m_numWorkers; ++worker)
+    {
+        if ((worker == 0) || (cpus[worker].first != cpus[worker - 1].first))
+            m_nodeFirstWorker.push_back(worker);
+        m_workerNode.push_back(static_cast<int32_t>(m_nodeFirstWorker.size()) - 1);
+        m_threads.emplace_back(&HostWorkers::Loop, this, worker);
+        if ((cpus[worker].second >= 0) && !PinThread(m_threads.back(), cpus[worker].second))
+            SPDLOG_WARN("failed to pin host worker {} to cpu {}", worker, cpus[worker].second);
+    }
+    SPDLOG_INFO("host workers : {} threads on {} NUMA nodes", m_numWorkers, m_nodeFirstWorker.size());
+    m_nodeFirstWorker.push_back(m_numWorkers);
+}
+
+HostWorkers::~HostWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_start.notify_all();
+    for (auto &thread : m_threads)
+        thread.join();
+}
+
+void HostWorkers::Range(int64_t num, int32_t worker, int32_t numWorkers, int64_t &begin, int64_t &end)
+{
+    begin = num * worker / numWorkers;
+    end   = num * (worker + 1) / numWorkers;
+}
+
+void HostWorkers::Run(int64_t num, const Job &job)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_job = &job;
+    m_num = num;
+    m_pending = m_numWorkers;
+    ++m_generation;
+    m_start.notify_all();
+    m_done.wait(lock, [&] { return m_pending == 0; });
+    m_job = nullptr;
+}
+
+void HostWorkers::ChunkRange(int64_t num, int32_t worker, int64_t &begin, int64_t &end) const
+{
+    // the share of the node in whole chunks, as many as its workers
+    int32_t node = m_workerNode[worker];
+    int32_t firstWorker = m_nodeFirstWorker[node];
+    int32_t lastWorker = m_nodeFirstWorker[node + 1];
+    int64_t numChunks = (num + chunkSize - 1) / chunkSize;
+    int64_t shareBegin = std::min(numChunks * firstWorker / m_numWorkers * chunkSize, num);
+    int64_t shareEnd   = std::min(numChunks * lastWorker / m_numWorkers * chunkSize, num);
+
+    Range(shareEnd - shareBegin, worker - firstWorker, lastWorker - firstWorker, begin, end);
+    begin += shareBegin;
+    end   += shareBegin;
+}
+
+void HostWorkers::RunChunks(int64_t num, const Job &job)
+{
+    Run(m_numWorkers, [&](int32_t worker, int64_t, int64_t) {
+        int64_t begin, end;
+        ChunkRange(num, worker, begin, end);
+        if (begin < end)
+            job(worker, begin, end);
+    });
+}
+
+void HostWorkers::Loop(int32_t worker)
+{
+    uint64_t generation = 0;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_start.wait(lock, [&] { return m_quit || (m_generation != generation); });
+        if (m_quit)
+            return;
+        generation = m_generation;
+        const Job *job = m_job;
+        int64_t num = m_num;
+        lock.unlock();
+
+        int64_t begin, end;
+        Range(num, worker, m_numWorkers, begin, end);
+        if (begin < end)
+            (*job)(worker, begin, end);
+
+        lock.lock();
+        if (--m_pending == 0)
+            m_done.notify_one();
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef __HOSTWORKERS_H__
+#define __HOSTWORKERS_H__
+
+#include "common.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Host threads pinned one per core, the cores of a NUMA node next to each other.
+// Run splits [0, num) into one contiguous range per worker.
+// RunChunks is the partition of every pass over the particle arrays : each NUMA node owns one
+// contiguous share of [0, num) in whole chunks, split among the workers of the node. The pages a
+// worker writes first stay on its node (first-touch), and the later passes over the same elements
+// read local memory. Counts below a chunk per node land on the last nodes.
+CLASS_PTR(HostWorkers)
+class HostWorkers
+{
+public:
+    using Job = std::function<void(int32_t worker, int64_t begin, int64_t end)>;
+
+    static HostWorkers &Get();
+    ~HostWorkers();
+
+    int32_t Size() const { return m_numWorkers; }
+    static void Range(int64_t num, int32_t worker, int32_t numWorkers, int64_t &begin, int64_t &end);
+
+    // job on every non-empty range of [0, num), returns when all workers are done
+    void Run(int64_t num, const Job &job);
+
+    // elements of one chunk, a few pages of any particle array
+    static constexpr int64_t chunkSize = 1024;
+
+    // range of a worker in the particle partition of [0, num)
+    void ChunkRange(int64_t num, int32_t worker, int64_t &begin, int64_t &end) const;
+
+    // job on every non-empty range of the particle partition of [0, num), returns when all workers are done
+    void RunChunks(int64_t num, const Job &job);
+
+private:
+    HostWorkers() {}
+    static HostWorkersUPtr Create();
+    void Init();
+    void Loop(int32_t worker);
+
+    int32_t m_numWorkers {0};
+    std::vector<int32_t> m_workerNode;      // node of every worker, nodes counted from 0
+    std::vector<int32_t> m_nodeFirstWorker; // first worker of every node, Size() at the end
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    const Job *m_job {nullptr};
+    int64_t m_num {0};
+    uint64_t m_generation {0};
+    int32_t m_pending {0};
+    bool m_quit {false};
+};
+
+#endif // __HOSTWORKERS_H__
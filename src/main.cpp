@@ -1,5 +1,11 @@
 #include "context.h"
 #include "simbuffer.h"
+#include "statecache.h"
+#include "decomposition.h"
+#include "sdf.h"
+#include "bvh.h"
+#include "headless.h"
+#include "frame_recorder.h"
 #include "HiPhysics/hiphysics.h"
 #include <vector>
 #include <spdlog/spdlog.h>
@@ -20,6 +26,8 @@ GLFWwindow*         g_window = nullptr;
 ContextUPtr         g_context = nullptr;
 HiPhysicsUPtr       g_hiPhysics = nullptr;
 SimBufferPtr        g_buffer = nullptr;
+StateCacheUPtr      g_stateCache = nullptr;
+DomainDecompositionUPtr g_decomposition = nullptr; // set when the scene is split over several processes
 
 #include "scenes/sceneHelper.h"
 #include "scenes/scene.h"
@@ -103,6 +111,42 @@ void OnKeyEvent(GLFWwindow* window, int key, int scancode, int action, int mods)
 // |                                                                             |
 // o =========================================================================== o
 
+// run the solver without gravity so the particles settle out of the initial lattice packing,
+// then upload the relaxed state at rest
+bool RelaxInitialState(int32_t warmupSteps) {
+    SPDLOG_INFO("relax initial state : {} steps", warmupSteps);
+    glm::vec3 gravity = g_buffer->m_commonParam.gravity;
+    bool adaptiveDt = g_buffer->m_commonParam.adaptiveDt;
+    g_buffer->m_commonParam.gravity = glm::vec3(0.0f);
+    g_buffer->m_commonParam.adaptiveDt = false; // one solver step per warmup step
+    for (int32_t step = 0; step < warmupSteps; ++step)
+        g_hiPhysics->UpdateSolver(g_buffer);
+    g_buffer->m_commonParam.gravity = gravity;
+    g_buffer->m_commonParam.adaptiveDt = adaptiveDt;
+
+    if (!g_hiPhysics->GetMemory(g_buffer))
+        return false;
+    std::fill(g_buffer->m_velocities.begin(), g_buffer->m_velocities.end(), glm::vec3(0.0f));
+
+    g_hiPhysics->ClearMemory();
+    g_hiPhysics = HiPhysics::Create();
+    return g_hiPhysics && g_hiPhysics->SetMemory(g_buffer);
+}
+
+// the precision picked in the UI overrides the scene default
+void ApplyPrecisionOverride() {
+    if (g_context->m_precisionOverride > 0)
+        g_buffer->m_commonParam.precision = static_cast<Precision>(g_context->m_precisionOverride - 1);
+}
+
+// hand particles over to the neighbor ranks and refresh the ghosts, then re-upload the slab :
+// the solver keeps its time, time step and colliders, only the particles are replaced
+bool ExchangeDomains() {
+    if (!g_decomposition->Exchange(g_buffer))
+        return false;
+    return g_hiPhysics->UploadParticles(g_buffer);
+}
+
 bool InitializeWithScene(int32_t sceneIndex) {
     g_scene = sceneIndex;
 
@@ -125,27 +169,60 @@ bool InitializeWithScene(int32_t sceneIndex) {
     }
 
     // Load Current Scene
-    g_scenes[g_scene]->Init();
+    // - with the state cache, the scene is described first and generated only on a cache miss
+    // - a decomposed scene is always generated : every rank cuts its slab out of the same full scene
+    bool useStateCache = g_stateCache && g_context->m_useStateCache && !g_decomposition;
+    bool loadedFromCache = false;
+    uint64_t cacheKey = 0;
+    if (useStateCache)
+    {
+        g_stateCache->BeginDescribe();
+        g_scenes[g_scene]->Init();
+        ApplyPrecisionOverride();
+        cacheKey = g_stateCache->EndDescribe(g_scenes[g_scene]->mName, g_buffer, g_scenes[g_scene]->mWarmupSteps);
+        loadedFromCache = g_stateCache->Load(cacheKey, g_buffer);
+        if (!loadedFromCache)
+            g_buffer = SimBuffer::Create();
+    }
+    if (!loadedFromCache)
+    {
+        g_scenes[g_scene]->Init();
+        ApplyPrecisionOverride();
+    }
+
+    if (g_decomposition)
+    {
+        if (!g_decomposition->Distribute(g_buffer) || !g_decomposition->Exchange(g_buffer))
+        {
+            SPDLOG_ERROR("failed to decompose the scene");
+            return false;
+        }
+    }
 
     SPDLOG_INFO("init number of particles : {}", g_buffer->GetNumParticles());
 
     // Initialize Scene into hiphysics engine
 
-    if (g_scenes[g_scene]->mSceneType == StateOfMatter::FLUID)
+    if (!g_hiPhysics->SetMemory(g_buffer))
     {
-        if (!g_hiPhysics->SetMemory(g_buffer))
-        {
-            SPDLOG_ERROR("CUDA : failed to copy host to device.");
-            return false;
-        }
+        SPDLOG_ERROR("CUDA : failed to copy host to device.");
+        return false;
     }
-    else if (g_scenes[g_scene]->mSceneType == StateOfMatter::CLOTH)
+    g_hiPhysics->SetHaloExchange(g_decomposition.get());
+
+    // Relax and store the generated state for the next launch
+    if (useStateCache && !loadedFromCache)
     {
-        if (!g_hiPhysics->SetMemoryCloth(g_buffer))
+        int32_t warmupSteps = g_scenes[g_scene]->mWarmupSteps;
+        if (warmupSteps > 0)
         {
-            SPDLOG_ERROR("CUDA : failed to copy host to device.");
-            return false;
+            if (!RelaxInitialState(warmupSteps))
+            {
+                SPDLOG_ERROR("CUDA : failed to relax initial state.");
+                return false;
+            }
         }
+        g_stateCache->Save(cacheKey, g_buffer);
     }
 
     // 
@@ -158,6 +235,79 @@ bool InitializeWithScene(int32_t sceneIndex) {
     return true;
 }
 
+void LoadScenes() {
+    g_scenes.push_back(new SphereDrop("Sphere Drop"));
+    g_scenes.push_back(new SphereCollision("Sphere Collision"));
+    g_scenes.push_back(new DamBreak("Dam Break")); 
+    g_scenes.push_back(new Cloth("Cloth"));
+    g_scenes.push_back(new MultiCloth("Multi Cloth"));
+    g_scenes.push_back(new MeshCloth("Mesh Cloth"));
+    g_scenes.push_back(new FluidOnCloth("Fluid On Cloth"));
+    g_scenes.push_back(new DamWall("Dam Wall"));
+    g_scenes.push_back(new FluidOnPlate("Fluid On Plate"));
+    g_scenes.push_back(new Mixer("Mixer"));
+    std::vector<Scene*>::iterator scenePtr;
+    for (scenePtr = g_scenes.begin(); scenePtr != g_scenes.end(); ++scenePtr)
+    {
+        g_context->m_sceneList.push_back((**scenePtr).mName);
+    }
+}
+
+// simulate and render numFrames frames without a window, as PNG files in directory
+int RunHeadless(const std::string& directory, int32_t numFrames, int32_t initialScene) {
+    auto headlessContext = HeadlessContext::Create();
+    if (!headlessContext)
+        return -1;
+    if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::GetProcAddress)) {
+        SPDLOG_ERROR("failed to initialze glad");
+        return -1;
+    }
+    SPDLOG_INFO("OpenGL context version: {}", glGetString(GL_VERSION));
+
+    g_context = Context::Create();
+    if (!g_context) {
+        SPDLOG_ERROR("failed to create context");
+        return -1;
+    }
+    g_context->m_drawUI = false;
+    g_context->SetOffscreen(true);
+    g_context->Reshape(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    g_stateCache = StateCache::Create("../cache");
+    if (!g_stateCache)
+        SPDLOG_WARN("state cache disabled");
+    LoadScenes();
+    if (!InitializeWithScene(initialScene))
+        return -1;
+
+    auto recorder = FrameRecorder::Create(directory, WINDOW_WIDTH, WINDOW_HEIGHT);
+    if (!recorder)
+        return -1;
+
+    SPDLOG_INFO("Start headless loop : {} frames", numFrames);
+    for (int32_t frame = 0; frame < numFrames; ++frame) {
+        g_hiPhysics->UpdateSolver(g_buffer);
+        if (!g_hiPhysics->GetMemory(g_buffer)) {
+            SPDLOG_ERROR("CUDA : failed to copy device to host.");
+            return -1;
+        }
+        if (g_decomposition && !ExchangeDomains()) {
+            SPDLOG_ERROR("failed to exchange particles with the neighbor ranks");
+            return -1;
+        }
+        g_context->Render();
+        recorder->Capture(g_context->GetOutputFramebuffer());
+    }
+    recorder->Finish();
+    SPDLOG_INFO("{} frames written to {}", recorder->GetNumCaptured(), directory);
+
+    // GL objects go before their context
+    recorder.reset();
+    g_hiPhysics.reset();
+    g_context.reset();
+    return 0;
+}
+
 // o =========================================================================== o
 // |                                                                             |
 // |                                                                             |
@@ -169,6 +319,35 @@ int main(int argc, const char** argv)
 {
     SPDLOG_INFO("START PROGRAM.");
 
+    // decomposition : --ranks N --rank R [--transport-dir DIR] [--scene I]
+    // headless : --headless DIR [--frames N] renders N frames to DIR without a window
+    int32_t numRanks = 1, rank = 0, initialScene = 0, numFrames = 300;
+    std::string transportDir = "../transport";
+    std::string headlessDir;
+    for (int32_t arg = 1; arg + 1 < argc; arg += 2)
+    {
+        std::string option = argv[arg];
+        if (option == "--ranks")                numRanks = std::atoi(argv[arg + 1]);
+        else if (option == "--rank")            rank = std::atoi(argv[arg + 1]);
+        else if (option == "--transport-dir")   transportDir = argv[arg + 1];
+        else if (option == "--scene")           initialScene = std::atoi(argv[arg + 1]);
+        else if (option == "--headless")        headlessDir = argv[arg + 1];
+        else if (option == "--frames")          numFrames = std::atoi(argv[arg + 1]);
+        else SPDLOG_WARN("unknown option {}", option);
+    }
+    if (numRanks > 1)
+    {
+        g_decomposition = DomainDecomposition::Create(UnixSocketTransport::Create(transportDir, rank, numRanks));
+        if (!g_decomposition)
+        {
+            SPDLOG_ERROR("failed to connect rank {} of {}", rank, numRanks);
+            return -1;
+        }
+    }
+
+    if (!headlessDir.empty())
+        return RunHeadless(headlessDir, numFrames, initialScene);
+
     // o ---------------------------------------------------------------------- o
     // |                      LOAD & INITIALIZE LIBRARIES                       |
     // o ---------------------------------------------------------------------- o
@@ -259,20 +438,17 @@ int main(int argc, const char** argv)
     glfwSetMouseButtonCallback(g_window, OnMouseButton);
     glfwSetScrollCallback(g_window, OnScroll);
 
+    // State cache of initial scene states
+    g_stateCache = StateCache::Create("../cache");
+    if (!g_stateCache)
+        SPDLOG_WARN("state cache disabled");
+
     // Load All Scenes
-    g_scenes.push_back(new SphereDrop("Sphere Drop"));
-    g_scenes.push_back(new SphereCollision("Sphere Collision"));
-    g_scenes.push_back(new DamBreak("Dam Break")); 
-    g_scenes.push_back(new Cloth("Cloth"));
-    g_scenes.push_back(new MultiCloth("Multi Cloth"));
-    std::vector<Scene*>::iterator scenePtr;
-    for (scenePtr = g_scenes.begin(); scenePtr != g_scenes.end(); ++scenePtr)
-    {
-        g_context->m_sceneList.push_back((**scenePtr).mName);
-    }
+    LoadScenes();
 
     // Load Current Scene
-    g_scene = 0;
+    g_scene = initialScene;
+    g_context->m_selectedScene = initialScene;
     g_context->m_reloadScene = false;
     InitializeWithScene(g_scene);
 
@@ -281,6 +457,9 @@ int main(int argc, const char** argv)
     while (!glfwWindowShouldClose(g_window)) {
 
         // Change Scene
+        // - ranks of a decomposed scene can't follow the UI of one window, they keep their scene
+        if (g_context->m_reloadScene && g_decomposition)
+            g_context->m_reloadScene = false;
         if (g_context->m_reloadScene)
         {
             g_hiPhysics->ClearMemory();
@@ -297,31 +476,23 @@ int main(int argc, const char** argv)
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
-        if (g_scenes[g_scene]->mSceneType == StateOfMatter::FLUID)
+        // ranks of a decomposed scene step in lockstep, pausing one would stall the others
+        bool stepped = !g_pause || g_step || g_decomposition;
+        if (stepped)
         {
-            if (!g_pause || g_step)
-            {
-                g_hiPhysics->UpdateSolver(g_buffer);
-                g_step = false;
-            }
+            g_hiPhysics->UpdateSolver(g_buffer);
+            g_context->m_adaptiveDt = g_hiPhysics->GetNextDt();
+            g_step = false;
+        }
 
-            if (!g_hiPhysics->GetMemory(g_buffer)){
-                SPDLOG_ERROR("CUDA : failed to copy device to host.");
-                return -1;
-            }
+        if (!g_hiPhysics->GetMemory(g_buffer)){
+            SPDLOG_ERROR("CUDA : failed to copy device to host.");
+            return -1;
         }
-        else if (g_scenes[g_scene]->mSceneType == StateOfMatter::CLOTH)
-        {
-            if (!g_pause || g_step)
-            {
-                g_hiPhysics->UpdateSolverCloth(g_buffer);
-                g_step = false;
-            }
 
-            if (!g_hiPhysics->GetMemoryCloth(g_buffer)){
-                SPDLOG_ERROR("CUDA : failed to copy device to host.");
-                return -1;
-            }
+        if (g_decomposition && stepped && !ExchangeDomains()) {
+            SPDLOG_ERROR("failed to exchange particles with the neighbor ranks");
+            return -1;
         }
 
         g_context->ProcessInput(g_window);
@@ -1,4 +1,6 @@
 #include "model.h"
+#include <algorithm>
+#include <numeric>
 
 ModelUPtr Model::Load(const std::string &filename)
 {
@@ -8,6 +10,14 @@ ModelUPtr Model::Load(const std::string &filename)
     return std::move(model);
 }
 
+ModelUPtr Model::LoadGeometry(const std::string &filename)
+{
+    auto model = ModelUPtr(new Model());
+    if (!model->LoadGeometryByAssimp(filename))
+        return nullptr;
+    return std::move(model);
+}
+
 bool Model::LoadByAssimp(const std::string &filename)
 {
     Assimp::Importer importer;
@@ -94,4 +104,80 @@ void Model::Draw(const Program* program) const
     {
         mesh->Draw(program);
     }
-}
\ No newline at end of file
+}
+
+bool Model::LoadGeometryByAssimp(const std::string &filename)
+{
+    Assimp::Importer importer;
+    auto scene = importer.ReadFile(filename,
+        aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices);
+
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        SPDLOG_ERROR("failed to load model: {}", filename);
+        return false;
+    }
+
+    for (uint32_t m = 0; m < scene->mNumMeshes; m++)
+    {
+        auto mesh = scene->mMeshes[m];
+        uint32_t base = (uint32_t)m_positions.size();
+        for (uint32_t i = 0; i < mesh->mNumVertices; i++)
+            m_positions.push_back(glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z));
+
+        for (uint32_t i = 0; i < mesh->mNumFaces; i++)
+        {
+            if (mesh->mFaces[i].mNumIndices != 3)
+                continue;
+            m_indices.push_back(base + mesh->mFaces[i].mIndices[0]);
+            m_indices.push_back(base + mesh->mFaces[i].mIndices[1]);
+            m_indices.push_back(base + mesh->mFaces[i].mIndices[2]);
+        }
+    }
+
+    WeldVertices();
+    SPDLOG_INFO("load geometry: {}, #vert: {}, #face: {}", filename, m_positions.size(), m_indices.size() / 3);
+    return true;
+}
+
+void Model::WeldVertices()
+{
+    // vertices split by uv or normal seams still share a position
+    std::vector<uint32_t> order(m_positions.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [&](uint32_t a, uint32_t b) {
+        const glm::vec3 &pa = m_positions[a];
+        const glm::vec3 &pb = m_positions[b];
+        if (pa.x != pb.x) return pa.x < pb.x;
+        if (pa.y != pb.y) return pa.y < pb.y;
+        return pa.z < pb.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    std::vector<uint32_t> remap(m_positions.size());
+    std::vector<glm::vec3> welded;
+    welded.reserve(m_positions.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        if ((i == 0) || less(order[i - 1], order[i]))
+            welded.push_back(m_positions[order[i]]);
+        remap[order[i]] = (uint32_t)welded.size() - 1;
+    }
+
+    // drop triangles collapsed by the weld
+    std::vector<uint32_t> indices;
+    indices.reserve(m_indices.size());
+    for (size_t t = 0; t + 2 < m_indices.size(); t += 3)
+    {
+        uint32_t i0 = remap[m_indices[t]];
+        uint32_t i1 = remap[m_indices[t + 1]];
+        uint32_t i2 = remap[m_indices[t + 2]];
+        if ((i0 == i1) || (i1 == i2) || (i2 == i0))
+            continue;
+        indices.push_back(i0);
+        indices.push_back(i1);
+        indices.push_back(i2);
+    }
+
+    m_positions = std::move(welded);
+    m_indices = std::move(indices);
+}
@@ -13,19 +13,29 @@ class Model
 {
 public:
     static ModelUPtr Load(const std::string &filename);
+    // positions and triangles only, without GL resources; coincident vertices are welded
+    static ModelUPtr LoadGeometry(const std::string &filename);
 
     int GetMeshCount() const { return (int)m_meshes.size(); }
     MeshPtr GetMesh(int index) const { return m_meshes[index]; }
     void Draw(const Program* program) const;
 
+    const std::vector<glm::vec3> &GetPositions() const { return m_positions; }
+    const std::vector<uint32_t> &GetIndices() const { return m_indices; }
+
 private:
     Model() {}
     bool LoadByAssimp(const std::string &filename);
     void ProcessMesh(aiMesh *mesh, const aiScene *scene);
     void ProcessNode(aiNode *node, const aiScene *scene);
+    bool LoadGeometryByAssimp(const std::string &filename);
+    void WeldVertices();
 
     std::vector<MeshPtr> m_meshes;
     std::vector<MaterialPtr> m_materials;
+
+    std::vector<glm::vec3> m_positions;
+    std::vector<uint32_t> m_indices;
 };
 
 #endif // __MODEL_H__
\ No newline at end of file
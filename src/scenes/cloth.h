@@ -14,8 +14,9 @@ public :
         g_buffer->m_commonParam.H       = g_buffer->m_commonParam.diameter * 2.0f * 1.2f ; // 0.048f;      
         g_buffer->m_commonParam.dt      = 0.001f;    
 
-        g_buffer->m_commonParam.iterationNumber = 30;
-	    g_buffer->m_commonParam.relaxationParameter = powf(3.3f/g_buffer->m_commonParam.radius,2.0f);
+        g_buffer->m_commonParam.iterationNumber = 1;
+        g_buffer->m_commonParam.substepNumber   = 10;
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(0.3f);
 	    g_buffer->m_commonParam.scorrK              = 0.00001f;
 	    g_buffer->m_commonParam.scorrDq             = 0.3f;
 
@@ -33,6 +34,11 @@ public :
         glm::vec3 initVel = glm::vec3(0.0, 0.0, 0.0);
 
         glm::vec3 centerPoint = glm::vec3(0, 1.0, 0.0);
+        int32_t firstID = g_buffer->GetNumParticles();
         createParticleCloth(centerPoint, 0.5*size, size, 1, initVel, 0);
+
+        // pin the two corners of the first row, particles are laid out row by row along the second side
+        int32_t rowLength = clothLatticeCount(size);
+        g_buffer->m_fixedID = { firstID, firstID + rowLength - 1 };
     }
 };
\ No newline at end of file
@@ -15,9 +15,16 @@ public :
         g_buffer->m_commonParam.dt      = 0.0005f;   
 
         g_buffer->m_commonParam.iterationNumber = 1;
-	    g_buffer->m_commonParam.relaxationParameter = powf(3.3f/g_buffer->m_commonParam.radius,2.0f);
+        g_buffer->m_commonParam.adaptiveDt      = true;
+        g_buffer->m_commonParam.minDt           = 0.0001f;
+        g_buffer->m_commonParam.maxDt           = 0.002f;
+        g_buffer->m_commonParam.quantizedPositions = true;
+        mWarmupSteps = 200;
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(3.0f);
 	    g_buffer->m_commonParam.scorrK              = 0.00001f;
 	    g_buffer->m_commonParam.scorrDq             = 0.3f;
+	    g_buffer->m_commonParam.xsphViscosity       = 0.05f;
+	    g_buffer->m_commonParam.vorticityEpsilon    = 0.001f;
         g_buffer->m_commonParam.gravity             = glm::vec3(0.0f, -9.81f, 0.0f);
         g_buffer->m_commonParam.AnalysisBox         = boxPoint(glm::vec3(-0.5f, -0.0f, -0.2f), glm::vec3(0.5f, 1.0f, 0.2f));
 
@@ -0,0 +1,44 @@
+// Test Scene
+// dam break against a wall given by a mesh collider
+class DamWall : public Scene
+{
+public :
+    DamWall(const char* name) : Scene(name) {}
+
+	virtual void Init()
+    {
+        SPDLOG_INFO("DamWall Initializing");
+ 
+        g_buffer->m_commonParam.radius  = 0.005f;    
+        g_buffer->m_commonParam.diameter= g_buffer->m_commonParam.radius * 2.0f;    
+        g_buffer->m_commonParam.H       = g_buffer->m_commonParam.diameter * 2.0f * 1.2f ;      
+        g_buffer->m_commonParam.dt      = 0.0005f;   
+
+        g_buffer->m_commonParam.iterationNumber = 1;
+        g_buffer->m_commonParam.adaptiveDt      = true;
+        g_buffer->m_commonParam.minDt           = 0.0001f;
+        g_buffer->m_commonParam.maxDt           = 0.002f;
+        mWarmupSteps = 200;
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(3.0f);
+	    g_buffer->m_commonParam.scorrK              = 0.00001f;
+	    g_buffer->m_commonParam.scorrDq             = 0.3f;
+	    g_buffer->m_commonParam.xsphViscosity       = 0.05f;
+	    g_buffer->m_commonParam.vorticityEpsilon    = 0.001f;
+        g_buffer->m_commonParam.gravity             = glm::vec3(0.0f, -9.81f, 0.0f);
+        g_buffer->m_commonParam.AnalysisBox         = boxPoint(glm::vec3(-0.5f, -0.0f, -0.2f), glm::vec3(0.5f, 1.0f, 0.2f));
+
+        PhaseParameters Water;
+        Water.phaseType = StateOfMatter::FLUID;
+        Water.density = 1000.0f; 
+        Water.color   = glm::vec3(1.0f, 0.0f, 0.0f);
+        g_buffer->m_phaseParam.push_back(Water); // phase : 0
+        
+        // wall across the channel, in the way of the water
+        createSdfCollider("../models/collider/dam_wall.obj", glm::vec3(0.1f, 0.0f, 0.0f), 1.0f);
+
+        //Box Generate
+        boxPoint WaterBox = boxPoint(glm::vec3(-0.5f, -0.0f, -0.2f), glm::vec3(-0.3f, 0.4f, 0.2f));
+        glm::vec3 initVel = glm::vec3(0.0, 0.0, 0.0);
+        createParticleGrid(WaterBox, initVel, 0);
+    }
+};
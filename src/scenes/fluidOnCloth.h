@@ -0,0 +1,53 @@
+// Test Scene
+// 
+class FluidOnCloth : public Scene
+{
+public :
+    FluidOnCloth(const char* name) : Scene(name) {}
+
+	virtual void Init()
+    {
+        SPDLOG_INFO("Fluid On Cloth Initializing");
+        
+        g_buffer->m_commonParam.radius  = 0.01f;    
+        g_buffer->m_commonParam.diameter= g_buffer->m_commonParam.radius * 2.0f;    
+        g_buffer->m_commonParam.H       = g_buffer->m_commonParam.diameter * 2.0f * 1.2f ;      
+        g_buffer->m_commonParam.dt      = 0.001f;    
+
+        g_buffer->m_commonParam.iterationNumber = 1;
+        g_buffer->m_commonParam.substepNumber   = 4;
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(3.0f);
+	    g_buffer->m_commonParam.scorrK              = 0.00001f;
+	    g_buffer->m_commonParam.scorrDq             = 0.3f;
+
+        g_buffer->m_commonParam.gravity             = glm::vec3(0.0f, -9.81f, 0.0f);
+        g_buffer->m_commonParam.AnalysisBox         = boxPoint(glm::vec3(-0.9f, 0.0f, -0.9f), glm::vec3(0.9f, 1.5f, 0.9f));
+
+        PhaseParameters Water;
+        Water.phaseType = StateOfMatter::FLUID;
+        Water.density = 1000.0f; 
+        Water.color   = glm::vec3(0.0f, 0.0f, 1.0f);
+        g_buffer->m_phaseParam.push_back(Water); // phase : 0
+
+        PhaseParameters Sheet;
+        Sheet.phaseType = StateOfMatter::CLOTH;
+        Sheet.density = 1000.0f; 
+        Sheet.color   = glm::vec3(0.0f, 0.0f, 0.0f);
+        g_buffer->m_phaseParam.push_back(Sheet); // phase : 1
+
+        // a sheet of 39 x 39 particles spanning [-0.38, 0.38], pinned at its four corners
+        float corner = 0.38f;
+        for (float x : {-corner, corner})
+            for (float z : {-corner, corner})
+            {
+                boxPoint fixedBox = boxPoint(glm::vec3(x - 0.005f, 0.605f, z - 0.005f), glm::vec3(x + 0.005f, 0.615f, z + 0.005f));
+                g_buffer->m_commonParam.fixedBox.push_back(fixedBox);
+            }
+
+        glm::vec3 initVel = glm::vec3(0.0, 0.0, 0.0);
+        createParticleCloth(glm::vec3(-corner - 0.01, 0.6, -corner - 0.01), 0.81, 0.81, 1, initVel, 1);
+
+        // water falling onto the sheet
+        createParticleSphere(glm::vec3(0.0, 1.0, 0.0), 0.15, initVel, 0);
+    }
+};
@@ -0,0 +1,39 @@
+// Test Scene
+// water poured onto a rigid plate of zero thickness, too thin for an SDF collider
+class FluidOnPlate : public Scene
+{
+public :
+    FluidOnPlate(const char* name) : Scene(name) {}
+
+	virtual void Init()
+    {
+        SPDLOG_INFO("Fluid On Plate Initializing");
+        
+        g_buffer->m_commonParam.radius  = 0.01f;    
+        g_buffer->m_commonParam.diameter= g_buffer->m_commonParam.radius * 2.0f;    
+        g_buffer->m_commonParam.H       = g_buffer->m_commonParam.diameter * 2.0f * 1.2f ;      
+        g_buffer->m_commonParam.dt      = 0.001f;    
+
+        g_buffer->m_commonParam.iterationNumber = 1;
+        g_buffer->m_commonParam.substepNumber   = 4;
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(3.0f);
+	    g_buffer->m_commonParam.scorrK              = 0.00001f;
+	    g_buffer->m_commonParam.scorrDq             = 0.3f;
+
+        g_buffer->m_commonParam.gravity             = glm::vec3(0.0f, -9.81f, 0.0f);
+        g_buffer->m_commonParam.AnalysisBox         = boxPoint(glm::vec3(-0.9f, 0.0f, -0.9f), glm::vec3(0.9f, 1.5f, 0.9f));
+
+        PhaseParameters Water;
+        Water.phaseType = StateOfMatter::FLUID;
+        Water.density = 1000.0f; 
+        Water.color   = glm::vec3(0.0f, 0.0f, 1.0f);
+        g_buffer->m_phaseParam.push_back(Water); // phase : 0
+
+        // the hexagonal cloth mesh as a rigid plate of circumradius 0.5
+        createMeshCollider("../models/cloth/hex_disc.obj", glm::vec3(0.0f, 0.6f, 0.0f), 0.5f);
+
+        // water falling onto the plate, spilling over its edges
+        glm::vec3 initVel = glm::vec3(0.0, 0.0, 0.0);
+        createParticleSphere(glm::vec3(0.2, 1.0, 0.0), 0.15, initVel, 0);
+    }
+};
@@ -0,0 +1,40 @@
+// Test Scene
+// 
+class MeshCloth : public Scene
+{
+public :
+    MeshCloth(const char* name) : Scene(name, StateOfMatter::CLOTH) {}
+
+	virtual void Init()
+    {
+        SPDLOG_INFO("Mesh Cloth Initializing");
+        
+        g_buffer->m_commonParam.radius  = 0.00375f;    
+        g_buffer->m_commonParam.diameter= g_buffer->m_commonParam.radius * 2.0f;    
+        g_buffer->m_commonParam.H       = g_buffer->m_commonParam.diameter * 2.0f * 1.2f ;      
+        g_buffer->m_commonParam.dt      = 0.001f;    
+
+        g_buffer->m_commonParam.iterationNumber = 1;
+        g_buffer->m_commonParam.substepNumber   = 10;
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(1.1f);
+	    g_buffer->m_commonParam.scorrK              = 0.00001f;
+	    g_buffer->m_commonParam.scorrDq             = 0.3f;
+
+        g_buffer->m_commonParam.gravity             = glm::vec3(0.0f, -10.0f, 0.0f);
+        g_buffer->m_commonParam.AnalysisBox         = boxPoint(glm::vec3(-10.f, -10.0f, -10.0f), glm::vec3(10.f, 10.f, 10.f));
+
+        PhaseParameters Tablecloth;
+        Tablecloth.phaseType = StateOfMatter::CLOTH;
+        Tablecloth.density = 1000.0f; 
+        Tablecloth.color   = glm::vec3(0.0f, 0.0f, 0.0f);
+        Tablecloth.bendCompliance = 1.0e-8f;
+        g_buffer->m_phaseParam.push_back(Tablecloth);
+
+        // hang the disc by its center
+        boxPoint fixedBox = boxPoint(glm::vec3(-0.001, 0.999, -0.001), glm::vec3(0.001, 1.001, 0.001));
+        g_buffer->m_commonParam.fixedBox.push_back(fixedBox);
+
+        glm::vec3 initVel = glm::vec3(0.0, 0.0, 0.0);
+        createParticleClothFromMesh("../models/cloth/hex_disc.obj", glm::vec3(0.0, 1.0, 0.0), 0.15f, initVel, 0);
+    }
+};
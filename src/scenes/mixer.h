@@ -0,0 +1,42 @@
+// Test Scene
+// a paddle spinning in a tank of water : a kinematic mesh collider
+class Mixer : public Scene
+{
+public :
+    Mixer(const char* name) : Scene(name) {}
+
+	virtual void Init()
+    {
+        SPDLOG_INFO("Mixer Initializing");
+        
+        g_buffer->m_commonParam.radius  = 0.01f;    
+        g_buffer->m_commonParam.diameter= g_buffer->m_commonParam.radius * 2.0f;    
+        g_buffer->m_commonParam.H       = g_buffer->m_commonParam.diameter * 2.0f * 1.2f ;      
+        g_buffer->m_commonParam.dt      = 0.001f;    
+
+        g_buffer->m_commonParam.iterationNumber = 1;
+        g_buffer->m_commonParam.substepNumber   = 4;
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(3.0f);
+	    g_buffer->m_commonParam.scorrK              = 0.00001f;
+	    g_buffer->m_commonParam.scorrDq             = 0.3f;
+	    g_buffer->m_commonParam.xsphViscosity       = 0.05f;
+
+        g_buffer->m_commonParam.gravity             = glm::vec3(0.0f, -9.81f, 0.0f);
+        g_buffer->m_commonParam.AnalysisBox         = boxPoint(glm::vec3(-0.4f, 0.0f, -0.4f), glm::vec3(0.4f, 0.8f, 0.4f));
+
+        PhaseParameters Water;
+        Water.phaseType = StateOfMatter::FLUID;
+        Water.density = 1000.0f; 
+        Water.color   = glm::vec3(0.0f, 0.0f, 1.0f);
+        g_buffer->m_phaseParam.push_back(Water); // phase : 0
+
+        // half a turn per second, dragging the water it touches
+        ColliderMotion* paddle = createMeshCollider("../models/collider/mixer_paddle.obj", glm::vec3(0.0f), 1.0f);
+        spinCollider(paddle, glm::vec3(0.0f, 0.02f, 0.0f), 0.5f, 0.5f);
+
+        //Box Generate
+        boxPoint WaterBox = boxPoint(glm::vec3(-0.4f, 0.0f, -0.4f), glm::vec3(0.4f, 0.2f, 0.4f));
+        glm::vec3 initVel = glm::vec3(0.0, 0.0, 0.0);
+        createParticleGrid(WaterBox, initVel, 0);
+    }
+};
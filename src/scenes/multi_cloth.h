@@ -14,8 +14,9 @@ public :
         g_buffer->m_commonParam.H       = g_buffer->m_commonParam.diameter * 2.0f * 1.2f ; // 0.048f;      
         g_buffer->m_commonParam.dt      = 0.001f;    
 
-        g_buffer->m_commonParam.iterationNumber = 30;
-	    g_buffer->m_commonParam.relaxationParameter = powf(3.3f/g_buffer->m_commonParam.radius,2.0f);
+        g_buffer->m_commonParam.iterationNumber = 1;
+        g_buffer->m_commonParam.substepNumber   = 10;
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(0.3f);
 	    g_buffer->m_commonParam.scorrK              = 0.00001f;
 	    g_buffer->m_commonParam.scorrDq             = 0.3f;
 
@@ -33,8 +34,11 @@ public :
         float size = 0.5;
         glm::vec3 initVel = glm::vec3(0.0, 0.0, 0.0);
 
-        // boxPoint fixedBox1 = boxPoint(glm::vec3(-0.01, 0.99, -0.01), glm::vec3(0.01, 1.01, 0.01));
-        // g_buffer->m_commonParam.fixedBox.push_back(fixedBox1);
+        // pin the two corners of the first row
+        boxPoint fixedBox1 = boxPoint(glm::vec3(0.0005, 1.0005, 0.0005), glm::vec3(0.0015, 1.0015, 0.0015));
+        g_buffer->m_commonParam.fixedBox.push_back(fixedBox1);
+        boxPoint fixedBox2 = boxPoint(glm::vec3(0.0005, 1.0005, 0.2965), glm::vec3(0.0015, 1.0015, 0.2975));
+        g_buffer->m_commonParam.fixedBox.push_back(fixedBox2);
         glm::vec3 minPoint = glm::vec3(0, 1.0, 0.0);        
         createParticleCloth(minPoint, 0.51, 0.3, 1, initVel, 0);
 
@@ -13,6 +13,8 @@ public :
 	virtual void Init() = 0;
     
     StateOfMatter mSceneType {StateOfMatter::FLUID};
+    // steps run without gravity to relax the initial lattice packing before the state is cached
+    int32_t mWarmupSteps {0};
 	const char* mName;
 };
 
@@ -21,6 +23,11 @@ public :
 #include "damBreak.h"
 #include "cloth.h"
 #include "multi_cloth.h"
+#include "meshCloth.h"
+#include "fluidOnCloth.h"
+#include "damWall.h"
+#include "fluidOnPlate.h"
+#include "mixer.h"
 
 #endif // __SCENES_H__
 /*
@@ -1,10 +1,18 @@
 
+
+#include "hostworkers.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+
 #define EPSILON_SCENE_HELPER 0.00000001
 
 bool checkGlobalVariable()
 {
     if (glm::length(g_buffer->m_commonParam.AnalysisBox.maxPoint - g_buffer->m_commonParam.AnalysisBox.minPoint) < EPSILON_SCENE_HELPER) return false;
     if (g_buffer->m_commonParam.radius < EPSILON_SCENE_HELPER) return false;
+    return true;
 }
 
 bool isInsideOfBox(glm::vec3 pos, boxPoint box)
@@ -15,142 +23,225 @@ bool isInsideOfBox(glm::vec3 pos, boxPoint box)
     return true;
 }
 
+template <typename T>
+void describeArgument(const T& arg) { g_stateCache->Hash(arg); }
+void describeArgument(const char* arg) { g_stateCache->HashBytes(arg, strlen(arg)); }
+
+// while the state cache describes a scene, a generator only hashes its arguments
+template <typename... Args>
+bool describePrimitive(const char* primitive, const Args&... args)
+{
+    if (!g_stateCache || !g_stateCache->IsDescribing()) return false;
+    g_stateCache->HashBytes(primitive, strlen(primitive));
+    (describeArgument(args), ...);
+    return true;
+}
+
+// func(ii) for every ii in [0, num), a contiguous range of rows per host worker :
+// the particles of a row are written first by the node that owns them
+template <typename Func>
+void parallelFor(int32_t num, Func func)
+{
+    HostWorkers::Get().Run(num, [&](int32_t, int64_t begin, int64_t end) {
+        for (int64_t ii = begin; ii < end; ++ii)
+            func(static_cast<int32_t>(ii));
+    });
+}
+
+// coordinate of the ii-th lattice point from origin, spaced by a particle diameter
+inline float latticeCoordinate(float origin, int32_t ii, float radius)
+{
+    return origin + ii*2.0f*radius;
+}
+
+// lattice points are sorted along an axis, so the ones inside [lo, hi] are the contiguous range [first, last)
+void clipLatticeAxis(float origin, float radius, int32_t num, float lo, float hi, int32_t &first, int32_t &last)
+{
+    first = 0;
+    while ((first < num) && (latticeCoordinate(origin, first, radius) < lo)) ++first;
+    last = num;
+    while ((last > first) && (latticeCoordinate(origin, last - 1, radius) > hi)) --last;
+}
+
+// XPBD compliance of the density constraint for an artificial speed of sound, in s^2/m^2 :
+// the constraint is dimensionless and its gradient is in 1/m, so 1/c^2 depends on neither dt nor substepNumber
+inline float soundSpeedCompliance(float soundSpeed)
+{
+    return 1.0f / (soundSpeed * soundSpeed);
+}
+
+// grow the particle arrays once and return the index of the first new particle
+int32_t resizeParticles(int32_t nAdded)
+{
+    int32_t nParticlesBeforeAdded = g_buffer->GetNumParticles();
+    g_buffer->ResizeParticles(nParticlesBeforeAdded + nAdded);
+    return nParticlesBeforeAdded;
+}
+
 void createParticleGrid(boxPoint particleBox, glm::vec3 velocity, int32_t phaseID)
 {
+    if (describePrimitive("grid", particleBox.minPoint, particleBox.maxPoint, velocity, phaseID)) return;
     if (!checkGlobalVariable()) SPDLOG_ERROR("failed to create particle grid.");
-    glm::vec3 AnalysisBoxMinPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.minPoint + g_buffer->m_commonParam.radius;
-    glm::vec3 AnalysisBoxMaxPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.maxPoint - g_buffer->m_commonParam.radius;
-    boxPoint AnalysisBoxConsideringRadius = boxPoint(AnalysisBoxMinPointConsideringRadius, AnalysisBoxMaxPointConsideringRadius);
-
-    int32_t xNum = static_cast<int32_t>((particleBox.maxPoint.x - particleBox.minPoint.x) / (2.0f * g_buffer->m_commonParam.radius));
-    int32_t yNum = static_cast<int32_t>((particleBox.maxPoint.y - particleBox.minPoint.y) / (2.0f * g_buffer->m_commonParam.radius));
-    int32_t zNum = static_cast<int32_t>((particleBox.maxPoint.z - particleBox.minPoint.z) / (2.0f * g_buffer->m_commonParam.radius));
-    int32_t totalParticleNumber = xNum*yNum*zNum + g_buffer->GetNumParticles();
-
-    g_buffer->m_positions.reserve(totalParticleNumber);
-    g_buffer->m_velocities.reserve(totalParticleNumber);
-    g_buffer->m_phases.reserve(totalParticleNumber);
-    g_buffer->m_colorValues.reserve(totalParticleNumber);
-    
-    for (int32_t ii = 0 ; ii < xNum ; ++ii)
+    float radius = g_buffer->m_commonParam.radius;
+    glm::vec3 AnalysisBoxMinPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.minPoint + radius;
+    glm::vec3 AnalysisBoxMaxPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.maxPoint - radius;
+    glm::vec3 origin = particleBox.minPoint + radius;
+
+    int32_t xNum = static_cast<int32_t>((particleBox.maxPoint.x - particleBox.minPoint.x) / (2.0f * radius));
+    int32_t yNum = static_cast<int32_t>((particleBox.maxPoint.y - particleBox.minPoint.y) / (2.0f * radius));
+    int32_t zNum = static_cast<int32_t>((particleBox.maxPoint.z - particleBox.minPoint.z) / (2.0f * radius));
+
+    // the analysis box test is separable, so clipping is done per axis
+    int32_t x0, x1, y0, y1, z0, z1;
+    clipLatticeAxis(origin.x, radius, xNum, AnalysisBoxMinPointConsideringRadius.x, AnalysisBoxMaxPointConsideringRadius.x, x0, x1);
+    clipLatticeAxis(origin.y, radius, yNum, AnalysisBoxMinPointConsideringRadius.y, AnalysisBoxMaxPointConsideringRadius.y, y0, y1);
+    clipLatticeAxis(origin.z, radius, zNum, AnalysisBoxMinPointConsideringRadius.z, AnalysisBoxMaxPointConsideringRadius.z, z0, z1);
+    int32_t nx = x1 - x0;
+    int32_t ny = y1 - y0;
+    int32_t nz = z1 - z0;
+
+    int32_t offset = resizeParticles(nx*ny*nz);
+    parallelFor(nx, [&](int32_t ii)
     {
-        for (int32_t jj = 0 ; jj < yNum ; ++jj)
+        for (int32_t jj = 0 ; jj < ny ; ++jj)
         {
-            for (int32_t kk = 0 ; kk < zNum ; ++kk)
+            for (int32_t kk = 0 ; kk < nz ; ++kk)
             {
-                glm::vec3 tmp_position = glm::vec3(particleBox.minPoint.x + g_buffer->m_commonParam.radius + ii*2.0f*g_buffer->m_commonParam.radius,
-                                                    particleBox.minPoint.y + g_buffer->m_commonParam.radius + jj*2.0f*g_buffer->m_commonParam.radius,
-                                                    particleBox.minPoint.z + g_buffer->m_commonParam.radius + kk*2.0f*g_buffer->m_commonParam.radius);
-                if (isInsideOfBox(tmp_position, AnalysisBoxConsideringRadius))
-                {
-                    g_buffer->m_positions.push_back(tmp_position);
-                    g_buffer->m_velocities.push_back(velocity);
-                    g_buffer->m_phases.push_back(phaseID);
-                    g_buffer->m_colorValues.push_back(static_cast<float>(jj));
-                }
+                int32_t idx = offset + (ii*ny + jj)*nz + kk;
+                g_buffer->m_positions[idx]   = glm::vec3(latticeCoordinate(origin.x, x0 + ii, radius),
+                                                         latticeCoordinate(origin.y, y0 + jj, radius),
+                                                         latticeCoordinate(origin.z, z0 + kk, radius));
+                g_buffer->m_velocities[idx]  = velocity;
+                g_buffer->m_phases[idx]      = phaseID;
+                g_buffer->m_colorValues[idx] = static_cast<float>(y0 + jj);
             }
         }
-    }
-
-    g_buffer->m_positions.shrink_to_fit();
-    g_buffer->m_velocities.shrink_to_fit();
-    g_buffer->m_phases.shrink_to_fit();
-    g_buffer->m_colorValues.shrink_to_fit();
+    });
 }
 
 void createParticleSphere(glm::vec3 centerPoint, float sphereRadius, glm::vec3 velocity, int32_t phaseID)
 {
+    if (describePrimitive("sphere", centerPoint, sphereRadius, velocity, phaseID)) return;
     if (!checkGlobalVariable()) SPDLOG_ERROR("failed to create particle sphere.");
-    glm::vec3 AnalysisBoxMinPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.minPoint + g_buffer->m_commonParam.radius;
-    glm::vec3 AnalysisBoxMaxPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.maxPoint - g_buffer->m_commonParam.radius;
+    float radius = g_buffer->m_commonParam.radius;
+    glm::vec3 AnalysisBoxMinPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.minPoint + radius;
+    glm::vec3 AnalysisBoxMaxPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.maxPoint - radius;
     boxPoint AnalysisBoxConsideringRadius = boxPoint(AnalysisBoxMinPointConsideringRadius, AnalysisBoxMaxPointConsideringRadius);
 
-    int32_t rNum = static_cast<int32_t>((sphereRadius) / (2.0f * g_buffer->m_commonParam.radius));
-    int32_t totalParticleNumber = (2*rNum+1)*(2*rNum+1)*(2*rNum+1) + g_buffer->GetNumParticles();
+    int32_t rNum = static_cast<int32_t>((sphereRadius) / (2.0f * radius));
+    int32_t nSlabs = 2*rNum + 1;
 
-    g_buffer->m_positions.reserve(totalParticleNumber);
-    g_buffer->m_velocities.reserve(totalParticleNumber);
-    g_buffer->m_phases.reserve(totalParticleNumber);
-    g_buffer->m_colorValues.reserve(totalParticleNumber);
-    
-    for (int32_t ii = -rNum ; ii < rNum+1 ; ++ii)
+    auto spherePosition = [&](int32_t ii, int32_t jj, int32_t kk) -> glm::vec3
     {
+        return glm::vec3(latticeCoordinate(centerPoint.x, ii, radius),
+                         latticeCoordinate(centerPoint.y, jj, radius),
+                         latticeCoordinate(centerPoint.z, kk, radius));
+    };
+    auto isInsideOfSphere = [&](glm::vec3 pos) -> bool
+    {
+        return isInsideOfBox(pos, AnalysisBoxConsideringRadius) && (length(pos - centerPoint) < sphereRadius - radius);
+    };
+
+    // 1. count the particles of every x-slab
+    std::vector<int32_t> slabOffsets(nSlabs + 1, 0);
+    parallelFor(nSlabs, [&](int32_t slab)
+    {
+        int32_t count = 0;
+        for (int32_t jj = -rNum; jj < rNum + 1; ++jj)
+            for (int32_t kk = -rNum; kk < rNum + 1; ++kk)
+                if (isInsideOfSphere(spherePosition(slab - rNum, jj, kk))) ++count;
+        slabOffsets[slab + 1] = count;
+    });
+
+    // 2. scan the counts into the first index of every slab
+    std::inclusive_scan(slabOffsets.begin(), slabOffsets.end(), slabOffsets.begin());
+
+    // 3. fill every slab from its own offset
+    int32_t offset = resizeParticles(slabOffsets[nSlabs]);
+    parallelFor(nSlabs, [&](int32_t slab)
+    {
+        int32_t idx = offset + slabOffsets[slab];
         for (int32_t jj = -rNum; jj < rNum + 1; ++jj)
         {
             for (int32_t kk = -rNum; kk < rNum + 1; ++kk)
             {
-                glm::vec3 tmp_position = glm::vec3(centerPoint.x + ii*2.0f*g_buffer->m_commonParam.radius,
-                                                   centerPoint.y + jj*2.0f*g_buffer->m_commonParam.radius,
-                                                   centerPoint.z + kk*2.0f*g_buffer->m_commonParam.radius);
-
-                if (isInsideOfBox(tmp_position, AnalysisBoxConsideringRadius) && (length(tmp_position-centerPoint) < sphereRadius-g_buffer->m_commonParam.radius))
-                {
-                    g_buffer->m_positions.push_back(tmp_position);
-                    g_buffer->m_velocities.push_back(velocity);
-                    g_buffer->m_phases.push_back(phaseID);
-                    g_buffer->m_colorValues.push_back(static_cast<float>(jj));
-                }
+                glm::vec3 tmp_position = spherePosition(slab - rNum, jj, kk);
+                if (!isInsideOfSphere(tmp_position)) continue;
+
+                g_buffer->m_positions[idx]   = tmp_position;
+                g_buffer->m_velocities[idx]  = velocity;
+                g_buffer->m_phases[idx]      = phaseID;
+                g_buffer->m_colorValues[idx] = static_cast<float>(jj);
+                ++idx;
             }
         }
-    }
+    });
+}
 
-    g_buffer->m_positions.shrink_to_fit();
-    g_buffer->m_velocities.shrink_to_fit();
-    g_buffer->m_phases.shrink_to_fit();
-    g_buffer->m_colorValues.shrink_to_fit();
+// position of the (ii, jj) particle of a plane spanned by the two axes other than "axis"
+glm::vec3 planePosition(glm::vec3 center, int32_t ii, int32_t jj, int32_t axis, float radius)
+{
+    glm::vec3 origin = center + radius;
+    if ( axis == 0 )
+        return glm::vec3(origin.x, latticeCoordinate(origin.y, ii, radius), latticeCoordinate(origin.z, jj, radius));
+    else if ( axis == 1 )
+        return glm::vec3(latticeCoordinate(origin.x, ii, radius), origin.y, latticeCoordinate(origin.z, jj, radius));
+    return glm::vec3(latticeCoordinate(origin.x, ii, radius), latticeCoordinate(origin.y, jj, radius), origin.z);
 }
 
 void createParticlePlane(glm::vec3 center, float size1, float size2, int32_t axis, glm::vec3 velocity,  int32_t phaseID)
 {
+    if (describePrimitive("plane", center, size1, size2, axis, velocity, phaseID)) return;
     if (!checkGlobalVariable()) SPDLOG_ERROR("failed to create particle plane.");
-    glm::vec3 AnalysisBoxMinPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.minPoint + g_buffer->m_commonParam.radius;
-    glm::vec3 AnalysisBoxMaxPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.maxPoint - g_buffer->m_commonParam.radius;
-    boxPoint AnalysisBoxConsideringRadius = boxPoint(AnalysisBoxMinPointConsideringRadius, AnalysisBoxMaxPointConsideringRadius);
-
-    int32_t num1 = static_cast<int32_t>( size1 / (2.0f * g_buffer->m_commonParam.radius));
-    int32_t num2 = static_cast<int32_t>( size2 / (2.0f * g_buffer->m_commonParam.radius));
-    int32_t totalParticleNumber = num1*num2 + g_buffer->GetNumParticles();
-
-    g_buffer->m_positions.reserve(totalParticleNumber);
-    g_buffer->m_velocities.reserve(totalParticleNumber);
-    g_buffer->m_phases.reserve(totalParticleNumber);
-    g_buffer->m_colorValues.reserve(totalParticleNumber);
-    
-    glm::vec3 tmp_position;
-    for (int32_t ii = 0 ; ii < num1 ; ++ii)
+    float radius = g_buffer->m_commonParam.radius;
+    glm::vec3 AnalysisBoxMinPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.minPoint + radius;
+    glm::vec3 AnalysisBoxMaxPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.maxPoint - radius;
+    glm::vec3 origin = center + radius;
+
+    int32_t num1 = static_cast<int32_t>( size1 / (2.0f * radius));
+    int32_t num2 = static_cast<int32_t>( size2 / (2.0f * radius));
+
+    // axes of ii, jj and of the fixed coordinate
+    int32_t axis1 = (axis == 0) ? 1 : 0;
+    int32_t axis2 = (axis == 2) ? 1 : 2;
+
+    int32_t i0, i1, j0, j1;
+    clipLatticeAxis(origin[axis1], radius, num1, AnalysisBoxMinPointConsideringRadius[axis1], AnalysisBoxMaxPointConsideringRadius[axis1], i0, i1);
+    clipLatticeAxis(origin[axis2], radius, num2, AnalysisBoxMinPointConsideringRadius[axis2], AnalysisBoxMaxPointConsideringRadius[axis2], j0, j1);
+    if ((origin[axis] < AnalysisBoxMinPointConsideringRadius[axis]) || (origin[axis] > AnalysisBoxMaxPointConsideringRadius[axis]))
+        i1 = i0;
+    int32_t n1 = i1 - i0;
+    int32_t n2 = j1 - j0;
+
+    int32_t offset = resizeParticles(n1*n2);
+    parallelFor(n1, [&](int32_t ii)
     {
-        for (int32_t jj = 0 ; jj < num2 ; ++jj)
-        {   
-            if ( axis == 0 )
-                tmp_position = center + g_buffer->m_commonParam.radius + glm::vec3(0.0, ii*2.0f*g_buffer->m_commonParam.radius, jj*2.0f*g_buffer->m_commonParam.radius);
-            else if ( axis == 1 )
-                tmp_position = center + g_buffer->m_commonParam.radius + glm::vec3(ii*2.0f*g_buffer->m_commonParam.radius, 0.0, jj*2.0f*g_buffer->m_commonParam.radius);
-            else if ( axis == 2 )
-                tmp_position = center + g_buffer->m_commonParam.radius + glm::vec3(ii*2.0f*g_buffer->m_commonParam.radius, jj*2.0f*g_buffer->m_commonParam.radius, 0.0);
-
-            if (isInsideOfBox(tmp_position, AnalysisBoxConsideringRadius))
-            {
-                g_buffer->m_positions.push_back(tmp_position);
-                g_buffer->m_velocities.push_back(velocity);
-                g_buffer->m_phases.push_back(phaseID);
-                g_buffer->m_colorValues.push_back(static_cast<float>(jj));
-            }
+        for (int32_t jj = 0 ; jj < n2 ; ++jj)
+        {
+            int32_t idx = offset + ii*n2 + jj;
+            g_buffer->m_positions[idx]   = planePosition(center, i0 + ii, j0 + jj, axis, radius);
+            g_buffer->m_velocities[idx]  = velocity;
+            g_buffer->m_phases[idx]      = phaseID;
+            g_buffer->m_colorValues[idx] = static_cast<float>(j0 + jj);
         }
-    }
-
-    g_buffer->m_positions.shrink_to_fit();
-    g_buffer->m_velocities.shrink_to_fit();
-    g_buffer->m_phases.shrink_to_fit();
-    g_buffer->m_colorValues.shrink_to_fit();
+    });
 
     SPDLOG_INFO("a plane generated");
 }
 
+// lattice points along a cloth side of the given length, as laid out by createParticleCloth
+inline int32_t clothLatticeCount(float size)
+{
+    return static_cast<int32_t>(size / (2.0f * g_buffer->m_commonParam.radius)) - 1;
+}
+
 void createParticleCloth(glm::vec3 center, float size1, float size2, int32_t axis, glm::vec3 velocity,  int32_t phaseID)
 {
+    if (describePrimitive("cloth", center, size1, size2, axis, velocity, phaseID)) return;
     if (!checkGlobalVariable()) SPDLOG_ERROR("failed to create particle plane.");
-    glm::vec3 AnalysisBoxMinPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.minPoint + g_buffer->m_commonParam.radius;
-    glm::vec3 AnalysisBoxMaxPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.maxPoint - g_buffer->m_commonParam.radius;
+    float radius = g_buffer->m_commonParam.radius;
+    glm::vec3 AnalysisBoxMinPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.minPoint + radius;
+    glm::vec3 AnalysisBoxMaxPointConsideringRadius = g_buffer->m_commonParam.AnalysisBox.maxPoint - radius;
     boxPoint AnalysisBoxConsideringRadius = boxPoint(AnalysisBoxMinPointConsideringRadius, AnalysisBoxMaxPointConsideringRadius);
 
     if ((axis == 0)&&(!isInsideOfBox(center + glm::vec3(0, 0.5*size1, 0.5*size2), AnalysisBoxConsideringRadius))) SPDLOG_ERROR("failed to create particle plane.");
@@ -160,149 +251,231 @@ void createParticleCloth(glm::vec3 center, float size1, float size2, int32_t axi
     if ((axis == 1)&&(!isInsideOfBox(center - glm::vec3(0.5*size1, 0, 0.5*size2), AnalysisBoxConsideringRadius))) SPDLOG_ERROR("failed to create particle plane.");
     if ((axis == 2)&&(!isInsideOfBox(center - glm::vec3(0.5*size1, 0.5*size2, 0), AnalysisBoxConsideringRadius))) SPDLOG_ERROR("failed to create particle plane.");
 
-    int32_t num1 = static_cast<int32_t>( size1 / (2.0f * g_buffer->m_commonParam.radius)) - 1;
-    int32_t num2 = static_cast<int32_t>( size2 / (2.0f * g_buffer->m_commonParam.radius)) - 1;
-    int32_t nParticlesBeforeAdded = g_buffer->GetNumParticles();
+    int32_t num1 = clothLatticeCount(size1);
+    int32_t num2 = clothLatticeCount(size2);
 
-    int32_t nParticles = num1*num2;
+    // every lattice point is a particle, so all counts are known up front
+    int32_t nParticles    = num1*num2;
     int32_t nStretchLines = (num1-1) * (num2) + (num1) * (num2-1);
     int32_t nBendLines    = (num1-2) * (num2) + (num1) * (num2-2) ;
     int32_t nShearLines   = 2 * (num1-1) * (num2-1);
     int32_t nTriangles    = 2 * (num1-1) * (num2-1);
 
-    g_buffer->m_positions.reserve(nParticles + g_buffer->GetNumParticles());
-    g_buffer->m_velocities.reserve(nParticles + g_buffer->GetNumParticles());
-    g_buffer->m_phases.reserve(nParticles + g_buffer->GetNumParticles());
-    g_buffer->m_colorValues.reserve(nParticles + g_buffer->GetNumParticles());
-
-    g_buffer->m_stretchID.reserve(2 * (nStretchLines + g_buffer->GetNumStretchLines()) );
-    g_buffer->m_bendID.reserve(2 * (nBendLines  + g_buffer->GetNumBendLines()) );       
-    g_buffer->m_shearID.reserve(2 * (nShearLines + g_buffer->GetNumShearLines()) );                   
-    g_buffer->m_triangleID.reserve(3 * (nTriangles + g_buffer->GetNumTriangles()) );       
-    
     SPDLOG_INFO("{} {} {} {} {}", num1, num2, nStretchLines, nBendLines, nShearLines);
 
-    glm::vec3 tmp_position;
-    for (int32_t ii = 0 ; ii < num1 ; ++ii)
-    {
-        for (int32_t jj = 0 ; jj < num2 ; ++jj)
-        {   
-            if ( axis == 0 )
-                tmp_position = center + g_buffer->m_commonParam.radius + glm::vec3(0.0, ii*2.0f*g_buffer->m_commonParam.radius, jj*2.0f*g_buffer->m_commonParam.radius);
-            else if ( axis == 1 )
-                tmp_position = center + g_buffer->m_commonParam.radius + glm::vec3(ii*2.0f*g_buffer->m_commonParam.radius, 0.0, jj*2.0f*g_buffer->m_commonParam.radius);
-            else if ( axis == 2 )
-                tmp_position = center + g_buffer->m_commonParam.radius + glm::vec3(ii*2.0f*g_buffer->m_commonParam.radius, jj*2.0f*g_buffer->m_commonParam.radius, 0.0);
-
-            if (isInsideOfBox(tmp_position, AnalysisBoxConsideringRadius))
-            {
-                g_buffer->m_positions.push_back(tmp_position);
-                g_buffer->m_velocities.push_back(velocity);
-                g_buffer->m_phases.push_back(phaseID);
-                g_buffer->m_colorValues.push_back(static_cast<float>(jj));
-            }
-        }
-    }
+    int32_t nParticlesBeforeAdded = resizeParticles(nParticles);
+    ClothConstraints &constraints = g_buffer->m_clothConstraints;
+    const PhaseParameters &phase  = g_buffer->m_phaseParam[phaseID];
+    int32_t stretchOffset  = constraints.Size();
+    int32_t bendOffset     = stretchOffset + nStretchLines;
+    int32_t shearOffset    = bendOffset + nBendLines;
+    int32_t triangleOffset = 3 * g_buffer->GetNumTriangles();
+    constraints.Resize(shearOffset + nShearLines);
+    g_buffer->m_triangleID.resize(triangleOffset + 3 * nTriangles);
+
+    auto particleID = [&](int32_t ii, int32_t jj) -> int32_t { return nParticlesBeforeAdded + ii*num2 + jj; };
 
-    // stretchIDs
-    int32_t tmpN = 0;
-    for (int32_t ii = 0 ; ii < num1 ; ++ii)
+    // lines along jj come first, then lines along ii
+    int32_t nStretchRowLines = num1 * (num2-1);
+    int32_t nBendRowLines    = num1 * (num2-2);
+
+    parallelFor(num1, [&](int32_t ii)
     {
         for (int32_t jj = 0 ; jj < num2 ; ++jj)
-        {   
+        {
+            int32_t idx = particleID(ii, jj);
+            g_buffer->m_positions[idx]   = planePosition(center, ii, jj, axis, radius);
+            g_buffer->m_velocities[idx]  = velocity;
+            g_buffer->m_phases[idx]      = phaseID;
+            g_buffer->m_colorValues[idx] = static_cast<float>(jj);
+
+            // stretch constraints
             if (jj < num2 - 1)
-            {
-                g_buffer->m_stretchID.push_back(nParticlesBeforeAdded + ii*num2 + jj);
-                g_buffer->m_stretchID.push_back(nParticlesBeforeAdded + ii*num2 + jj + 1);
-                ++tmpN;
-            }
+                constraints.Set(stretchOffset + ii*(num2-1) + jj, idx, particleID(ii, jj+1), phase.stretchCompliance, STRETCH_CONSTRAINT);
             if (ii < num1 - 1)
-            {
-                g_buffer->m_stretchID.push_back(nParticlesBeforeAdded + ii*num2 + jj);
-                g_buffer->m_stretchID.push_back(nParticlesBeforeAdded + (ii+1)*num2 + jj);
-                ++tmpN;
-            }
-        }
-    }
-    if (tmpN != nStretchLines) SPDLOG_ERROR("failed to create particle plane. stretchLines {} {}", tmpN, nStretchLines);
+                constraints.Set(stretchOffset + nStretchRowLines + ii*num2 + jj, idx, particleID(ii+1, jj), phase.stretchCompliance, STRETCH_CONSTRAINT);
 
-    // BendIDs
-    tmpN = 0;
-    for (int32_t ii = 0 ; ii < num1 ; ++ii)
-    {
-        for (int32_t jj = 0 ; jj < num2 ; ++jj)
-        {   
+            // bend constraints
             if (jj < num2 - 2)
-            {
-                g_buffer->m_bendID.push_back(nParticlesBeforeAdded + ii*num2 + jj);
-                g_buffer->m_bendID.push_back(nParticlesBeforeAdded + ii*num2 + jj + 2);
-                ++tmpN;
-            }
+                constraints.Set(bendOffset + ii*(num2-2) + jj, idx, particleID(ii, jj+2), phase.bendCompliance, BEND_CONSTRAINT);
             if (ii < num1 - 2)
-            {
-                g_buffer->m_bendID.push_back(nParticlesBeforeAdded + ii*num2 + jj);
-                g_buffer->m_bendID.push_back(nParticlesBeforeAdded + (ii+2)*num2 + jj);
-                ++tmpN;
-            }
+                constraints.Set(bendOffset + nBendRowLines + ii*num2 + jj, idx, particleID(ii+2, jj), phase.bendCompliance, BEND_CONSTRAINT);
+
+            if ((ii == num1 - 1) || (jj == num2 - 1)) continue;
+
+            // shear constraints
+            int32_t cell = ii*(num2-1) + jj;
+            constraints.Set(shearOffset + 2*cell,     idx,                  particleID(ii+1, jj+1), phase.shearCompliance, SHEAR_CONSTRAINT);
+            constraints.Set(shearOffset + 2*cell + 1, particleID(ii+1, jj), particleID(ii, jj+1),   phase.shearCompliance, SHEAR_CONSTRAINT);
+
+            // triIDs
+            int32_t* tri = &g_buffer->m_triangleID[triangleOffset + 6*cell];
+            tri[0] = idx; tri[1] = particleID(ii+1, jj+1); tri[2] = particleID(ii, jj+1);
+            tri[3] = idx; tri[4] = particleID(ii+1, jj+1); tri[5] = particleID(ii+1, jj);
         }
-    }
-    if (tmpN != nBendLines) SPDLOG_ERROR("failed to create particle plane. nBendLines {} {}", tmpN, nBendLines);
+    });
+    constraints.ComputeRestLengths(g_buffer->m_positions, stretchOffset);
 
+    SPDLOG_INFO("a plane generated");
+}
+
+// Cloth from any triangle mesh : welded vertices become particles, mesh edges become
+// stretch constraints and the far vertices of two triangles sharing an edge become
+// bend constraints. Particles are renumbered by reverse Cuthill-McKee for locality.
+void createParticleClothFromMesh(const char* filename, glm::vec3 translation, float scale, glm::vec3 velocity, int32_t phaseID)
+{
+    std::error_code error;
+    int64_t fileSize = static_cast<int64_t>(std::filesystem::file_size(filename, error));
+    if (describePrimitive("mesh cloth", filename, fileSize, translation, scale, velocity, phaseID)) return;
+    if (!checkGlobalVariable()) SPDLOG_ERROR("failed to create particle cloth.");
 
-    // shearIDs
-    tmpN = 0;
-    for (int32_t ii = 0 ; ii < num1-1 ; ++ii)
+    auto model = Model::LoadGeometry(filename);
+    if (!model)
     {
-        for (int32_t jj = 0 ; jj < num2-1 ; ++jj)
-        {   
-            if (((ii*num2 + jj) >= num1*num2)||
-                (((ii+1)*num2 + jj + 1) >= num1*num2)||
-                (((ii+1)*num2 + jj) >= num1*num2)||
-                ((ii*num2 + jj + 1) >= num1*num2)) printf("False\n\n\n");
-            g_buffer->m_shearID.push_back(nParticlesBeforeAdded + ii*num2 + jj);
-            g_buffer->m_shearID.push_back(nParticlesBeforeAdded + (ii+1)*num2 + jj + 1);
-            ++tmpN;
-            
-            g_buffer->m_shearID.push_back(nParticlesBeforeAdded + (ii+1)*num2 + jj);
-            g_buffer->m_shearID.push_back(nParticlesBeforeAdded + ii*num2 + jj + 1);
-            ++tmpN;
-
-            
+        SPDLOG_ERROR("failed to create particle cloth from {}", filename);
+        return;
+    }
+    const std::vector<glm::vec3> &vertices = model->GetPositions();
+    const std::vector<uint32_t>  &indices  = model->GetIndices();
+    int32_t nVertices  = static_cast<int32_t>(vertices.size());
+    int32_t nTriangles = static_cast<int32_t>(indices.size() / 3);
+
+    // every half edge as (lower vertex, higher vertex, opposite vertex), sorted so twins are adjacent
+    struct HalfEdge { int32_t v0, v1, opposite; };
+    std::vector<HalfEdge> halfEdges(3 * nTriangles);
+    for (int32_t t = 0; t < nTriangles; ++t)
+    {
+        for (int32_t e = 0; e < 3; ++e)
+        {
+            int32_t a = indices[3*t + e];
+            int32_t b = indices[3*t + (e+1)%3];
+            int32_t c = indices[3*t + (e+2)%3];
+            halfEdges[3*t + e] = { std::min(a, b), std::max(a, b), c };
         }
     }
-    if (tmpN != nShearLines) SPDLOG_ERROR("failed to create particle plane. nShearLines {} {}", tmpN, nShearLines);
+    std::sort(halfEdges.begin(), halfEdges.end(), [](const HalfEdge &l, const HalfEdge &r) {
+        return (l.v0 != r.v0) ? (l.v0 < r.v0) : (l.v1 < r.v1);
+    });
 
+    const PhaseParameters &phase = g_buffer->m_phaseParam[phaseID];
+    ClothConstraints local;
+    for (size_t first = 0; first < halfEdges.size(); )
+    {
+        size_t last = first + 1;
+        while ((last < halfEdges.size()) && (halfEdges[last].v0 == halfEdges[first].v0) && (halfEdges[last].v1 == halfEdges[first].v1)) ++last;
+
+        local.Append(halfEdges[first].v0, halfEdges[first].v1, phase.stretchCompliance, STRETCH_CONSTRAINT);
+        // manifold interior edge
+        if ((last - first == 2) && (halfEdges[first].opposite != halfEdges[first+1].opposite))
+            local.Append(halfEdges[first].opposite, halfEdges[first+1].opposite, phase.bendCompliance, BEND_CONSTRAINT);
+        first = last;
+    }
+
+    ClothAdjacency adjacency;
+    adjacency.Build(local, nVertices);
+    std::vector<int32_t> permutation = adjacency.ReverseCuthillMcKee();
 
-    // triIDs
-    tmpN = 0;
-    for (int32_t ii = 0 ; ii < num1-1 ; ++ii)
+    int32_t nParticlesBeforeAdded = resizeParticles(nVertices);
+    parallelFor(nVertices, [&](int32_t ii)
     {
-        for (int32_t jj = 0 ; jj < num2-1 ; ++jj)
-        {   
-            g_buffer->m_triangleID.push_back(nParticlesBeforeAdded + ii*num2 + jj);
-            g_buffer->m_triangleID.push_back(nParticlesBeforeAdded + (ii+1)*num2 + jj + 1);
-            g_buffer->m_triangleID.push_back(nParticlesBeforeAdded + ii*num2 + jj + 1);
-            ++tmpN;
-            
-            g_buffer->m_triangleID.push_back(nParticlesBeforeAdded + ii*num2 + jj);
-            g_buffer->m_triangleID.push_back(nParticlesBeforeAdded + (ii+1)*num2 + jj + 1);
-            g_buffer->m_triangleID.push_back(nParticlesBeforeAdded + (ii+1)*num2 + jj);
-            ++tmpN;
+        int32_t idx = nParticlesBeforeAdded + permutation[ii];
+        g_buffer->m_positions[idx]   = translation + scale * vertices[ii];
+        g_buffer->m_velocities[idx]  = velocity;
+        g_buffer->m_phases[idx]      = phaseID;
+        g_buffer->m_colorValues[idx] = 0.0f;
+    });
+
+    for (int32_t &id : permutation) id += nParticlesBeforeAdded;
+    local.Renumber(permutation);
+
+    ClothConstraints &constraints = g_buffer->m_clothConstraints;
+    int32_t constraintOffset = constraints.Size();
+    constraints.Resize(constraintOffset + local.Size());
+    for (int32_t c = 0; c < local.Size(); ++c)
+        constraints.Set(constraintOffset + c, local.id0[c], local.id1[c], local.compliance[c], static_cast<ClothConstraintType>(local.type[c]));
+    constraints.ComputeRestLengths(g_buffer->m_positions, constraintOffset);
+
+    int32_t triangleOffset = 3 * g_buffer->GetNumTriangles();
+    g_buffer->m_triangleID.resize(triangleOffset + 3 * nTriangles);
+    for (int32_t k = 0; k < 3 * nTriangles; ++k)
+        g_buffer->m_triangleID[triangleOffset + k] = permutation[indices[k]];
+
+    SPDLOG_INFO("a mesh cloth generated : {} particles, {} constraints", nVertices, local.Size());
+}
 
-        }
-    }
-    if (tmpN != nTriangles) SPDLOG_ERROR("failed to create particle plane. nTriangles {} {}", tmpN, nTriangles);
+// Collider from a closed triangle mesh, voxelized into an SDF of radius sized cells.
+// Colliders are no particle state : they are added while the state cache describes the scene too,
+// so a scene loaded from the cache keeps them. Returns the motion of the collider, static until
+// keyframes are added, nullptr on failure.
+ColliderMotion* createSdfCollider(const char* filename, glm::vec3 translation, float scale)
+{
+    std::error_code error;
+    int64_t fileSize = static_cast<int64_t>(std::filesystem::file_size(filename, error));
+    describePrimitive("sdf collider", filename, fileSize, translation, scale);
+    if (!checkGlobalVariable()) SPDLOG_ERROR("failed to create sdf collider.");
 
+    auto model = Model::LoadGeometry(filename);
+    if (!model)
+    {
+        SPDLOG_ERROR("failed to create sdf collider from {}", filename);
+        return nullptr;
+    }
+    std::vector<glm::vec3> vertices = model->GetPositions();
+    for (glm::vec3 &vertex : vertices)
+        vertex = translation + scale * vertex;
+
+    // the band covers a particle radius plus the cells the trilinear gradient reads
+    float radius = g_buffer->m_commonParam.radius;
+    SdfCollider collider;
+    if (!LoadOrVoxelizeSdf(vertices, model->GetIndices(), radius, 4.0f * radius, "../cache/sdf", collider))
+        return nullptr;
+    g_buffer->m_colliders.push_back(std::move(collider));
+
+    SPDLOG_INFO("a sdf collider generated : {} triangles", model->GetIndices().size() / 3);
+    return &g_buffer->m_colliders.back().motion;
+}
 
-    g_buffer->m_positions.shrink_to_fit();
-    g_buffer->m_velocities.shrink_to_fit();
-    g_buffer->m_phases.shrink_to_fit();
-    g_buffer->m_colorValues.shrink_to_fit();
+// Collider from any triangle mesh, open or thin ones included : particles keep a radius away from
+// its triangles, found through a BVH. Added while the state cache describes the scene, like the SDF ones.
+ColliderMotion* createMeshCollider(const char* filename, glm::vec3 translation, float scale)
+{
+    std::error_code error;
+    int64_t fileSize = static_cast<int64_t>(std::filesystem::file_size(filename, error));
+    describePrimitive("mesh collider", filename, fileSize, translation, scale);
+    if (!checkGlobalVariable()) SPDLOG_ERROR("failed to create mesh collider.");
 
-    g_buffer->m_stretchID.shrink_to_fit();
-    g_buffer->m_bendID.shrink_to_fit();  
-    g_buffer->m_shearID.shrink_to_fit();              
-    g_buffer->m_triangleID.shrink_to_fit();
+    auto model = Model::LoadGeometry(filename);
+    if (!model)
+    {
+        SPDLOG_ERROR("failed to create mesh collider from {}", filename);
+        return nullptr;
+    }
+    MeshCollider collider;
+    collider.vertices = model->GetPositions();
+    for (glm::vec3 &vertex : collider.vertices)
+        vertex = translation + scale * vertex;
+    const std::vector<uint32_t> &indices = model->GetIndices();
+    collider.triangles.assign(indices.begin(), indices.end());
+    BuildBvh(collider);
+
+    SPDLOG_INFO("a mesh collider generated : {} triangles, {} bvh nodes", collider.triangles.size() / 3, collider.nodes.size());
+    g_buffer->m_meshColliders.push_back(std::move(collider));
+    return &g_buffer->m_meshColliders.back().motion;
+}
 
-    SPDLOG_INFO("a plane generated");
+// Turn at a constant rate about a vertical axis through pivot : keyframes every third of a turn, looping.
+// The collider mesh is given around the origin, the pivot places it.
+void spinCollider(ColliderMotion* motion, glm::vec3 pivot, float turnsPerSecond, float friction)
+{
+    if (!motion || (turnsPerSecond <= 0.0f))
+        return;
+    float period = 1.0f / turnsPerSecond;
+    motion->keyframes.clear();
+    for (int32_t k = 0; k <= 3; ++k)
+    {
+        float angle = glm::radians(120.0f * k);
+        motion->keyframes.push_back({period * k / 3.0f, pivot, glm::angleAxis(angle, glm::vec3(0.0f, 1.0f, 0.0f))});
+    }
+    motion->loop = true;
+    motion->friction = friction;
 }
@@ -15,7 +15,7 @@ public :
         g_buffer->m_commonParam.dt      = 0.001f;   
 
         g_buffer->m_commonParam.iterationNumber = 1;
-	    g_buffer->m_commonParam.relaxationParameter = powf(3.3f/g_buffer->m_commonParam.radius,2.0f);
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(6.0f);
 	    g_buffer->m_commonParam.scorrK              = 0.00001f;
 	    g_buffer->m_commonParam.scorrDq             = 0.3f;
 
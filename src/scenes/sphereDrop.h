@@ -15,9 +15,11 @@ public :
         g_buffer->m_commonParam.dt      = 0.001f;   
 
         g_buffer->m_commonParam.iterationNumber = 1;
-	    g_buffer->m_commonParam.relaxationParameter = powf(3.3f/g_buffer->m_commonParam.radius,2.0f);
+	    g_buffer->m_commonParam.densityCompliance   = soundSpeedCompliance(6.0f);
 	    g_buffer->m_commonParam.scorrK              = 0.00001f;
 	    g_buffer->m_commonParam.scorrDq             = 0.3f;
+	    g_buffer->m_commonParam.xsphViscosity       = 0.05f;
+	    g_buffer->m_commonParam.vorticityEpsilon    = 0.001f;
 
         g_buffer->m_commonParam.gravity             = glm::vec3(0.0f, -9.81f, 0.0f);
         g_buffer->m_commonParam.AnalysisBox         = boxPoint(glm::vec3(-0.7f, 0.0f, -0.7f), glm::vec3(0.7f, 2.0f, 0.7f));
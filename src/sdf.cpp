@@ -0,0 +1,204 @@
+#include "sdf.h"
+#include "hostworkers.h"
+#include "HiPhysics/hiphysicsGeometry.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+// bump whenever the voxelization or the file layout change
+uint32_t const sdfCacheVersion = 1;
+
+// edge function of the (y, z) projection : twice the signed area of (p0, p1, p)
+static double EdgeYZ(const glm::vec3 &p0, const glm::vec3 &p1, double y, double z)
+{
+    return (double(p1.y) - p0.y) * (z - p0.z) - (double(p1.z) - p0.z) * (y - p0.y);
+}
+
+// a point on an edge belongs to one of the two triangles sharing it
+static bool OwnsEdgeYZ(const glm::vec3 &p0, const glm::vec3 &p1)
+{
+    return (p1.z > p0.z) || ((p1.z == p0.z) && (p1.y < p0.y));
+}
+
+void VoxelizeSdf(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+                 float cellSize, float bandWidth, SdfCollider &collider)
+{
+    glm::vec3 minPoint = positions.front();
+    glm::vec3 maxPoint = positions.front();
+    for (const glm::vec3 &p : positions)
+    {
+        minPoint = glm::min(minPoint, p);
+        maxPoint = glm::max(maxPoint, p);
+    }
+
+    // one more cell than the band on each side, so the trilinear gradient never reads past the grid
+    float margin = bandWidth + cellSize;
+    collider.origin    = minPoint - glm::vec3(margin);
+    collider.cellSize  = cellSize;
+    collider.bandWidth = bandWidth;
+    glm::vec3 extent = (maxPoint - minPoint + glm::vec3(2.0f * margin)) / cellSize;
+    collider.dims = glm::ivec3(static_cast<int32_t>(ceilf(extent.x)) + 1,
+                               static_cast<int32_t>(ceilf(extent.y)) + 1,
+                               static_cast<int32_t>(ceilf(extent.z)) + 1);
+    const glm::ivec3 dims = collider.dims;
+    collider.distances.assign(int64_t(dims.x) * dims.y * dims.z, bandWidth);
+
+    auto voxel = [&](int32_t i, int32_t j, int32_t k) {
+        return collider.origin + cellSize * glm::vec3(float(i), float(j), float(k));
+    };
+    auto clampIndex = [](float g, int32_t n) { return std::clamp(static_cast<int32_t>(g), 0, n - 1); };
+    int32_t nTriangles = static_cast<int32_t>(indices.size() / 3);
+
+    // every worker owns a range of z slices : it writes its voxels only
+    HostWorkers::Get().Run(dims.z, [&](int32_t, int64_t kBegin, int64_t kEnd) {
+        // unsigned distance within the band
+        for (int32_t t = 0; t < nTriangles; ++t)
+        {
+            glm::vec3 a = positions[indices[3*t]];
+            glm::vec3 b = positions[indices[3*t + 1]];
+            glm::vec3 c = positions[indices[3*t + 2]];
+            glm::vec3 lo = (glm::min(glm::min(a, b), c) - glm::vec3(bandWidth) - collider.origin) / cellSize;
+            glm::vec3 hi = (glm::max(glm::max(a, b), c) + glm::vec3(bandWidth) - collider.origin) / cellSize;
+            int32_t k0 = std::max<int32_t>(clampIndex(floorf(lo.z), dims.z), kBegin);
+            int32_t k1 = std::min<int32_t>(clampIndex(ceilf(hi.z), dims.z), kEnd - 1);
+            for (int32_t k = k0; k <= k1; ++k)
+            for (int32_t j = clampIndex(floorf(lo.y), dims.y); j <= clampIndex(ceilf(hi.y), dims.y); ++j)
+            for (int32_t i = clampIndex(floorf(lo.x), dims.x); i <= clampIndex(ceilf(hi.x), dims.x); ++i)
+            {
+                glm::vec3 p = voxel(i, j, k);
+                float &distance = collider.distances[i + int64_t(dims.x) * (j + int64_t(dims.y) * k)];
+                distance = std::min(distance, glm::length(p - ClosestPointOnTriangle(p, a, b, c)));
+            }
+        }
+
+        // x of the mesh crossings along every row of voxels
+        int64_t nRows = int64_t(dims.y) * (kEnd - kBegin);
+        std::vector<std::vector<float>> crossings(nRows);
+        for (int32_t t = 0; t < nTriangles; ++t)
+        {
+            glm::vec3 a = positions[indices[3*t]];
+            glm::vec3 b = positions[indices[3*t + 1]];
+            glm::vec3 c = positions[indices[3*t + 2]];
+            double area = EdgeYZ(a, b, c.y, c.z);
+            if (area == 0.0)
+                continue;   // edge on along x
+            if (area < 0.0)
+            {
+                std::swap(b, c);
+                area = -area;
+            }
+            glm::vec3 lo = (glm::min(glm::min(a, b), c) - collider.origin) / cellSize;
+            glm::vec3 hi = (glm::max(glm::max(a, b), c) - collider.origin) / cellSize;
+            int32_t k0 = std::max<int32_t>(clampIndex(ceilf(lo.z), dims.z), kBegin);
+            int32_t k1 = std::min<int32_t>(clampIndex(floorf(hi.z), dims.z), kEnd - 1);
+            for (int32_t k = k0; k <= k1; ++k)
+            for (int32_t j = clampIndex(ceilf(lo.y), dims.y); j <= clampIndex(floorf(hi.y), dims.y); ++j)
+            {
+                glm::vec3 p = voxel(0, j, k);
+                double wa = EdgeYZ(b, c, p.y, p.z);
+                double wb = EdgeYZ(c, a, p.y, p.z);
+                double wc = EdgeYZ(a, b, p.y, p.z);
+                if ((wa < 0.0) || (wb < 0.0) || (wc < 0.0)) continue;
+                if ((wa == 0.0) && !OwnsEdgeYZ(b, c)) continue;
+                if ((wb == 0.0) && !OwnsEdgeYZ(c, a)) continue;
+                if ((wc == 0.0) && !OwnsEdgeYZ(a, b)) continue;
+                crossings[j + int64_t(dims.y) * (k - kBegin)].push_back(float((wa * a.x + wb * b.x + wc * c.x) / area));
+            }
+        }
+
+        // inside after an odd number of crossings
+        for (int32_t k = kBegin; k < kEnd; ++k)
+        for (int32_t j = 0; j < dims.y; ++j)
+        {
+            std::vector<float> &row = crossings[j + int64_t(dims.y) * (k - kBegin)];
+            std::sort(row.begin(), row.end());
+            size_t passed = 0;
+            for (int32_t i = 0; i < dims.x; ++i)
+            {
+                float x = collider.origin.x + cellSize * i;
+                while ((passed < row.size()) && (row[passed] < x)) ++passed;
+                if (passed % 2 == 1)
+                    collider.distances[i + int64_t(dims.x) * (j + int64_t(dims.y) * k)] *= -1.0f;
+            }
+        }
+    });
+}
+
+static uint64_t HashSdfInput(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+                             float cellSize, float bandWidth)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    auto hashBytes = [&](const void *data, size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    hashBytes(&sdfCacheVersion, sizeof(uint32_t));
+    hashBytes(positions.data(), positions.size() * sizeof(glm::vec3));
+    hashBytes(indices.data(), indices.size() * sizeof(uint32_t));
+    hashBytes(&cellSize, sizeof(float));
+    hashBytes(&bandWidth, sizeof(float));
+    return hash;
+}
+
+bool LoadOrVoxelizeSdf(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+                       float cellSize, float bandWidth, const std::string &directory, SdfCollider &collider)
+{
+    if (positions.empty() || (indices.size() < 3) || (cellSize <= 0.0f))
+    {
+        SPDLOG_ERROR("failed to voxelize an empty mesh");
+        return false;
+    }
+
+    uint64_t key = HashSdfInput(positions, indices, cellSize, bandWidth);
+    std::string filename = fmt::format("{}/sdf_{:016x}.bin", directory, key);
+
+    std::ifstream fin(filename, std::ios::binary);
+    if (fin.is_open())
+    {
+        uint64_t fileKey = 0;
+        uint64_t count = 0;
+        fin.read(reinterpret_cast<char *>(&fileKey), sizeof(uint64_t));
+        fin.read(reinterpret_cast<char *>(&collider.origin), sizeof(glm::vec3));
+        fin.read(reinterpret_cast<char *>(&collider.cellSize), sizeof(float));
+        fin.read(reinterpret_cast<char *>(&collider.dims), sizeof(glm::ivec3));
+        fin.read(reinterpret_cast<char *>(&collider.bandWidth), sizeof(float));
+        fin.read(reinterpret_cast<char *>(&count), sizeof(uint64_t));
+        if (fin && (fileKey == key) && (count == uint64_t(collider.dims.x) * collider.dims.y * collider.dims.z))
+        {
+            collider.distances.resize(count);
+            fin.read(reinterpret_cast<char *>(collider.distances.data()), count * sizeof(float));
+            if (fin)
+            {
+                SPDLOG_INFO("load sdf collider from cache {}", filename);
+                return true;
+            }
+        }
+        SPDLOG_WARN("ignore stale sdf cache {}", filename);
+    }
+
+    VoxelizeSdf(positions, indices, cellSize, bandWidth, collider);
+    SPDLOG_INFO("sdf collider voxelized : {} x {} x {}", collider.dims.x, collider.dims.y, collider.dims.z);
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::ofstream fout(filename, std::ios::binary | std::ios::trunc);
+    if (error || !fout.is_open())
+    {
+        SPDLOG_WARN("failed to write sdf cache {}", filename);
+        return true;
+    }
+    uint64_t count = collider.distances.size();
+    fout.write(reinterpret_cast<const char *>(&key), sizeof(uint64_t));
+    fout.write(reinterpret_cast<const char *>(&collider.origin), sizeof(glm::vec3));
+    fout.write(reinterpret_cast<const char *>(&collider.cellSize), sizeof(float));
+    fout.write(reinterpret_cast<const char *>(&collider.dims), sizeof(glm::ivec3));
+    fout.write(reinterpret_cast<const char *>(&collider.bandWidth), sizeof(float));
+    fout.write(reinterpret_cast<const char *>(&count), sizeof(uint64_t));
+    fout.write(reinterpret_cast<const char *>(collider.distances.data()), count * sizeof(float));
+    return true;
+}
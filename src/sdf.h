@@ -0,0 +1,17 @@
+#ifndef __SDF_H__
+#define __SDF_H__
+
+#include "common.h"
+#include "simbuffer.h"
+
+// Voxelize a closed triangle mesh, in world space, into a narrow band SDF covering its bounds plus the band.
+// Distances are measured to the nearest triangle within the band, the sign comes from
+// the parity of the mesh crossings along x, so the mesh has to be watertight.
+void VoxelizeSdf(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+                 float cellSize, float bandWidth, SdfCollider &collider);
+
+// VoxelizeSdf through grids cached in directory, keyed by the mesh and the grid settings
+bool LoadOrVoxelizeSdf(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+                       float cellSize, float bandWidth, const std::string &directory, SdfCollider &collider);
+
+#endif // __SDF_H__
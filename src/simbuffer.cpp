@@ -1,4 +1,7 @@
 #include "simbuffer.h"
+#include "hostworkers.h"
+#include <algorithm>
+#include <numeric>
 
 
 SimBufferPtr SimBuffer::Create() {
@@ -9,14 +12,234 @@ SimBufferPtr SimBuffer::Create() {
 };
 
 bool SimBuffer::Init () {
+    // reserving commits no page, ResizeParticles places them
     m_positions.reserve(maxParticle); 
     m_velocities.reserve(maxParticle);
     m_phases.reserve(maxParticle);
 	m_colorValues.reserve(maxParticle);
+    m_invMasses.reserve(maxParticle);
 
     m_positions.resize(0);
     m_velocities.resize(0);
     m_phases.resize(0);
     m_colorValues.resize(0);
+    m_invMasses.resize(0);
     return true;
-}
\ No newline at end of file
+}
+
+void SimBuffer::ResizeParticles(int32_t count) {
+    int64_t first = m_positions.size();
+    m_positions.resize(count);
+    m_velocities.resize(count);
+    m_phases.resize(count);
+    m_colorValues.resize(count);
+    m_invMasses.resize(count);
+
+    // only the ranges holding new particles have work
+    HostWorkers::Get().RunChunks(count, [&](int32_t, int64_t begin, int64_t end) {
+        for (int64_t idx = std::max(begin, first); idx < end; ++idx)
+        {
+            m_positions[idx]   = glm::vec3(0.0f);
+            m_velocities[idx]  = glm::vec3(0.0f);
+            m_phases[idx]      = 0;
+            m_colorValues[idx] = 0.0f;
+            m_invMasses[idx]   = 1.0f;
+        }
+    });
+}
+
+void SimBuffer::ApplyFixedConstraints() {
+    m_invMasses.resize(m_positions.size(), 1.0f);
+
+    int64_t count = m_positions.size();
+    HostWorkers::Get().RunChunks(count, [&](int32_t, int64_t begin, int64_t end) {
+        for (const auto& box : m_commonParam.fixedBox)
+        {
+            for (int64_t idx = begin; idx < end; ++idx)
+            {
+                const glm::vec3& p = m_positions[idx];
+                if (glm::all(glm::greaterThanEqual(p, box.minPoint)) && glm::all(glm::lessThanEqual(p, box.maxPoint)))
+                    m_invMasses[idx] = 0.0f;
+            }
+        }
+    });
+
+    for (int32_t idx : m_fixedID)
+    {
+        if ((idx < 0) || (idx >= static_cast<int32_t>(m_positions.size())))
+        {
+            SPDLOG_ERROR("fixed particle {} is out of range", idx);
+            continue;
+        }
+        m_invMasses[idx] = 0.0f;
+    }
+}
+
+
+void ClothConstraints::Resize(int32_t count) {
+    id0.resize(count);
+    id1.resize(count);
+    restLength.resize(count);
+    compliance.resize(count);
+    type.resize(count);
+}
+
+void ClothConstraints::Set(int32_t c, int32_t i0, int32_t i1, float alpha, ClothConstraintType t) {
+    id0[c]       = i0;
+    id1[c]       = i1;
+    restLength[c]= 0.0f;
+    compliance[c]= alpha;
+    type[c]      = t;
+}
+
+void ClothConstraints::Append(int32_t i0, int32_t i1, float alpha, ClothConstraintType t) {
+    Resize(Size() + 1);
+    Set(Size() - 1, i0, i1, alpha, t);
+}
+
+void ClothConstraints::ComputeRestLengths(const ParticleArray<glm::vec3>& positions, int32_t first) {
+    for (int32_t c = first; c < Size(); ++c)
+        restLength[c] = glm::length(positions[id1[c]] - positions[id0[c]]);
+}
+
+std::vector<int32_t> ClothConstraints::SortByColor(int32_t nParticles) {
+    int32_t count = Size();
+
+    // visit constraints by their lowest particle so each color stays vertex ordered
+    std::vector<int32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+        return std::min(id0[a], id1[a]) < std::min(id0[b], id1[b]);
+    });
+
+    // greedy coloring, usedColors[p][k] : particle p is touched by color k, grown on demand
+    std::vector<std::vector<bool>> usedColors(nParticles);
+    auto isUsed = [&](int32_t particle, int32_t color) {
+        const std::vector<bool> &used = usedColors[particle];
+        return (color < static_cast<int32_t>(used.size())) && used[color];
+    };
+    auto markUsed = [&](int32_t particle, int32_t color) {
+        std::vector<bool> &used = usedColors[particle];
+        if (color >= static_cast<int32_t>(used.size())) used.resize(color + 1, false);
+        used[color] = true;
+    };
+    std::vector<int32_t> colors(count);
+    int32_t nColors = 0;
+    for (int32_t c : order)
+    {
+        int32_t color = 0;
+        while (isUsed(id0[c], color) || isUsed(id1[c], color)) ++color;
+
+        colors[c] = color;
+        markUsed(id0[c], color);
+        markUsed(id1[c], color);
+        nColors = std::max(nColors, color + 1);
+    }
+
+    // counting sort by color, stable in the visiting order
+    std::vector<int32_t> offsets(nColors + 1, 0);
+    for (int32_t c = 0; c < count; ++c)
+        ++offsets[colors[c] + 1];
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    ClothConstraints sorted;
+    sorted.Resize(count);
+    std::vector<int32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (int32_t c : order)
+    {
+        int32_t dst = cursor[colors[c]]++;
+        sorted.id0[dst]        = id0[c];
+        sorted.id1[dst]        = id1[c];
+        sorted.restLength[dst] = restLength[c];
+        sorted.compliance[dst] = compliance[c];
+        sorted.type[dst]       = type[c];
+    }
+    *this = std::move(sorted);
+
+    return offsets;
+}
+
+void ClothConstraints::Renumber(const std::vector<int32_t>& permutation) {
+    for (int32_t c = 0; c < Size(); ++c)
+    {
+        id0[c] = permutation[id0[c]];
+        id1[c] = permutation[id1[c]];
+    }
+}
+
+void ClothAdjacency::Build(const ClothConstraints& constraints, int32_t nParticles) {
+    offsets.assign(nParticles + 1, 0);
+    for (int32_t c = 0; c < constraints.Size(); ++c)
+    {
+        ++offsets[constraints.id0[c] + 1];
+        ++offsets[constraints.id1[c] + 1];
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    ids.resize(offsets[nParticles]);
+    std::vector<int32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (int32_t c = 0; c < constraints.Size(); ++c)
+    {
+        ids[cursor[constraints.id0[c]]++] = constraints.id1[c];
+        ids[cursor[constraints.id1[c]]++] = constraints.id0[c];
+    }
+    for (int32_t i = 0; i < nParticles; ++i)
+        std::sort(ids.begin() + offsets[i], ids.begin() + offsets[i + 1]);
+}
+
+std::vector<int32_t> ClothAdjacency::ReverseCuthillMcKee() const {
+    int32_t nParticles = static_cast<int32_t>(offsets.size()) - 1;
+    std::vector<int32_t> order;
+    order.reserve(nParticles);
+    std::vector<bool> visited(nParticles, false);
+
+    // start every connected component from its lowest degree particle
+    std::vector<int32_t> seeds(nParticles);
+    std::iota(seeds.begin(), seeds.end(), 0);
+    std::stable_sort(seeds.begin(), seeds.end(), [&](int32_t a, int32_t b) { return Degree(a) < Degree(b); });
+
+    std::vector<int32_t> neighbors;
+    for (int32_t seed : seeds)
+    {
+        if (visited[seed]) continue;
+        visited[seed] = true;
+        size_t head = order.size();
+        order.push_back(seed);
+
+        // breadth first, visiting neighbors by increasing degree
+        while (head < order.size())
+        {
+            int32_t i = order[head++];
+            neighbors.clear();
+            for (int32_t k = offsets[i]; k < offsets[i + 1]; ++k)
+                if (!visited[ids[k]]) { visited[ids[k]] = true; neighbors.push_back(ids[k]); }
+            std::stable_sort(neighbors.begin(), neighbors.end(), [&](int32_t a, int32_t b) { return Degree(a) < Degree(b); });
+            order.insert(order.end(), neighbors.begin(), neighbors.end());
+        }
+    }
+
+    std::vector<int32_t> permutation(nParticles);
+    for (int32_t k = 0; k < nParticles; ++k)
+        permutation[order[k]] = nParticles - 1 - k;
+    return permutation;
+}
+
+ColliderKeyframe ColliderMotion::PoseAt(float time) const {
+    if (keyframes.empty())
+        return {time, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f)};
+
+    float duration = keyframes.back().time;
+    if (loop && (duration > 0.0f))
+        time = fmodf(time, duration);
+    if (time <= keyframes.front().time)
+        return keyframes.front();
+    if (time >= duration)
+        return keyframes.back();
+
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+                                 [](float t, const ColliderKeyframe& keyframe) { return t < keyframe.time; });
+    const ColliderKeyframe& a = *(next - 1);
+    const ColliderKeyframe& b = *next;
+    float s = (b.time > a.time) ? (time - a.time) / (b.time - a.time) : 1.0f;
+    return {time, glm::mix(a.translation, b.translation, s), glm::slerp(a.rotation, b.rotation, s)};
+}
@@ -2,6 +2,7 @@
 #define __SIMBUFFER_H__
 
 #include "common.h"
+#include <glm/gtc/quaternion.hpp>
 
 uint64_t const maxParticle = 1'000'000;
 
@@ -21,16 +22,39 @@ struct boxPoint {
 	};
 };
 
+// precision of the fluid density solve, fixed when the scene is loaded.
+// Positions and velocities stay float in every mode : the cloth, collider and render paths share them,
+// and they are touched once per substep where the multipliers are read and written every iteration.
+enum class Precision : int32_t
+{
+	SINGLE,			// float storage and compute
+	HALF_STORAGE,	// Lagrange multipliers stored as half, float compute
+	DOUBLE			// neighbor sums, kernel values and multipliers computed and stored in double, for validation runs
+};
+
 struct CommonParameters {
 	float radius;
 	float diameter = 2.0f * radius;
 	float H = 1.3f * diameter;
 	float dt;
-	float relaxationParameter;
+	float densityCompliance;	// XPBD compliance of the fluid density constraint, in s^2/m^2 (1/c^2 for a speed of sound c)
 	float scorrK;
 	float scorrDq;
+	float xsphViscosity;		// XSPH velocity smoothing, 0 : off
+	float vorticityEpsilon;		// vorticity confinement strength, 0 : off
 	glm::vec3 gravity;
 	int32_t iterationNumber;
+	int32_t substepNumber;		// dt is split in substeps, each with its own prediction
+	// adaptive time step : dt follows the CFL condition, steps are sub-cycled to land on frameDt
+	bool adaptiveDt;
+	float cflNumber;
+	float minDt;
+	float maxDt;
+	float frameDt;
+	Precision precision;
+	bool quantizedPositions;	// density and correction traversals read 16 bit cell-relative positions
+	float surfaceThreshold;		// |grad c| H / c above which a fluid particle is on the surface, for the renderer only
+	bool classifySurface;		// set by the renderer while it draws the surface particles only
 	boxPoint AnalysisBox;
 	std::vector<boxPoint> fixedBox;
 	
@@ -39,11 +63,23 @@ struct CommonParameters {
 		diameter(0.2f),
 		H(0.48f),
 		dt(0.1f),
-		relaxationParameter(0.0000001f),
+		densityCompliance(0.0000001f),
 		scorrK(0.01f),
 		scorrDq(0.1f),
+		xsphViscosity(0.0f),
+		vorticityEpsilon(0.0f),
 		gravity(glm::vec3(0.0f, -9.81f, 0.0f)),
 		iterationNumber(3),
+		substepNumber(1),
+		adaptiveDt(false),
+		cflNumber(0.4f),
+		minDt(0.00001f),
+		maxDt(0.01f),
+		frameDt(1.0f/60.0f),
+		precision(Precision::SINGLE),
+		quantizedPositions(false),
+		surfaceThreshold(0.75f),
+		classifySurface(false),
 		AnalysisBox(boxPoint(glm::vec3(0.0f), glm::vec3(1.0f)))
 		// fixedBox(nullptr)
 		{};
@@ -59,38 +95,148 @@ struct PhaseParameters {
 	StateOfMatter phaseType;
 	float density;
 	glm::vec3 color; 
+	// XPBD compliance of the cloth distance constraints, 0 : rigid
+	float stretchCompliance;
+	float bendCompliance;
+	float shearCompliance;
 	PhaseParameters() : 
 		phaseType(StateOfMatter::FLUID),
 		density(1000.0f), 
-		color(glm::vec3(1.0f,0.0f,0.0f))
+		color(glm::vec3(1.0f,0.0f,0.0f)),
+		stretchCompliance(0.0f),
+		bendCompliance(0.0f),
+		shearCompliance(0.0f)
 	{};
 };
 
+enum ClothConstraintType : int32_t
+{
+	STRETCH_CONSTRAINT,
+	BEND_CONSTRAINT,
+	SHEAR_CONSTRAINT
+};
+
+// Distance constraints of every cloth in the scene, stored as SoA.
+// Rest lengths are measured from the generated positions, so any topology works.
+struct ClothConstraints {
+	std::vector<int32_t> id0;
+	std::vector<int32_t> id1;
+	std::vector<float>   restLength;
+	std::vector<float>   compliance;
+	std::vector<int32_t> type;		// ClothConstraintType
+
+	int32_t Size() const { return id0.size(); }
+	void Resize(int32_t count);
+	void Clear() { Resize(0); }
+	void Set(int32_t c, int32_t i0, int32_t i1, float alpha, ClothConstraintType t);
+	void Append(int32_t i0, int32_t i1, float alpha, ClothConstraintType t);
+	// measure the rest length of constraints [first, Size()) from positions
+	void ComputeRestLengths(const ParticleArray<glm::vec3>& positions, int32_t first);
+	// reorder so that constraints of one color share no particle, each color sorted by
+	// its lowest particle ID; returns the first constraint of each color (+ the end)
+	std::vector<int32_t> SortByColor(int32_t nParticles);
+	// rename particle IDs : newID = permutation[oldID]
+	void Renumber(const std::vector<int32_t>& permutation);
+};
+
+// Pose of a kinematic collider : world = translation + rotation * collider space
+struct ColliderKeyframe {
+	float time;
+	glm::vec3 translation;
+	glm::quat rotation;
+};
+
+// Rigid motion of a collider, its geometry stays in collider space and is never rebuilt.
+// Keyframes are sorted by time and interpolated linearly, rotations by slerp : keep consecutive
+// keyframes under half a turn apart. Without keyframes the collider is static.
+struct ColliderMotion {
+	std::vector<ColliderKeyframe> keyframes;
+	bool loop {false};		// restart at time 0 after the last keyframe, else hold the last pose
+	float friction {0.0f};	// share of the slip along the surface removed at a contact, 1 : carried along
+
+	bool IsKinematic() const { return !keyframes.empty(); }
+	ColliderKeyframe PoseAt(float time) const;
+};
+
+// Narrow band signed distance field of a mesh collider on a regular grid, negative inside.
+// Distances are exact within bandWidth of the surface and clamped to +-bandWidth further away.
+struct SdfCollider {
+	glm::vec3 origin;				// position of voxel (0, 0, 0)
+	float cellSize;
+	glm::ivec3 dims;
+	float bandWidth;
+	std::vector<float> distances;	// x fastest, then y, then z
+	ColliderMotion motion;			// the grid is in collider space
+};
+
+// Node of a flattened BVH in depth first order : the left child follows its parent.
+// A leaf holds the triangles [rightOrFirst, rightOrFirst + count).
+struct BvhNode {
+	glm::vec3 boundsMin;
+	int32_t rightOrFirst;	// inner node : index of the right child, leaf : first triangle
+	glm::vec3 boundsMax;
+	int32_t count;			// triangles of a leaf, 0 for an inner node
+};
+
+// deepest leaf of a BVH, the root at depth 0 : traversal stacks hold one far child per level
+int32_t const bvhMaxDepth = 64;
+
+// Triangle mesh collider for thin or detailed geometry, queried exactly through a SAH BVH
+struct MeshCollider {
+	std::vector<glm::vec3> vertices;	// collider space : refit the BVH after deforming them
+	std::vector<int32_t>   triangles;	// 3 vertex IDs per triangle, in BVH leaf order
+	std::vector<BvhNode>   nodes;
+	ColliderMotion motion;
+};
+
+// Compressed sparse row adjacency of the constraint graph :
+// the neighbors of particle i are ids[offsets[i]] ... ids[offsets[i+1] - 1]
+struct ClothAdjacency {
+	std::vector<int32_t> offsets;
+	std::vector<int32_t> ids;
+
+	void Build(const ClothConstraints& constraints, int32_t nParticles);
+	int32_t Degree(int32_t i) const { return offsets[i + 1] - offsets[i]; }
+	// bandwidth reducing order, permutation[oldID] = newID
+	std::vector<int32_t> ReverseCuthillMcKee() const;
+};
+
 CLASS_PTR(SimBuffer);
 class SimBuffer
 {
 public :
 	static SimBufferPtr Create();
 	int32_t GetNumParticles() { return m_positions.size(); }
-	int32_t GetNumStretchLines() { return m_stretchID.size()/2; }
-	int32_t GetNumBendLines() { return m_bendID.size()/2; }
-	int32_t GetNumShearLines() { return m_shearID.size()/2; }
+	int32_t GetNumClothConstraints() { return m_clothConstraints.Size(); }
 	int32_t GetNumTriangles() { return m_triangleID.size()/3; }
 
+	// grow or shrink the particle arrays, a new particle is first written by the host worker owning its range
+	void ResizeParticles(int32_t count);
+	// zero the inverse mass of particles inside fixedBox or listed in m_fixedID
+	void ApplyFixedConstraints();
+
 private :
     SimBuffer() {};
 	bool Init();
 
 public :
-	std::vector<glm::vec3>  m_positions;
-	std::vector<glm::vec3>  m_velocities;
-	std::vector<int32_t>    m_phases;
-	std::vector<float>  	m_colorValues;
-
-	std::vector<int32_t> 	m_stretchID;
-	std::vector<int32_t> 	m_bendID;
-	std::vector<int32_t> 	m_shearID;
+	ParticleArray<glm::vec3> m_positions;
+	ParticleArray<glm::vec3> m_velocities;
+	ParticleArray<int32_t>   m_phases;
+	ParticleArray<float>     m_colorValues;
+	ParticleArray<float>     m_invMasses;	// 0 : pinned particle
+
+	// filled by HiPhysics::GetMemory for the renderer, cleared when the particles change outside the solver
+	ParticleArray<int32_t>   m_gridOrder;		// particle IDs in the solver's grid order
+	ParticleArray<uint8_t>   m_surfaceFlags;	// in grid order, 0 : fluid particle away from the surface
+	ParticleArray<int32_t>   m_gridCells;		// in grid order, the solver cell of each particle
+
+	ClothConstraints		m_clothConstraints;
+	ClothAdjacency			m_clothAdjacency;	// built from m_clothConstraints at SetMemoryCloth
 	std::vector<int32_t> 	m_triangleID;
+	std::vector<int32_t> 	m_fixedID;		// explicitly pinned particles
+	std::vector<SdfCollider> m_colliders;	// closed mesh colliders, particles are pushed out of them
+	std::vector<MeshCollider> m_meshColliders;	// exact triangle colliders, particles keep a radius away
 
 	CommonParameters m_commonParam;
 	std::vector<PhaseParameters> m_phaseParam;
@@ -0,0 +1,202 @@
+#include "statecache.h"
+#include <filesystem>
+#include <fstream>
+
+// bump whenever the generators or the file layout change
+uint32_t const stateCacheVersion = 4;
+uint64_t const fnvOffsetBasis = 14695981039346656037ull;
+uint64_t const fnvPrime = 1099511628211ull;
+
+template <typename T, typename Allocator>
+static void WriteVector(std::ofstream &fout, const std::vector<T, Allocator> &values)
+{
+    uint64_t count = values.size();
+    fout.write(reinterpret_cast<const char *>(&count), sizeof(uint64_t));
+    fout.write(reinterpret_cast<const char *>(values.data()), count * sizeof(T));
+}
+
+template <typename T, typename Allocator>
+static bool ReadVector(std::ifstream &fin, std::vector<T, Allocator> &values)
+{
+    uint64_t count = 0;
+    fin.read(reinterpret_cast<char *>(&count), sizeof(uint64_t));
+    if (!fin || count > maxParticle * 16)
+        return false;
+    values.resize(count);
+    fin.read(reinterpret_cast<char *>(values.data()), count * sizeof(T));
+    return static_cast<bool>(fin);
+}
+
+StateCacheUPtr StateCache::Create(const std::string &directory)
+{
+    auto stateCache = StateCacheUPtr(new StateCache());
+    if (!stateCache->Init(directory))
+        return nullptr;
+    return std::move(stateCache);
+}
+
+bool StateCache::Init(const std::string &directory)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error)
+    {
+        SPDLOG_ERROR("failed to create state cache directory {}: {}", directory, error.message());
+        return false;
+    }
+    m_directory = directory;
+    return true;
+}
+
+void StateCache::BeginDescribe()
+{
+    m_describing = true;
+    m_hash = fnvOffsetBasis;
+    Hash(stateCacheVersion);
+}
+
+void StateCache::HashBytes(const void *data, size_t size)
+{
+    // FNV-1a
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        m_hash ^= bytes[i];
+        m_hash *= fnvPrime;
+    }
+}
+
+uint64_t StateCache::EndDescribe(const std::string &sceneName, const SimBufferPtr simBuffer, int32_t warmupSteps)
+{
+    HashBytes(sceneName.data(), sceneName.size());
+    Hash(warmupSteps);
+
+    // field by field, so padding and the fixedBox heap pointer stay out of the key
+    const CommonParameters &param = simBuffer->m_commonParam;
+    Hash(param.radius);
+    Hash(param.diameter);
+    Hash(param.H);
+    Hash(param.dt);
+    Hash(param.densityCompliance);
+    Hash(param.scorrK);
+    Hash(param.scorrDq);
+    Hash(param.xsphViscosity);
+    Hash(param.vorticityEpsilon);
+    Hash(param.gravity);
+    Hash(param.iterationNumber);
+    Hash(param.substepNumber);
+    Hash(param.adaptiveDt);
+    Hash(param.cflNumber);
+    Hash(param.minDt);
+    Hash(param.maxDt);
+    Hash(param.frameDt);
+    Hash(param.precision);
+    Hash(param.quantizedPositions);
+    Hash(param.AnalysisBox.minPoint);
+    Hash(param.AnalysisBox.maxPoint);
+    for (const auto &box : param.fixedBox)
+    {
+        Hash(box.minPoint);
+        Hash(box.maxPoint);
+    }
+
+    for (int32_t idx : simBuffer->m_fixedID)
+        Hash(idx);
+
+    for (const auto &phase : simBuffer->m_phaseParam)
+    {
+        Hash(phase.phaseType);
+        Hash(phase.density);
+        Hash(phase.color);
+        Hash(phase.stretchCompliance);
+        Hash(phase.bendCompliance);
+        Hash(phase.shearCompliance);
+    }
+
+    m_describing = false;
+    return m_hash;
+}
+
+std::string StateCache::GetFilename(uint64_t key) const
+{
+    return fmt::format("{}/{:016x}.bin", m_directory, key);
+}
+
+bool StateCache::Load(uint64_t key, SimBufferPtr simBuffer) const
+{
+    auto filename = GetFilename(key);
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin.is_open())
+        return false;
+
+    uint32_t version = 0;
+    uint64_t fileKey = 0;
+    fin.read(reinterpret_cast<char *>(&version), sizeof(uint32_t));
+    fin.read(reinterpret_cast<char *>(&fileKey), sizeof(uint64_t));
+    if (!fin || version != stateCacheVersion || fileKey != key)
+    {
+        SPDLOG_WARN("ignore stale state cache {}", filename);
+        return false;
+    }
+
+    // size the particle arrays ahead of the reads, so the host workers place their pages
+    uint64_t numParticles = 0;
+    std::streampos particlesStart = fin.tellg();
+    fin.read(reinterpret_cast<char *>(&numParticles), sizeof(uint64_t));
+    fin.seekg(particlesStart);
+    if (fin && (numParticles <= maxParticle))
+        simBuffer->ResizeParticles(static_cast<int32_t>(numParticles));
+
+    bool loaded = ReadVector(fin, simBuffer->m_positions)
+               && ReadVector(fin, simBuffer->m_velocities)
+               && ReadVector(fin, simBuffer->m_phases)
+               && ReadVector(fin, simBuffer->m_colorValues)
+               && ReadVector(fin, simBuffer->m_invMasses)
+               && ReadVector(fin, simBuffer->m_clothConstraints.id0)
+               && ReadVector(fin, simBuffer->m_clothConstraints.id1)
+               && ReadVector(fin, simBuffer->m_clothConstraints.restLength)
+               && ReadVector(fin, simBuffer->m_clothConstraints.compliance)
+               && ReadVector(fin, simBuffer->m_clothConstraints.type)
+               && ReadVector(fin, simBuffer->m_triangleID);
+    if (!loaded)
+    {
+        SPDLOG_ERROR("failed to read state cache {}", filename);
+        return false;
+    }
+
+    SPDLOG_INFO("load initial state from cache {}", filename);
+    return true;
+}
+
+bool StateCache::Save(uint64_t key, const SimBufferPtr simBuffer) const
+{
+    auto filename = GetFilename(key);
+    std::ofstream fout(filename, std::ios::binary | std::ios::trunc);
+    if (!fout.is_open())
+    {
+        SPDLOG_ERROR("failed to open state cache {}", filename);
+        return false;
+    }
+
+    fout.write(reinterpret_cast<const char *>(&stateCacheVersion), sizeof(uint32_t));
+    fout.write(reinterpret_cast<const char *>(&key), sizeof(uint64_t));
+    WriteVector(fout, simBuffer->m_positions);
+    WriteVector(fout, simBuffer->m_velocities);
+    WriteVector(fout, simBuffer->m_phases);
+    WriteVector(fout, simBuffer->m_colorValues);
+    WriteVector(fout, simBuffer->m_invMasses);
+    WriteVector(fout, simBuffer->m_clothConstraints.id0);
+    WriteVector(fout, simBuffer->m_clothConstraints.id1);
+    WriteVector(fout, simBuffer->m_clothConstraints.restLength);
+    WriteVector(fout, simBuffer->m_clothConstraints.compliance);
+    WriteVector(fout, simBuffer->m_clothConstraints.type);
+    WriteVector(fout, simBuffer->m_triangleID);
+    if (!fout)
+    {
+        SPDLOG_ERROR("failed to write state cache {}", filename);
+        return false;
+    }
+
+    SPDLOG_INFO("save initial state to cache {}", filename);
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef __STATECACHE_H__
+#define __STATECACHE_H__
+
+#include "common.h"
+#include "simbuffer.h"
+
+// Content-addressed cache of generated (and optionally pre-relaxed) initial states.
+// A scene is first "described" : Scene::Init runs while the particle generators only
+// hash their arguments. The hash of those arguments, CommonParameters and the phases
+// is the key of a binary file holding the particle state.
+CLASS_PTR(StateCache)
+class StateCache
+{
+public:
+    static StateCacheUPtr Create(const std::string &directory);
+
+    void BeginDescribe();
+    bool IsDescribing() const { return m_describing; }
+    void HashBytes(const void *data, size_t size);
+    template <typename T>
+    void Hash(const T &value) { HashBytes(&value, sizeof(T)); }
+    uint64_t EndDescribe(const std::string &sceneName, const SimBufferPtr simBuffer, int32_t warmupSteps);
+
+    bool Load(uint64_t key, SimBufferPtr simBuffer) const;
+    bool Save(uint64_t key, const SimBufferPtr simBuffer) const;
+
+private:
+    StateCache() {}
+    bool Init(const std::string &directory);
+    std::string GetFilename(uint64_t key) const;
+
+    std::string m_directory;
+    bool m_describing {false};
+    uint64_t m_hash {0};
+};
+
+#endif // __STATECACHE_H__
@@ -0,0 +1,100 @@
+#include "stream_buffer.h"
+
+StreamBufferUPtr StreamBuffer::Create(uint32_t bufferType, size_t stride, size_t capacity) {
+    auto buffer = StreamBufferUPtr(new StreamBuffer());
+    if (!buffer->Init(bufferType, stride, capacity))
+        return nullptr;
+    return std::move(buffer);
+}
+
+StreamBuffer::~StreamBuffer() {
+    for (GLsync &fence : m_fences)
+        if (fence)
+            glDeleteSync(fence);
+    if (m_buffer) {
+        if (m_mapped) {
+            Bind();
+            glUnmapBuffer(m_bufferType);
+        }
+        glDeleteBuffers(1, &m_buffer);
+    }
+}
+
+void StreamBuffer::Bind() const {
+    glBindBuffer(m_bufferType, m_buffer);
+}
+
+bool StreamBuffer::Init(uint32_t bufferType, size_t stride, size_t capacity) {
+    m_bufferType = bufferType;
+    m_stride = stride;
+    m_capacity = capacity;
+    size_t size = regionCount * m_capacity * m_stride;
+
+    glGenBuffers(1, &m_buffer);
+    Bind();
+    m_persistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+    if (m_persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(m_bufferType, size, nullptr, flags);
+        m_mapped = static_cast<uint8_t*>(glMapBufferRange(m_bufferType, 0, size, flags));
+        if (!m_mapped) {
+            SPDLOG_ERROR("failed to map the stream buffer persistently");
+            return false;
+        }
+    }
+    else {
+        glBufferData(m_bufferType, size, nullptr, GL_STREAM_DRAW);
+    }
+    SPDLOG_INFO("stream buffer : {} regions of {} elements, {}", regionCount, m_capacity,
+                m_persistent ? "persistently mapped" : "mapped per write");
+    return true;
+}
+
+void StreamBuffer::WaitRegion(int32_t region) {
+    if (!m_fences[region])
+        return;
+    // a frame or two behind : the region is usually free already, the first wait flushes the fence
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (true) {
+        GLenum status = glClientWaitSync(m_fences[region], flags, 1'000'000);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            break;
+        if (status == GL_WAIT_FAILED) {
+            SPDLOG_ERROR("failed to wait for the stream buffer region {}", region);
+            break;
+        }
+        flags = 0;
+    }
+    glDeleteSync(m_fences[region]);
+    m_fences[region] = nullptr;
+}
+
+void* StreamBuffer::BeginWrite(size_t count) {
+    if (count > m_capacity)
+        return nullptr;
+    m_region = (m_region + 1) % regionCount;
+    WaitRegion(m_region);
+
+    size_t offset = m_region * m_capacity * m_stride;
+    if (m_persistent)
+        return m_mapped + offset;
+
+    // the fence already orders the write : the driver need not synchronize nor keep the old contents
+    Bind();
+    return glMapBufferRange(m_bufferType, offset, count * m_stride,
+                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+int32_t StreamBuffer::EndWrite() {
+    if (!m_persistent) {
+        Bind();
+        glUnmapBuffer(m_bufferType);
+    }
+    return static_cast<int32_t>(m_region * m_capacity);
+}
+
+void StreamBuffer::Fence() {
+    if (m_fences[m_region])
+        glDeleteSync(m_fences[m_region]);
+    m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,46 @@
+#ifndef __STREAM_BUFFER_H__
+#define __STREAM_BUFFER_H__
+
+#include "common.h"
+
+// Vertex stream rewritten every frame without allocating : one buffer split in regions used in turn.
+// A region is written while the GPU still reads the previous ones, a fence per region tells when it
+// can be reused. The buffer stays mapped when persistent mapping is available (GL 4.4 or
+// ARB_buffer_storage), otherwise each region is mapped unsynchronized for its write.
+CLASS_PTR(StreamBuffer)
+class StreamBuffer {
+public:
+    static StreamBufferUPtr Create(uint32_t bufferType, size_t stride, size_t capacity);
+    ~StreamBuffer();
+
+    uint32_t Get() const { return m_buffer; }
+    size_t GetStride() const { return m_stride; }
+    size_t GetCapacity() const { return m_capacity; }
+    bool IsPersistent() const { return m_persistent; }
+    void Bind() const;
+
+    // region of the next count elements, waits until the GPU is done with it; nullptr if count exceeds the capacity
+    void* BeginWrite(size_t count);
+    // returns the first element of the written region, the draws read it from there
+    int32_t EndWrite();
+    // after the last draw that reads the written region
+    void Fence();
+
+private:
+    StreamBuffer() {}
+    bool Init(uint32_t bufferType, size_t stride, size_t capacity);
+    void WaitRegion(int32_t region);
+
+    static constexpr int32_t regionCount = 3;
+
+    uint32_t m_buffer {0};
+    uint32_t m_bufferType {0};
+    size_t m_stride {0};
+    size_t m_capacity {0};      // elements per region
+    bool m_persistent {false};
+    uint8_t* m_mapped {nullptr}; // whole buffer while persistently mapped
+    int32_t m_region {regionCount - 1};
+    GLsync m_fences[regionCount] {};
+};
+
+#endif // __STREAM_BUFFER_H__
@@ -50,6 +50,10 @@ void Texture::SetTextureFormat(int width, int height, uint32_t format)
         glTexImage2D(GL_TEXTURE_2D, 0, format, // RGBA? ==> 4bytes : efficient
             m_width, m_height, 0,
             format, GL_FLOAT, nullptr);
+    else if (format == GL_R32F)
+        glTexImage2D(GL_TEXTURE_2D, 0, format, // one float channel, as smoothed depth
+            m_width, m_height, 0,
+            GL_RED, GL_FLOAT, nullptr);
 }
 
 void Texture::CreateTexture() {
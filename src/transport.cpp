@@ -0,0 +1,204 @@
+#include "transport.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+static void CloseSocket(SOCKET socket) { closesocket(socket); }
+static std::string SocketError() { return std::to_string(WSAGetLastError()); }
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int SOCKET;
+int const INVALID_SOCKET = -1;
+static void CloseSocket(SOCKET socket) { close(socket); }
+static std::string SocketError() { return strerror(errno); }
+#endif
+
+// how long a rank waits for the lower ranks to start listening
+int32_t const connectRetries = 600;
+std::chrono::milliseconds const connectRetryDelay(50);
+
+static bool WriteAll(SOCKET socket, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        int written = send(socket, bytes, static_cast<int>(std::min<size_t>(size, INT32_MAX)), 0);
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool ReadAll(SOCKET socket, void *data, size_t size)
+{
+    char *bytes = static_cast<char *>(data);
+    while (size > 0)
+    {
+        int count = recv(socket, bytes, static_cast<int>(std::min<size_t>(size, INT32_MAX)), 0);
+        if (count <= 0)
+            return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+static sockaddr_un SocketAddress(const std::string &path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+bool Transport::Exchange(int32_t peer, const std::vector<uint8_t> &message, std::vector<uint8_t> &received)
+{
+    if (m_rank < peer)
+        return Send(peer, message) && Receive(peer, received);
+    return Receive(peer, received) && Send(peer, message);
+}
+
+UnixSocketTransportUPtr UnixSocketTransport::Create(const std::string &directory, int32_t rank, int32_t size)
+{
+    if ((size < 1) || (rank < 0) || (rank >= size))
+    {
+        SPDLOG_ERROR("invalid rank {} of {}", rank, size);
+        return nullptr;
+    }
+    auto transport = UnixSocketTransportUPtr(new UnixSocketTransport(rank, size));
+    if (!transport->Init(directory))
+        return nullptr;
+    return std::move(transport);
+}
+
+UnixSocketTransport::~UnixSocketTransport()
+{
+    for (SOCKET socket : m_sockets)
+        if (socket != INVALID_SOCKET)
+            CloseSocket(socket);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+std::string UnixSocketTransport::GetSocketPath(int32_t rank) const
+{
+    return m_directory + "/rank" + std::to_string(rank) + ".sock";
+}
+
+bool UnixSocketTransport::Init(const std::string &directory)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error)
+    {
+        SPDLOG_ERROR("failed to create transport directory {}: {}", directory, error.message());
+        return false;
+    }
+    m_directory = directory;
+    m_sockets.assign(m_size, INVALID_SOCKET);
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        SPDLOG_ERROR("failed to start winsock");
+        return false;
+    }
+#endif
+
+    // listen before connecting, so higher ranks can queue while this rank waits for lower ones
+    SOCKET listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = SocketAddress(GetSocketPath(m_rank));
+    std::filesystem::remove(address.sun_path, error);
+    if ((listener == INVALID_SOCKET) ||
+        (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) ||
+        (listen(listener, m_size) != 0))
+    {
+        SPDLOG_ERROR("failed to listen on {}: {}", address.sun_path, SocketError());
+        if (listener != INVALID_SOCKET)
+            CloseSocket(listener);
+        return false;
+    }
+
+    for (int32_t peer = 0; peer < m_rank; ++peer)
+    {
+        sockaddr_un peerAddress = SocketAddress(GetSocketPath(peer));
+        SOCKET connection = INVALID_SOCKET;
+        for (int32_t attempt = 0; attempt < connectRetries; ++attempt)
+        {
+            connection = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (connect(connection, reinterpret_cast<sockaddr *>(&peerAddress), sizeof(peerAddress)) == 0)
+                break;
+            CloseSocket(connection);
+            connection = INVALID_SOCKET;
+            std::this_thread::sleep_for(connectRetryDelay);
+        }
+        if ((connection == INVALID_SOCKET) || !WriteAll(connection, &m_rank, sizeof(int32_t)))
+        {
+            SPDLOG_ERROR("rank {} failed to connect to rank {}", m_rank, peer);
+            CloseSocket(listener);
+            return false;
+        }
+        m_sockets[peer] = connection;
+    }
+
+    for (int32_t accepted = m_rank + 1; accepted < m_size; ++accepted)
+    {
+        SOCKET connection = accept(listener, nullptr, nullptr);
+        int32_t peer = -1;
+        if ((connection == INVALID_SOCKET) || !ReadAll(connection, &peer, sizeof(int32_t)) ||
+            (peer <= m_rank) || (peer >= m_size) || (m_sockets[peer] != INVALID_SOCKET))
+        {
+            SPDLOG_ERROR("rank {} failed to accept a higher rank", m_rank);
+            if (connection != INVALID_SOCKET)
+                CloseSocket(connection);
+            CloseSocket(listener);
+            return false;
+        }
+        m_sockets[peer] = connection;
+    }
+
+    CloseSocket(listener);
+    std::filesystem::remove(address.sun_path, error);
+    SPDLOG_INFO("transport : rank {} of {} connected", m_rank, m_size);
+    return true;
+}
+
+bool UnixSocketTransport::Send(int32_t peer, const std::vector<uint8_t> &message)
+{
+    uint64_t size = message.size();
+    if (!WriteAll(m_sockets[peer], &size, sizeof(uint64_t)) || !WriteAll(m_sockets[peer], message.data(), size))
+    {
+        SPDLOG_ERROR("rank {} failed to send to rank {}", m_rank, peer);
+        return false;
+    }
+    return true;
+}
+
+bool UnixSocketTransport::Receive(int32_t peer, std::vector<uint8_t> &message)
+{
+    uint64_t size = 0;
+    if (!ReadAll(m_sockets[peer], &size, sizeof(uint64_t)))
+    {
+        SPDLOG_ERROR("rank {} failed to receive from rank {}", m_rank, peer);
+        return false;
+    }
+    message.resize(size);
+    if (!ReadAll(m_sockets[peer], message.data(), size))
+    {
+        SPDLOG_ERROR("rank {} failed to receive from rank {}", m_rank, peer);
+        return false;
+    }
+    return true;
+}
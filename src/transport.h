@@ -0,0 +1,57 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include "common.h"
+
+// Point to point messages between the solver processes of one decomposed scene.
+// Every process has a rank in [0, size). Messages are whole byte buffers.
+CLASS_PTR(Transport)
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    int32_t Rank() const { return m_rank; }
+    int32_t Size() const { return m_size; }
+
+    virtual bool Send(int32_t peer, const std::vector<uint8_t> &message) = 0;
+    virtual bool Receive(int32_t peer, std::vector<uint8_t> &message) = 0;
+
+    // send and receive one message with peer, the lower rank sends first
+    // so that chains of exchanges between neighbors never wait on each other
+    bool Exchange(int32_t peer, const std::vector<uint8_t> &message, std::vector<uint8_t> &received);
+
+protected:
+    Transport(int32_t rank, int32_t size) : m_rank(rank), m_size(size) {}
+
+    int32_t m_rank {0};
+    int32_t m_size {1};
+};
+
+// Stream sockets in a directory shared by the processes of one host (AF_UNIX, Windows 10 and later included) :
+// each rank listens on <directory>/rank<r>.sock, connects to every lower rank and accepts the higher ones.
+CLASS_PTR(UnixSocketTransport)
+class UnixSocketTransport : public Transport
+{
+public:
+    static UnixSocketTransportUPtr Create(const std::string &directory, int32_t rank, int32_t size);
+    ~UnixSocketTransport() override;
+
+    bool Send(int32_t peer, const std::vector<uint8_t> &message) override;
+    bool Receive(int32_t peer, std::vector<uint8_t> &message) override;
+
+private:
+    UnixSocketTransport(int32_t rank, int32_t size) : Transport(rank, size) {}
+    bool Init(const std::string &directory);
+    std::string GetSocketPath(int32_t rank) const;
+
+    std::string m_directory;
+#ifdef _WIN32
+    using SocketHandle = uintptr_t;    // SOCKET
+#else
+    using SocketHandle = int;
+#endif
+    std::vector<SocketHandle> m_sockets;    // connected socket of each peer, invalid for self
+};
+
+#endif // __TRANSPORT_H__